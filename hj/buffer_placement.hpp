@@ -0,0 +1,224 @@
+#pragma once
+
+#include "buffer_tracking.hpp"
+#include "cl.hpp"
+#include "join_context.hpp"
+#include "mapped_view.hpp"
+#include "param.hpp"
+#include "step_graph.hpp"
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+// Where the join buffers live. The modes create every intermediate with
+// ALLOC_HOST_PTR (or plain device memory) up front, whichever device ends up
+// using it. Once the step shares are known, place_buffers reallocates each
+// intermediate for its main consumer: host memory for a device that shares it
+// with the host, device memory for a discrete GPU. BufferMigrator then moves
+// the table and intermediates (clEnqueueMigrateMemObjects) to a step's device
+// ahead of the step, and counts the bytes moved per step. R and S are the
+// host's Tuple arrays (USE_HOST_PTR) and stay put.
+
+// One JoinBuffers member and the steps whose kernels take it
+struct JoinBufferUse {
+  const char *name;
+  cl::Buffer JoinBuffers::*buffer;
+  double bytes;
+  bool input; // R/S tuples
+  bool whole; // hash table arrays: any use touches all of it
+  std::vector<int> steps;
+};
+
+inline std::vector<JoinBufferUse> join_buffer_uses(const TableSize &t) {
+  const double R = 4.0 * R_LENGTH, S = 4.0 * S_LENGTH;
+  const double tuple = sizeof(Tuple);
+  const double results = S * MAX_RIDS_PER_KEY;
+  typedef JoinBuffers B;
+  return {
+      {"R", &B::R, tuple * R_LENGTH, true, false, {JOIN_B1, JOIN_B3, JOIN_B4}},
+      {"R_bucket_ids", &B::R_bucket_ids, R, false, false,
+       {JOIN_B1, JOIN_B2, JOIN_B3, JOIN_B4}},
+      {"key_indices", &B::key_indices, R, false, false, {JOIN_B3, JOIN_B4}},
+      {"bucket_total", &B::bucket_total, 4.0 * t.buckets, false, true,
+       {JOIN_B2, JOIN_P2}},
+      {"bucket_keys", &B::bucket_keys, 4.0 * t.key_slots(), false, true,
+       {JOIN_B3, JOIN_P3}},
+      {"bucket_key_rids", &B::bucket_key_rids, 4.0 * t.rid_slots(), false,
+       true, {JOIN_B4, JOIN_P4}},
+      {"S", &B::S, tuple * S_LENGTH, true, false, {JOIN_P1, JOIN_P3}},
+      {"S_bucket_ids", &B::S_bucket_ids, S, false, false,
+       {JOIN_P1, JOIN_P2, JOIN_P3, JOIN_P4}},
+      {"S_key_indices", &B::S_key_indices, S, false, false, {JOIN_P3, JOIN_P4}},
+      {"S_match_found", &B::S_match_found, S, false, false, {JOIN_P3, JOIN_P4}},
+      {"result_rid", &B::result_rid, results, false, false, {JOIN_P4}},
+      {"result_count", &B::result_count, S, false, false, {JOIN_P4}},
+  };
+}
+
+inline bool uses_step(const JoinBufferUse &use, int step) {
+  for (int s : use.steps) {
+    if (s == step)
+      return true;
+  }
+  return false;
+}
+
+// Queue slot doing most of the work on a buffer: STEP_GPU if any step using
+// it gives the GPU side more than half
+inline int consumer_queue(const JoinBufferUse &use, const StepShares &shares) {
+  for (int s : use.steps) {
+    if (shares.gpu[s] > 50)
+      return STEP_GPU;
+  }
+  return STEP_CPU;
+}
+
+// Host memory for a device that shares it with the host (a CPU, an
+// integrated GPU), device memory for a discrete GPU
+inline cl_mem_flags placement_flags(const cl::Device &device) {
+  return CL_MEM_READ_WRITE |
+         (shares_host_memory(device) ? CL_MEM_ALLOC_HOST_PTR : 0);
+}
+
+// memtrack name of a buffer place_buffers reallocated
+inline std::string placed_name(const JoinBufferUse &use) {
+  return std::string(use.name) + " (placed)";
+}
+
+// placement_flags of the consumer of `use` if `buf`, one of the
+// intermediates, was created for the other kind of memory; 0 if it stays
+inline cl_mem_flags replacement_flags(const JoinBufferUse &use,
+                                      const cl::Buffer &buf,
+                                      std::vector<cl::CommandQueue> &queues,
+                                      const StepShares &shares) {
+  const cl_mem_flags host = CL_MEM_ALLOC_HOST_PTR | CL_MEM_USE_HOST_PTR;
+  if (use.input || buf() == NULL)
+    return 0;
+  cl::CommandQueue &queue = queues[consumer_queue(use, shares)];
+  cl_mem_flags want = placement_flags(queue.getInfo<CL_QUEUE_DEVICE>());
+  cl_mem_flags have = buf.getInfo<CL_MEM_FLAGS>();
+  return ((have & host) != 0) == ((want & host) != 0) ? 0 : want;
+}
+
+inline void print_placement(size_t moved, size_t bytes) {
+  std::cout << "Buffer placement: " << moved << " buffers reallocated ("
+            << bytes / (1 << 20) << " MB)" << std::endl;
+}
+
+// Copy of `in` with every intermediate whose creation flags do not suit its
+// consumer reallocated with placement_flags; the old contents are copied, so
+// a reset table stays reset and a built one stays built. Unset buffers and
+// the inputs are left alone. Reallocated buffers are recorded in memtrack
+// under placed_name.
+inline JoinBuffers place_buffers(const cl::Context &context,
+                                 std::vector<cl::CommandQueue> &queues,
+                                 const JoinBuffers &in,
+                                 const StepShares &shares) {
+  JoinBuffers out = in;
+  size_t moved = 0, bytes = 0;
+  for (const JoinBufferUse &use : join_buffer_uses(in.table)) {
+    cl::Buffer &buf = out.*use.buffer;
+    cl_mem_flags want = replacement_flags(use, buf, queues, shares);
+    if (want == 0)
+      continue;
+    cl::CommandQueue &queue = queues[consumer_queue(use, shares)];
+    size_t size = buf.getInfo<CL_MEM_SIZE>();
+    cl::Buffer placed(context, want, size);
+    track_buffer(placed_name(use), placed);
+    queue.enqueueCopyBuffer(buf, placed, 0, 0, size);
+    buf = placed;
+    moved++;
+    bytes += size;
+  }
+  for (cl::CommandQueue &queue : queues)
+    queue.finish();
+  print_placement(moved, bytes);
+  return out;
+}
+
+// place_buffers for a join that starts from jc.reset(), with the
+// reallocated buffers pooled in `jc` by name and flags (JoinContext::placed).
+// Repeated calls (every --search candidate, then the final run) reuse them:
+// nothing is allocated or copied after the first call for a placement. A
+// pooled buffer resets like the one it stands in for, and the intermediates
+// without a reset pattern are written before they are read.
+inline JoinBuffers place_buffers(JoinContext &jc, const JoinBuffers &in,
+                                 const StepShares &shares,
+                                 bool report = true) {
+  JoinBuffers out = in;
+  size_t moved = 0, bytes = 0;
+  for (const JoinBufferUse &use : join_buffer_uses(in.table)) {
+    cl::Buffer &buf = out.*use.buffer;
+    cl_mem_flags want = replacement_flags(use, buf, jc.queues(), shares);
+    if (want == 0)
+      continue;
+    std::string name = placed_name(use) +
+                       (want & CL_MEM_ALLOC_HOST_PTR ? " host" : " device");
+    buf = jc.placed(name, buf, want);
+    moved++;
+    bytes += buf.getInfo<CL_MEM_SIZE>();
+  }
+  if (report)
+    print_placement(moved, bytes);
+  return out;
+}
+
+class BufferMigrator {
+public:
+  explicit BufferMigrator(const JoinBuffers &bufs) : bufs_(bufs) {}
+
+  // Hook for add_shares_plan. Every buffer starts on queue 0, where the host
+  // filled it. A step placed whole migrates the buffers it uses that were
+  // last on another queue; a split step leaves them shared. Readers on other
+  // queues are ordered by the plan's dependencies, apart from b2/p2, which
+  // do not touch their buffers.
+  StepWrap hook() {
+    owner_.clear();
+    return [this](int step, size_t queue, bool whole, StepFn fn) {
+      return wrap(step, queue, whole, fn);
+    };
+  }
+
+  size_t bytes(int step) const { return bytes_[step]; }
+
+  void print(std::ostream &out) const {
+    out << "Migrated (MB):";
+    for (int i = 0; i < NUM_JOIN_STEPS; i++)
+      out << " " << join_step_name(i) << ":" << bytes_[i] / (1 << 20);
+    out << std::endl;
+  }
+
+private:
+  StepFn wrap(int step, size_t queue, bool whole, StepFn fn) {
+    std::vector<cl::Memory> mems;
+    size_t bytes = 0;
+    for (const JoinBufferUse &use : join_buffer_uses(bufs_.table)) {
+      const cl::Buffer &buf = bufs_.*use.buffer;
+      if (use.input || buf() == NULL || !uses_step(use, step))
+        continue;
+      int &owner = owner_[use.name];
+      if (!whole) {
+        owner = -1;
+      } else if (owner != (int)queue) {
+        owner = (int)queue;
+        mems.push_back(buf);
+        bytes += buf.getInfo<CL_MEM_SIZE>();
+      }
+    }
+    if (mems.empty())
+      return fn;
+    return [this, step, fn, mems, bytes](cl::CommandQueue &q, const Morsel &r,
+                                         const std::vector<cl::Event> &wait) {
+      cl::Event migrated;
+      q.enqueueMigrateMemObjects(mems, 0, &wait, &migrated);
+      bytes_[step] += bytes;
+      return fn(q, r, {migrated});
+    };
+  }
+
+  JoinBuffers bufs_;
+  std::map<std::string, int> owner_;
+  size_t bytes_[NUM_JOIN_STEPS] = {};
+};
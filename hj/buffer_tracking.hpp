@@ -0,0 +1,27 @@
+#pragma once
+
+#include "cl.hpp"
+#include "mem_tracker.hpp"
+
+#include <string>
+
+// memtrack records of cl::Buffers. A runtime-allocated buffer counts as
+// OpenCL memory; a USE_HOST_PTR one wraps a host array that is counted
+// where it was allocated, and is skipped.
+
+inline bool tracked(const cl::Buffer &buf) {
+  return !(buf.getInfo<CL_MEM_FLAGS>() & CL_MEM_USE_HOST_PTR);
+}
+
+// Records a buffer under `name` unless it wraps host memory
+inline void track_buffer(const std::string &name, const cl::Buffer &buf) {
+  if (tracked(buf))
+    memtrack::tracker().add(name, memtrack::OPENCL,
+                            buf.getInfo<CL_MEM_SIZE>());
+}
+
+// Drops a buffer recorded by track_buffer once it is released
+inline void untrack_buffer(const std::string &name, const cl::Buffer &buf) {
+  if (tracked(buf))
+    memtrack::tracker().sub(name, buf.getInfo<CL_MEM_SIZE>());
+}
@@ -0,0 +1,275 @@
+#pragma once
+
+#include "host_join.hpp"
+#include "hugepage.hpp"
+
+#include <algorithm>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Experimental coroutine-interleaved probe (AMAC-style latency hiding).
+// Each S lookup is a coroutine that issues a prefetch for the next cache line
+// it needs (bucket, then rid list) and suspends; the interleaver keeps a
+// group of lookups in flight and resumes them round-robin, so by the time a
+// lookup runs again its line has arrived. Multi-step probes (linear probing
+// into the next bucket, then the rid list) are just more suspend points.
+
+namespace coro_detail {
+
+// Coroutine frames are all the same size; recycle them instead of hitting
+// malloc once per S tuple
+class FramePool {
+public:
+  ~FramePool() {
+    for (void *p : free_)
+      ::operator delete(p);
+  }
+
+  void *alloc(size_t n) {
+    if (n > block_) {
+      for (void *p : free_)
+        ::operator delete(p);
+      free_.clear();
+      block_ = n;
+    }
+    if (!free_.empty()) {
+      void *p = free_.back();
+      free_.pop_back();
+      return p;
+    }
+    return ::operator new(block_);
+  }
+
+  void release(void *p, size_t n) {
+    if (n < block_) {
+      ::operator delete(p);
+      return;
+    }
+    free_.push_back(p);
+  }
+
+private:
+  std::vector<void *> free_;
+  size_t block_{0};
+};
+
+inline FramePool &frame_pool() {
+  thread_local FramePool pool;
+  return pool;
+}
+
+} // namespace coro_detail
+
+class ProbeTask {
+public:
+  struct promise_type {
+    ProbeTask get_return_object() {
+      return ProbeTask(
+          std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+
+    static void *operator new(size_t n) {
+      return coro_detail::frame_pool().alloc(n);
+    }
+    static void operator delete(void *p, size_t n) {
+      coro_detail::frame_pool().release(p, n);
+    }
+  };
+
+  ProbeTask() = default;
+  explicit ProbeTask(std::coroutine_handle<promise_type> h) : handle_(h) {}
+  ProbeTask(ProbeTask &&other) noexcept
+      : handle_(std::exchange(other.handle_, nullptr)) {}
+  ProbeTask &operator=(ProbeTask &&other) noexcept {
+    if (this != &other) {
+      if (handle_)
+        handle_.destroy();
+      handle_ = std::exchange(other.handle_, nullptr);
+    }
+    return *this;
+  }
+  ProbeTask(const ProbeTask &) = delete;
+  ProbeTask &operator=(const ProbeTask &) = delete;
+  ~ProbeTask() {
+    if (handle_)
+      handle_.destroy();
+  }
+
+  bool active() const { return handle_ && !handle_.done(); }
+  void resume() { handle_.resume(); }
+
+private:
+  std::coroutine_handle<promise_type> handle_;
+};
+
+// One S lookup: bucket -> key slot (-> next bucket ...) -> rid list -> emit
+inline ProbeTask probe_lookup(const HostHashTable &table, Tuple s, size_t pos,
+                              SparseResult &res) {
+  uint32_t bucket_id = table.bucket_of(s.key);
+  int64_t slot = -1;
+  for (uint32_t probe = 0; probe < table.num_buckets; probe++) {
+    const uint32_t *slots =
+        &table.bucket_keys[(size_t)bucket_id * MAX_KEYS_PER_BUCKET];
+    __builtin_prefetch(slots);
+    co_await std::suspend_always{};
+
+    for (int i = 0; i < MAX_KEYS_PER_BUCKET; i++) {
+      if (slots[i] == s.key) {
+        slot = (int64_t)bucket_id * MAX_KEYS_PER_BUCKET + i;
+        break;
+      }
+      if (slots[i] == EMPTY_SLOT)
+        co_return;
+    }
+    if (slot >= 0)
+      break;
+    bucket_id = (bucket_id + 1) % table.num_buckets;
+  }
+  if (slot < 0)
+    co_return;
+
+  const uint32_t *rids = &table.bucket_key_rids[slot * table.rids_per_key];
+  __builtin_prefetch(rids);
+  co_await std::suspend_always{};
+
+  size_t base = pos * MAX_RIDS_PER_KEY;
+  uint32_t i;
+  for (i = 0; i < table.rids_per_key; i++) {
+    if (rids[i] == EMPTY_SLOT)
+      break;
+    res.rid[base + i] = rids[i];
+  }
+  res.count[pos] = i;
+}
+
+// Keep `group` lookups in flight over S[begin, end) and resume them
+// round-robin; a finished slot immediately starts the next tuple
+inline void probe_interleaved(const HostHashTable &table,
+                              const huge_vector<Tuple> &S, size_t begin,
+                              size_t end, size_t group, SparseResult &res) {
+  std::vector<ProbeTask> inflight(group);
+  size_t next = begin;
+  size_t active = 0;
+  for (size_t g = 0; g < group && next < end; g++, next++, active++)
+    inflight[g] = probe_lookup(table, S[next], next, res);
+
+  while (active > 0) {
+    for (size_t g = 0; g < group; g++) {
+      ProbeTask &task = inflight[g];
+      if (!task.active())
+        continue;
+      task.resume();
+      if (!task.active()) {
+        if (next < end) {
+          task = probe_lookup(table, S[next], next, res);
+          next++;
+        } else {
+          task = ProbeTask();
+          active--;
+        }
+      }
+    }
+  }
+}
+
+// Group prefetching baseline: prefetch the buckets of a whole group, then
+// the rid lists, then emit
+inline void probe_prefetch(const HostHashTable &table,
+                           const huge_vector<Tuple> &S, size_t begin,
+                           size_t end, size_t group, SparseResult &res) {
+  std::vector<int64_t> slots(group);
+  for (size_t g0 = begin; g0 < end; g0 += group) {
+    size_t n = std::min(group, end - g0);
+    for (size_t g = 0; g < n; g++)
+      __builtin_prefetch(
+          &table.bucket_keys[(size_t)table.bucket_of(S[g0 + g].key) *
+                             MAX_KEYS_PER_BUCKET]);
+    for (size_t g = 0; g < n; g++) {
+      slots[g] = table.find(S[g0 + g].key);
+      if (slots[g] >= 0)
+        __builtin_prefetch(
+            &table.bucket_key_rids[slots[g] * table.rids_per_key]);
+    }
+    for (size_t g = 0; g < n; g++) {
+      if (slots[g] < 0)
+        continue;
+      const uint32_t *rids =
+          &table.bucket_key_rids[slots[g] * table.rids_per_key];
+      size_t pos = g0 + g;
+      size_t base = pos * MAX_RIDS_PER_KEY;
+      uint32_t i;
+      for (i = 0; i < table.rids_per_key; i++) {
+        if (rids[i] == EMPTY_SLOT)
+          break;
+        res.rid[base + i] = rids[i];
+      }
+      res.count[pos] = i;
+    }
+  }
+}
+
+// Plain vs group-prefetching vs coroutine-interleaved probe over the same
+// host table, each driven by the morsel scheduler with cfg.threads threads
+inline void run_probe_benchmark(const huge_vector<Tuple> &R,
+                                const huge_vector<Tuple> &S,
+                                const MorselJoinConfig &cfg) {
+  util::Timer timer;
+  HostHashTable table(cfg.table);
+  SparseResult res;
+
+  timer.reset();
+  build_host_table(R, cfg, table);
+  std::cout << "Build: " << timer.getTimeMilliseconds() << " ms ("
+            << table.num_buckets << " buckets)" << std::endl;
+
+  struct Variant {
+    std::string name;
+    std::function<void(size_t, size_t)> probe;
+  };
+  std::vector<Variant> variants;
+  variants.push_back({"plain", [&](size_t b, size_t e) {
+                        for (size_t i = b; i < e; i++)
+                          probe_tuple(table, S[i], i, res);
+                      }});
+  variants.push_back({"prefetch G=16", [&](size_t b, size_t e) {
+                        probe_prefetch(table, S, b, e, 16, res);
+                      }});
+  const size_t groups[] = {4, 8, 16, 32};
+  for (size_t g : groups) {
+    variants.push_back({"coroutine G=" + std::to_string(g),
+                        [&, g](size_t b, size_t e) {
+                          probe_interleaved(table, S, b, e, g, res);
+                        }});
+  }
+
+  uint64_t expected = 0;
+  for (size_t v = 0; v < variants.size(); v++) {
+    std::fill(res.count.begin(), res.count.end(), 0);
+    MorselScheduler sched(cfg.threads);
+    sched.reset(S.size(), cfg.morsel_size);
+    timer.reset();
+    sched.run([&](unsigned, const Morsel &m) {
+      variants[v].probe(m.begin, m.end);
+    });
+    double ms = timer.getTimeMilliseconds();
+
+    uint64_t produced = 0;
+    for (uint32_t c : res.count)
+      produced += c;
+    if (v == 0)
+      expected = produced;
+    std::cout << variants[v].name << ": " << ms << " ms, "
+              << (ms > 0 ? S.size() / ms / 1000.0 : 0) << " M tuples/s, "
+              << produced << " results"
+              << (produced == expected ? "" : " (MISMATCH)") << std::endl;
+  }
+}
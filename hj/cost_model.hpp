@@ -0,0 +1,322 @@
+#pragma once
+
+#include "cl.hpp"
+#include "hash_kernels.hpp"
+#include "param.hpp"
+#include "table_size.hpp"
+#include "util.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Analytical replacement for the DD/OL/PL sweeps. A short calibration runs
+// every step kernel on every device at two small sizes (profiling events,
+// global offsets into the real buffers) and fits cost(n) = fixed + n * per
+// tuple. Cross-device handoffs are costed per byte from one
+// clEnqueueMigrateMemObjects measurement. The planner then evaluates the DD
+// ratio, the 16 OL placements and the PL per-step ratios for the real R/S
+// sizes instead of running them.
+
+enum CostStep {
+  STEP_B1,
+  STEP_B3,
+  STEP_B4,
+  STEP_P1,
+  STEP_P3,
+  STEP_P4,
+  NUM_STEPS
+};
+
+inline const char *step_name(int step) {
+  static const char *names[NUM_STEPS] = {"b1", "b3", "b4", "p1", "p3", "p4"};
+  return names[step];
+}
+
+struct StepCost {
+  double fixed_ms{0};
+  double per_tuple_ms{0};
+  bool measured{false};
+
+  double at(size_t n) const { return fixed_ms + per_tuple_ms * n; }
+};
+
+struct DeviceCosts {
+  std::string name;
+  StepCost steps[NUM_STEPS];
+};
+
+struct CostModel {
+  DeviceCosts cpu, gpu;
+  double migrate_ms_per_byte{0};
+  TableSize table; // moved whole when build and probe devices differ
+};
+
+struct CostPlan {
+  long dd_ratio{WORK_RATIO_GPU};
+  long ol_placement{2 | 8};
+  long p1_ratio{4}, p3_ratio{4}, p4_ratio{2};
+  double dd_ms{0}, ol_ms{0}, pl_ms{0};
+};
+
+// Full-length R (Tuples) and the hash table the kernels run against
+struct CalibrationBuffers {
+  cl::Buffer R;
+  cl::Buffer bucket_keys, bucket_key_rids;
+  TableSize table;
+};
+
+class CostCalibrator {
+public:
+  // Small sizes keep the whole calibration in the tens of milliseconds;
+  // both are multiples of 4096 so every range start suits the hash variants
+  static const size_t SMALL = 16384;
+  static const size_t LARGE = 65536;
+
+  CostCalibrator(const cl::Context &context, const cl::Program &program,
+                 const CalibrationBuffers &bufs)
+      : context_(context), program_(program), bufs_(bufs),
+        hash_keys_(program), b3_(program, "b3"), b4_(program, "b4"),
+        p3_(program, "p3"), p4_(program, "p4") {
+    // R ranges used per device: warm-up + SMALL + LARGE, twice
+    span_ = 2 * (4096 + SMALL + LARGE);
+    cl_mem_flags rw = CL_MEM_READ_WRITE;
+    bucket_ids_ = cl::Buffer(context_, rw, sizeof(uint32_t) * span_);
+    key_indices_ = cl::Buffer(context_, rw, sizeof(int) * span_);
+    match_found_ = cl::Buffer(context_, rw, sizeof(uint32_t) * span_);
+    size_t results = span_ * MAX_RIDS_PER_KEY;
+    result_rid_ = cl::Buffer(context_, rw, sizeof(uint32_t) * results);
+    result_count_ = cl::Buffer(context_, rw, sizeof(uint32_t) * span_);
+  }
+
+  // Measure one device. With build_steps the b-steps insert R ranges into
+  // the table, so the caller must reset it before the real build; without,
+  // the table must already hold R and only p1/p3/p4 are measured. Probes
+  // use R keys, which always hit (a miss in p3 scans the whole table).
+  DeviceCosts calibrate(cl::CommandQueue &queue, const HashVariant &variant,
+                        bool build_steps) {
+    DeviceCosts costs;
+    costs.name = queue.getInfo<CL_QUEUE_DEVICE>().getInfo<CL_DEVICE_NAME>();
+    run_range(queue, variant, build_steps, 4096, nullptr);
+    double small[NUM_STEPS], large[NUM_STEPS];
+    run_range(queue, variant, build_steps, SMALL, small);
+    run_range(queue, variant, build_steps, LARGE, large);
+    for (int s = 0; s < NUM_STEPS; s++) {
+      bool build = s == STEP_B1 || s == STEP_B3 || s == STEP_B4;
+      if (build && !build_steps)
+        continue;
+      StepCost &c = costs.steps[s];
+      c.per_tuple_ms = std::max(0.0, (large[s] - small[s]) / (LARGE - SMALL));
+      c.fixed_ms = std::max(0.0, small[s] - c.per_tuple_ms * SMALL);
+      c.measured = true;
+    }
+    return costs;
+  }
+
+  // Time to make `bytes` written on `from` available on `to`, per byte
+  double migrate_cost(cl::CommandQueue &from, cl::CommandQueue &to) {
+    const size_t bytes = 4u << 20;
+    cl::Buffer buf(context_, CL_MEM_READ_WRITE, bytes);
+    from.enqueueFillBuffer(buf, 0u, 0, bytes);
+    from.finish();
+    std::vector<cl::Memory> objs(1, buf);
+    cl::Event ev;
+    to.enqueueMigrateMemObjects(objs, 0, NULL, &ev);
+    ev.wait();
+    return elapsed_ms(ev) / bytes;
+  }
+
+private:
+  static double elapsed_ms(const cl::Event &ev) {
+    cl_ulong start = ev.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+    cl_ulong end = ev.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+    return (end - start) * 1e-6;
+  }
+
+  // Run every step once over the next n tuples of R
+  void run_range(cl::CommandQueue &queue, const HashVariant &variant,
+                 bool build_steps, size_t n, double *ms) {
+    size_t begin = next_;
+    next_ += n;
+    cl::EnqueueArgs args(queue, cl::NDRange(begin), cl::NDRange(n),
+                         cl::NullRange);
+    cl::Event ev[NUM_STEPS];
+    if (build_steps) {
+      ev[STEP_B1] = hash_keys_(queue, variant, bufs_.R, bucket_ids_,
+                               bufs_.table.buckets, (cl_uint)(begin + n),
+                               (cl_uint)begin);
+      ev[STEP_B3] = b3_(args, bufs_.R, bucket_ids_, bufs_.bucket_keys,
+                        key_indices_, bufs_.table.buckets);
+      ev[STEP_B4] = b4_(args, bufs_.R, bucket_ids_, key_indices_,
+                        bufs_.bucket_key_rids);
+    }
+    ev[STEP_P1] = hash_keys_(queue, variant, bufs_.R, bucket_ids_,
+                             bufs_.table.buckets, (cl_uint)(begin + n),
+                             (cl_uint)begin);
+    ev[STEP_P3] = p3_(args, bufs_.R, bucket_ids_, bufs_.bucket_keys,
+                      key_indices_, match_found_, bufs_.table.buckets);
+    ev[STEP_P4] = p4_(args, key_indices_, match_found_, bufs_.bucket_key_rids,
+                      bucket_ids_, result_rid_, result_count_);
+    queue.finish();
+    if (ms == nullptr)
+      return;
+    for (int s = 0; s < NUM_STEPS; s++) {
+      ms[s] = ev[s]() ? elapsed_ms(ev[s]) : 0;
+    }
+  }
+
+  cl::Context context_;
+  cl::Program program_;
+  CalibrationBuffers bufs_;
+  HashKernels hash_keys_;
+  cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer, cl_uint> b3_;
+  cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer> b4_;
+  cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer,
+                  cl_uint>
+      p3_;
+  cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer,
+                  cl::Buffer>
+      p4_;
+  size_t span_{0};
+  size_t next_{0};
+  cl::Buffer bucket_ids_, key_indices_, match_found_;
+  cl::Buffer result_rid_, result_count_;
+};
+
+// Best integer GPU percentage in [1, 99] for running `steps` on both devices
+// side by side (the split is 4096-aligned like the sweeps)
+inline long best_split(const CostModel &m, const std::vector<int> &steps,
+                       size_t total, double *best_ms) {
+  long best = 1;
+  double best_t = -1;
+  for (long r = 1; r <= 99; r++) {
+    size_t gpu = (total * r / 100) / 4096 * 4096;
+    size_t cpu = total - gpu;
+    double tg = 0, tc = 0;
+    for (int s : steps) {
+      tg += m.gpu.steps[s].at(gpu);
+      tc += m.cpu.steps[s].at(cpu);
+    }
+    double t = std::max(tg, tc);
+    if (best_t < 0 || t < best_t) {
+      best_t = t;
+      best = r;
+    }
+  }
+  if (best_ms != nullptr)
+    *best_ms = best_t;
+  return best;
+}
+
+inline CostPlan plan_from_model(const CostModel &m) {
+  CostPlan plan;
+  plan.dd_ratio = best_split(m, {STEP_P1, STEP_P3, STEP_P4}, S_LENGTH,
+                             &plan.dd_ms);
+
+  double t1, t3, t4;
+  plan.p1_ratio = best_split(m, {STEP_P1}, S_LENGTH, &t1);
+  plan.p3_ratio = best_split(m, {STEP_P3}, S_LENGTH, &t3);
+  plan.p4_ratio = best_split(m, {STEP_P4}, S_LENGTH, &t4);
+  plan.pl_ms = t1 + t3 + t4;
+
+  // OL: b1/p1 stay on the CPU; every device change between consecutive
+  // steps moves the intermediate arrays (and the table halves between the
+  // build and probe devices)
+  if (m.cpu.steps[STEP_B3].measured && m.gpu.steps[STEP_B3].measured) {
+    const double ids = 4.0, table_keys = 4.0 * MAX_KEYS_PER_BUCKET,
+                 table_rids = table_keys * m.table.rids_per_key;
+    double best_t = -1;
+    for (int combo = 0; combo < 16; combo++) {
+      bool g[4] = {(combo & 1) != 0, (combo & 2) != 0, (combo & 4) != 0,
+                   (combo & 8) != 0};
+      const DeviceCosts &b3 = g[0] ? m.gpu : m.cpu;
+      const DeviceCosts &b4 = g[1] ? m.gpu : m.cpu;
+      const DeviceCosts &p3 = g[2] ? m.gpu : m.cpu;
+      const DeviceCosts &p4 = g[3] ? m.gpu : m.cpu;
+      double t = m.cpu.steps[STEP_B1].at(R_LENGTH) +
+                 b3.steps[STEP_B3].at(R_LENGTH) +
+                 b4.steps[STEP_B4].at(R_LENGTH) +
+                 m.cpu.steps[STEP_P1].at(S_LENGTH) +
+                 p3.steps[STEP_P3].at(S_LENGTH) +
+                 p4.steps[STEP_P4].at(S_LENGTH);
+      double bytes = 0;
+      bytes += g[0] ? ids * R_LENGTH : 0;                    // b1 -> b3
+      bytes += g[0] != g[1] ? 2 * ids * R_LENGTH : 0;        // b3 -> b4
+      bytes += g[2] ? ids * S_LENGTH : 0;                    // p1 -> p3
+      bytes += g[2] != g[3] ? 3 * ids * S_LENGTH : 0;        // p3 -> p4
+      bytes += g[0] != g[2] ? table_keys * m.table.buckets : 0;
+      bytes += g[1] != g[3] ? table_rids * m.table.buckets : 0;
+      t += bytes * m.migrate_ms_per_byte;
+      if (best_t < 0 || t < best_t) {
+        best_t = t;
+        plan.ol_placement = combo;
+      }
+    }
+    plan.ol_ms = best_t;
+  }
+  return plan;
+}
+
+inline void print_cost_model(const CostModel &m) {
+  std::cout << "Step costs (fixed us + ns/tuple):" << std::endl;
+  const DeviceCosts *devs[2] = {&m.cpu, &m.gpu};
+  const char *labels[2] = {"CPU", "GPU"};
+  for (int d = 0; d < 2; d++) {
+    std::cout << "  " << labels[d] << " (" << devs[d]->name << "):";
+    for (int s = 0; s < NUM_STEPS; s++) {
+      const StepCost &c = devs[d]->steps[s];
+      if (!c.measured)
+        continue;
+      std::cout << " " << step_name(s) << " " << std::fixed
+                << std::setprecision(1) << c.fixed_ms * 1e3 << "+"
+                << std::setprecision(2) << c.per_tuple_ms * 1e6;
+    }
+    std::cout << std::defaultfloat << std::endl;
+  }
+  std::cout << "  Migration: " << m.migrate_ms_per_byte * 1e3 * (1 << 20)
+            << " us/MB" << std::endl;
+}
+
+// "[b3 b4 p3 p4]" with 0 = CPU, 1 = GPU, as printed by the OL sweep
+inline std::string placement_bits(long placement) {
+  std::string bits = "[";
+  for (int i = 0; i < 4; i++)
+    bits += (placement & (1 << i)) ? "1" : "0";
+  return bits + "]";
+}
+
+// Calibrate both devices and plan every mode for the real R/S sizes
+inline CostPlan calibrate_and_plan(const cl::Context &context,
+                                   const cl::Program &program,
+                                   cl::CommandQueue &cpu_queue,
+                                   cl::CommandQueue &gpu_queue,
+                                   const HashVariant &cpu_hash,
+                                   const HashVariant &gpu_hash,
+                                   const CalibrationBuffers &bufs,
+                                   bool build_steps) {
+  util::Timer timer;
+  timer.reset();
+  CostCalibrator cal(context, program, bufs);
+  CostModel m;
+  m.cpu = cal.calibrate(cpu_queue, cpu_hash, build_steps);
+  m.gpu = cal.calibrate(gpu_queue, gpu_hash, build_steps);
+  m.migrate_ms_per_byte = cal.migrate_cost(cpu_queue, gpu_queue);
+  m.table = bufs.table;
+  CostPlan plan = plan_from_model(m);
+  double ms = timer.getTimeMilliseconds();
+
+  std::cout << "\n=== Cost Model Calibration (" << ms << " ms) ==="
+            << std::endl;
+  print_cost_model(m);
+  std::cout << "Plan: DD GPU " << plan.dd_ratio << "% (" << plan.dd_ms
+            << " ms probe), PL GPU p1/p3/p4 " << plan.p1_ratio << "/"
+            << plan.p3_ratio << "/" << plan.p4_ratio << "% (" << plan.pl_ms
+            << " ms probe)";
+  if (build_steps)
+    std::cout << ", OL " << placement_bits(plan.ol_placement) << " ("
+              << plan.ol_ms << " ms)";
+  std::cout << std::endl;
+  return plan;
+}
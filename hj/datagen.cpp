@@ -1,17 +1,18 @@
 #include "hj.hpp"
+#include "hugepage.hpp"
 #include "param.hpp"
 #include <algorithm>
 #include <chrono>
 #include <random>
 #include <unordered_set>
 
-std::vector<Tuple> RGenerator() {
+huge_vector<Tuple> RGenerator() {
   static std::mt19937 rng(static_cast<uint32_t>(
       std::chrono::high_resolution_clock::now().time_since_epoch().count()));
   std::uniform_int_distribution<uint32_t> dist32(0u, 0xFFFFFFFFu);
 
   // R tuple들은 index를 key 값으로 저장
-  std::vector<Tuple> R(R_LENGTH);
+  huge_vector<Tuple> R(R_LENGTH);
   for (int i = 0; i < R_LENGTH; i++) {
     R[i].key = i; // index를 key로 사용
     R[i].rid = dist32(rng) % 1000;
@@ -23,7 +24,7 @@ std::vector<Tuple> RGenerator() {
   return R;
 }
 
-std::vector<Tuple> SGenerator(const std::vector<Tuple> &R) {
+huge_vector<Tuple> SGenerator(const huge_vector<Tuple> &R) {
   static std::mt19937 rng(static_cast<uint32_t>(
       std::chrono::high_resolution_clock::now().time_since_epoch().count() ^
       0x9e3779b9));
@@ -42,7 +43,7 @@ std::vector<Tuple> SGenerator(const std::vector<Tuple> &R) {
 
   const uint32_t U = static_cast<uint32_t>(keys.size());
   if (U == 0) {
-    return std::vector<Tuple>(S_LENGTH); // 비정상 상황: 빈 R. 빈 초기화 반환
+    return huge_vector<Tuple>(S_LENGTH); // 비정상 상황: 빈 R. 빈 초기화 반환
   }
 
   // R_LENGTH:S_LENGTH 비율로 매치
@@ -53,7 +54,7 @@ std::vector<Tuple> SGenerator(const std::vector<Tuple> &R) {
   // remainder를 공정하게 분산하기 위해 키 순서를 셔플
   std::shuffle(keys.begin(), keys.end(), rng);
 
-  std::vector<Tuple> S;
+  huge_vector<Tuple> S;
   S.reserve(S_LENGTH);
 
   // 각 키를 비율에 맞게 S에 할당
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "cl.hpp"
+#include "hash_kernels.hpp"
+#include "morsel.hpp"
+#include "param.hpp"
+#include "step_graph.hpp"
+#include "table_size.hpp"
+#include "util.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// DD probe with dynamic chunking instead of a static WORK_RATIO_GPU split.
+// S is cut into fixed-size chunks behind a shared cursor; one host thread per
+// device queue takes the next chunk as soon as its previous one is done, so
+// the split follows the actual device speeds. Chunks run the staged p1..p4
+// kernels on sub-buffers of the chunk, so devices never write the same
+// memory object at the same time.
+
+// Full-length buffers the probe kernels read and write
+struct DDProbeBuffers {
+  cl::Buffer S; // Tuples
+  cl::Buffer S_bucket_ids, S_key_indices, S_match_found;
+  cl::Buffer bucket_total, bucket_keys, bucket_key_rids;
+  cl::Buffer result_rid, result_count;
+  TableSize table;
+};
+
+struct DDDeviceStats {
+  std::string name;
+  size_t chunks{0};
+  size_t tuples{0};
+};
+
+// Chunks are a multiple of 4096 tuples (the static DD split granularity),
+// which also keeps every chunk start a multiple of the widest hash variant
+inline size_t dd_chunk_size(size_t requested) {
+  return std::max<size_t>(4096, (requested + 4095) / 4096 * 4096);
+}
+
+// Probe all of S across `queues`; variants[i] is the b1/p1 variant for
+// queues[i]. Each thread keeps two chunks in flight so the device does not
+// idle while the host takes the next chunk. Returns per-device stats.
+inline std::vector<DDDeviceStats>
+run_dd_dynamic_probe(const cl::Program &program,
+                     std::vector<cl::CommandQueue> &queues,
+                     const std::vector<HashVariant> &variants,
+                     const DDProbeBuffers &bufs, size_t chunk_size) {
+  ChunkCursor cursor(S_LENGTH, dd_chunk_size(chunk_size));
+  std::vector<DDDeviceStats> stats(queues.size());
+  std::vector<std::exception_ptr> errors(queues.size());
+  std::vector<std::thread> threads;
+
+  for (size_t d = 0; d < queues.size(); d++) {
+    cl::Device device = queues[d].getInfo<CL_QUEUE_DEVICE>();
+    stats[d].name =
+        "[" + std::to_string(d) + "] " + device.getInfo<CL_DEVICE_NAME>();
+    threads.emplace_back([&, d]() {
+      try {
+        // cl::Kernel arguments are per object: every thread needs its own
+        HashKernels hash_keys(program);
+        cl::make_kernel<cl::Buffer, cl::Buffer> p2(program, "p2");
+        cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer,
+                        cl::Buffer, cl_uint>
+            p3(program, "p3");
+        cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer,
+                        cl::Buffer, cl::Buffer>
+            p4(program, "p4");
+        cl::CommandQueue &queue = queues[d];
+
+        std::deque<cl::Event> inflight;
+        Morsel m;
+        while (cursor.next(m)) {
+          const size_t word = sizeof(uint32_t);
+          cl::Buffer S = range_buffer(bufs.S, m, sizeof(Tuple));
+          cl::Buffer ids = range_buffer(bufs.S_bucket_ids, m, word);
+          cl::Buffer key_indices = range_buffer(bufs.S_key_indices, m, word);
+          cl::Buffer match_found = range_buffer(bufs.S_match_found, m, word);
+          cl::Buffer result_rid =
+              range_buffer(bufs.result_rid, m, word * MAX_RIDS_PER_KEY);
+          cl::Buffer result_count = range_buffer(bufs.result_count, m, word);
+          cl::EnqueueArgs args(queue, cl::NDRange(m.size()));
+          hash_keys(queue, variants[d], S, ids, bufs.table.buckets,
+                    (cl_uint)m.size());
+          p2(args, ids, bufs.bucket_total);
+          p3(args, S, ids, bufs.bucket_keys, key_indices, match_found,
+             bufs.table.buckets);
+          inflight.push_back(p4(args, key_indices, match_found,
+                                bufs.bucket_key_rids, ids, result_rid,
+                                result_count));
+          queue.flush();
+          stats[d].chunks++;
+          stats[d].tuples += m.size();
+          if (inflight.size() >= 2) {
+            inflight.front().wait();
+            inflight.pop_front();
+          }
+        }
+        queue.finish();
+      } catch (...) {
+        errors[d] = std::current_exception();
+      }
+    });
+  }
+  for (auto &t : threads)
+    t.join();
+  for (auto &e : errors) {
+    if (e)
+      std::rethrow_exception(e);
+  }
+  return stats;
+}
+
+inline void print_dd_stats(const std::vector<DDDeviceStats> &stats) {
+  for (const auto &s : stats) {
+    std::cout << "  " << s.name << ": " << s.chunks << " chunks, " << s.tuples
+              << " tuples (" << 100.0 * s.tuples / S_LENGTH << "%)"
+              << std::endl;
+  }
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include "buffer_tracking.hpp"
+#include "cl.hpp"
+#include "hash_kernels.hpp"
+#include "param.hpp"
+#include "step_graph.hpp"
+#include "util.hpp"
+
+#include <algorithm>
+#include <vector>
+
+// DD with key-range sharded tables instead of one CPU-built table. The GPU
+// owns buckets [0, boundary) and the CPU the rest, with boundary at
+// `gpu_ratio` percent of the hash space. R and S are hashed on both devices,
+// then routed (route_count, a host scan of the per-block counts,
+// route_scatter) so each device's tuples are contiguous. After that each
+// device builds and probes only its own table, and both run side by side
+// with no table shared between them. The CPU's tuples start at the first
+// ROUTE_BLOCK boundary after the GPU's, so each shard's steps get aligned
+// sub-buffers of their own; the S-side buffers therefore hold
+// shard_slots(S_LENGTH) entries.
+
+// One device's table
+struct ShardTable {
+  cl::Buffer bucket_keys, bucket_key_rids;
+};
+
+// Routed length of n tuples: room for the gap before the CPU part
+inline size_t shard_slots(size_t n) { return n + ROUTE_BLOCK; }
+
+// Start of the CPU part after n_gpu GPU tuples
+inline size_t shard_cpu_begin(size_t n_gpu) {
+  return (n_gpu + ROUTE_BLOCK - 1) / ROUTE_BLOCK * ROUTE_BLOCK;
+}
+
+struct DDShardStats {
+  size_t R_gpu{0}, S_gpu{0}; // tuples routed to the GPU
+  double hash_ms{0}, route_ms{0}, join_ms{0};
+  cl::Buffer S; // routed S: the tuples the result slots belong to
+  size_t S_slots{0}; // length of S and of the result slots
+};
+
+class ShardRouter {
+public:
+  ShardRouter(const cl::Context &context, const cl::Program &program,
+              size_t n)
+      : count_(program, "route_count"), scatter_(program, "route_scatter"),
+        blocks_((n + ROUTE_BLOCK - 1) / ROUTE_BLOCK),
+        counts_(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * blocks_),
+        offsets_(context, CL_MEM_READ_ONLY, sizeof(cl_uint) * blocks_) {}
+
+  // Route n tuples by bucket id, the CPU's from shard_cpu_begin on; returns
+  // how many the GPU owns
+  size_t route(cl::CommandQueue &queue, const cl::Buffer &tuples,
+               const cl::Buffer &bucket_ids, size_t n, cl_uint boundary,
+               const cl::Buffer &out_tuples,
+               const cl::Buffer &out_bucket_ids) {
+    cl::Device device = queue.getInfo<CL_QUEUE_DEVICE>();
+    size_t group = std::min<size_t>(
+        256, device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>());
+    cl::EnqueueArgs args(queue, cl::NDRange(blocks_ * group),
+                         cl::NDRange(group));
+    count_(args, bucket_ids, (cl_uint)n, boundary, counts_);
+    std::vector<cl_uint> counts(blocks_);
+    queue.enqueueReadBuffer(counts_, CL_TRUE, 0, sizeof(cl_uint) * blocks_,
+                            &counts[0]);
+    size_t n_gpu = 0;
+    for (cl_uint &c : counts) {
+      cl_uint block = c;
+      c = (cl_uint)n_gpu;
+      n_gpu += block;
+    }
+    queue.enqueueWriteBuffer(offsets_, CL_TRUE, 0, sizeof(cl_uint) * blocks_,
+                             &counts[0]);
+    scatter_(args, tuples, bucket_ids, (cl_uint)n, boundary,
+             (cl_uint)shard_cpu_begin(n_gpu), offsets_, out_tuples,
+             out_bucket_ids);
+    queue.finish();
+    return n_gpu;
+  }
+
+private:
+  cl::make_kernel<cl::Buffer, cl_uint, cl_uint, cl::Buffer> count_;
+  cl::make_kernel<cl::Buffer, cl::Buffer, cl_uint, cl_uint, cl_uint,
+                  cl::Buffer, cl::Buffer, cl::Buffer>
+      scatter_;
+  size_t blocks_;
+  cl::Buffer counts_, offsets_;
+};
+
+// Join `in` (R/S tuples, the R/S bucket id, S key index and match
+// buffers, results) with tables[STEP_CPU/STEP_GPU]; hash[q] is the b1/p1
+// variant for queues[q]. The S key index, match and result buffers hold
+// shard_slots(S_LENGTH) entries. Hashing uses every queue, the two shards are
+// on queues 0 and 1. Both tables are reset first. Results land at the routed
+// S positions, so they are materialized against stats.S (stats.S_slots
+// entries; the gap has no results).
+inline DDShardStats run_dd_sharded(const cl::Context &context,
+                                   const cl::Program &program,
+                                   std::vector<cl::CommandQueue> &queues,
+                                   const std::vector<HashVariant> &hash,
+                                   const JoinBuffers &in,
+                                   const ShardTable tables[2],
+                                   long gpu_ratio) {
+  DDShardStats stats;
+  cl::CommandQueue &cpu_queue = queues[STEP_CPU];
+  for (int d = STEP_CPU; d <= STEP_GPU; d++) {
+    queues[d].enqueueFillBuffer(tables[d].bucket_keys, 0xffffffffu, 0,
+                                sizeof(uint32_t) * in.table.key_slots());
+    queues[d].enqueueFillBuffer(tables[d].bucket_key_rids, 0xffffffffu, 0,
+                                sizeof(uint32_t) * in.table.rid_slots());
+  }
+  const size_t R_slots = shard_slots(R_LENGTH);
+  stats.S_slots = shard_slots(S_LENGTH);
+  cpu_queue.enqueueFillBuffer(in.result_count, 0u, 0,
+                              sizeof(uint32_t) * stats.S_slots);
+  for (cl::CommandQueue &q : queues)
+    q.finish();
+
+  // Routed copies: each device's tuples contiguous
+  cl_mem_flags rw = CL_MEM_READ_WRITE;
+  cl::Buffer R(context, rw, sizeof(Tuple) * R_slots);
+  cl::Buffer R_ids(context, rw, sizeof(uint32_t) * R_slots);
+  cl::Buffer key_indices(context, rw, sizeof(int) * R_slots);
+  cl::Buffer S(context, rw, sizeof(Tuple) * stats.S_slots);
+  cl::Buffer S_ids(context, rw, sizeof(uint32_t) * stats.S_slots);
+  track_buffer("routed R", R);
+  track_buffer("routed R_bucket_ids", R_ids);
+  track_buffer("routed key_indices", key_indices);
+  track_buffer("routed S", S);
+  track_buffer("routed S_bucket_ids", S_ids);
+
+  // Hash all of R and S, split between all devices
+  JoinSteps hash_steps(program, in);
+  StepGraph hash_graph(queues);
+  std::vector<Morsel> R_parts = split_range({0, R_LENGTH}, gpu_ratio,
+                                            queues.size());
+  std::vector<Morsel> S_parts = split_range({0, S_LENGTH}, gpu_ratio,
+                                            queues.size());
+  for (size_t d = 0; d < queues.size(); d++) {
+    hash_graph.add("b1", d, R_parts[d], hash_steps.b1(hash[d]));
+    hash_graph.add("p1", d, S_parts[d], hash_steps.p1(hash[d]));
+  }
+  stats.hash_ms = hash_graph.run();
+
+  // Route on the CPU device, where R and S live
+  util::Timer timer;
+  timer.reset();
+  cl_uint boundary = (cl_uint)((size_t)in.table.buckets * gpu_ratio / 100);
+  ShardRouter router(context, program, std::max<size_t>(R_LENGTH, S_LENGTH));
+  stats.R_gpu = router.route(cpu_queue, in.R, in.R_bucket_ids, R_LENGTH,
+                             boundary, R, R_ids);
+  stats.S_gpu = router.route(cpu_queue, in.S, in.S_bucket_ids, S_LENGTH,
+                             boundary, S, S_ids);
+  stats.route_ms = timer.getTimeMilliseconds();
+
+  // Build and probe each shard on its own device
+  JoinBuffers routed = in;
+  routed.R = R;
+  routed.R_bucket_ids = R_ids;
+  routed.key_indices = key_indices;
+  routed.S = S;
+  stats.S = S;
+  routed.S_bucket_ids = S_ids;
+  JoinBuffers shard_bufs[2] = {routed, routed};
+  for (int d = STEP_CPU; d <= STEP_GPU; d++) {
+    shard_bufs[d].bucket_keys = tables[d].bucket_keys;
+    shard_bufs[d].bucket_key_rids = tables[d].bucket_key_rids;
+  }
+  JoinSteps cpu_steps(program, shard_bufs[STEP_CPU]);
+  JoinSteps gpu_steps(program, shard_bufs[STEP_GPU]);
+  JoinSteps *steps[2] = {&cpu_steps, &gpu_steps};
+  size_t R_cpu = shard_cpu_begin(stats.R_gpu);
+  size_t S_cpu = shard_cpu_begin(stats.S_gpu);
+  R_parts = {{R_cpu, R_cpu + R_LENGTH - stats.R_gpu}, {0, stats.R_gpu}};
+  S_parts = {{S_cpu, S_cpu + S_LENGTH - stats.S_gpu}, {0, stats.S_gpu}};
+  StepGraph join_graph(queues);
+  for (int d = STEP_CPU; d <= STEP_GPU; d++) {
+    int b3 = join_graph.add("b3", d, R_parts[d], steps[d]->b3());
+    int b4 = join_graph.add("b4", d, R_parts[d], steps[d]->b4(), {b3});
+    int p3 = join_graph.add("p3", d, S_parts[d], steps[d]->p3(), {b3});
+    join_graph.add("p4", d, S_parts[d], steps[d]->p4(), {p3, b4});
+  }
+  stats.join_ms = join_graph.run();
+  // Released on return; routed S lives on in stats.S
+  untrack_buffer("routed R", R);
+  untrack_buffer("routed R_bucket_ids", R_ids);
+  untrack_buffer("routed key_indices", key_indices);
+  untrack_buffer("routed S_bucket_ids", S_ids);
+  return stats;
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include "cl.hpp"
+#include "device_picker.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Devices DD, OL and PL run on. devices[0] is the CPU (the first device of
+// type CL_DEVICE_TYPE_CPU), then comes every other device on its platform,
+// so all of them fit in one context. With --fission the CPU is replaced by
+// its sub-devices (clCreateSubDevices), which gives a heterogeneous-looking
+// set on a machine without a GPU: one sub-device per NUMA node or L3 domain,
+// or N equal parts. The other devices go right after the first sub-device
+// and the remaining sub-devices last, so a real GPU keeps queue 1. Queue 0
+// keeps the CPU role (the build, b1/p1 by default) and queue 1 is the "GPU"
+// the two-device code (OL placement bits, cost model, sharded DD) talks
+// about; queues 2.. share the GPU part of every split with queue 1.
+
+struct FissionSpec {
+  enum Kind { NONE, EQUALLY, NUMA, L3 } kind{NONE};
+  unsigned parts{2}; // EQUALLY only
+};
+
+// "--fission [N|numa|l3]": true if `arg` is a spec and consumed
+inline bool parse_fission_spec(const char *arg, FissionSpec &spec) {
+  if (strcmp(arg, "numa") == 0) {
+    spec.kind = FissionSpec::NUMA;
+  } else if (strcmp(arg, "l3") == 0) {
+    spec.kind = FissionSpec::L3;
+  } else if (atoi(arg) >= 2) {
+    spec.kind = FissionSpec::EQUALLY;
+    spec.parts = atoi(arg);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+inline std::string to_string(const FissionSpec &spec) {
+  switch (spec.kind) {
+  case FissionSpec::EQUALLY:
+    return std::to_string(spec.parts) + " equal parts";
+  case FissionSpec::NUMA:
+    return "NUMA nodes";
+  case FissionSpec::L3:
+    return "L3 domains";
+  default:
+    return "none";
+  }
+}
+
+// `parts` sub-devices with an equal share of the compute units
+inline std::vector<cl::Device> split_device(cl::Device &device,
+                                            unsigned parts) {
+  cl_uint units = device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+  cl_device_partition_property props[] = {
+      CL_DEVICE_PARTITION_EQUALLY,
+      (cl_device_partition_property)std::max(1u, units / parts), 0};
+  std::vector<cl::Device> sub;
+  device.createSubDevices(props, &sub);
+  if (sub.size() < parts) {
+    throw cl::Error(CL_DEVICE_PARTITION_FAILED, "split_device");
+  }
+  sub.resize(parts);
+  return sub;
+}
+
+// One sub-device per NUMA node or L3 domain. A device with a single domain
+// cannot be split that way and throws like split_device.
+inline std::vector<cl::Device> split_by_affinity(cl::Device &device,
+                                                 cl_device_affinity_domain d) {
+  cl_device_partition_property props[] = {
+      CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN,
+      (cl_device_partition_property)d, 0};
+  std::vector<cl::Device> sub;
+  device.createSubDevices(props, &sub);
+  if (sub.size() < 2) {
+    throw cl::Error(CL_DEVICE_PARTITION_FAILED, "split_by_affinity");
+  }
+  return sub;
+}
+
+inline std::vector<cl::Device> split_device(cl::Device &device,
+                                            const FissionSpec &spec) {
+  switch (spec.kind) {
+  case FissionSpec::EQUALLY:
+    return split_device(device, spec.parts);
+  case FissionSpec::NUMA:
+    return split_by_affinity(device, CL_DEVICE_AFFINITY_DOMAIN_NUMA);
+  case FissionSpec::L3:
+    return split_by_affinity(device, CL_DEVICE_AFFINITY_DOMAIN_L3_CACHE);
+  default:
+    return {device};
+  }
+}
+
+// The first CPU device (split by `spec`) with every other device on its
+// platform right after its first part. Throws when there is no CPU or
+// nothing to pair it with: a lone device in both roles would only time a
+// split of itself.
+inline std::vector<cl::Device> pick_devices(std::vector<cl::Device> &all,
+                                            const FissionSpec &spec) {
+  size_t cpu = 0;
+  while (cpu < all.size() &&
+         !(all[cpu].getInfo<CL_DEVICE_TYPE>() & CL_DEVICE_TYPE_CPU))
+    cpu++;
+  if (cpu == all.size())
+    throw cl::Error(CL_DEVICE_NOT_FOUND, "pick_devices: no CPU device");
+  std::vector<cl::Device> set = split_device(all[cpu], spec);
+  cl_platform_id platform = all[cpu].getInfo<CL_DEVICE_PLATFORM>();
+  std::vector<cl::Device> others;
+  for (size_t i = 0; i < all.size(); i++) {
+    if (i != cpu && all[i].getInfo<CL_DEVICE_PLATFORM>() == platform)
+      others.push_back(all[i]);
+  }
+  // A real GPU takes queue 1 ahead of the other CPU sub-devices
+  set.insert(set.begin() + 1, others.begin(), others.end());
+  if (set.size() < 2) {
+    throw cl::Error(CL_DEVICE_NOT_FOUND,
+                    "pick_devices: no second device on the CPU's platform "
+                    "(add one or use --fission)");
+  }
+  return set;
+}
+
+inline void print_device_set(std::vector<cl::Device> &set,
+                             const FissionSpec &spec) {
+  if (spec.kind != FissionSpec::NONE) {
+    std::cout << "Device fission: CPU split into " << to_string(spec)
+              << std::endl;
+  }
+  for (size_t i = 0; i < set.size(); i++) {
+    std::string name;
+    getDeviceName(set[i], name);
+    const char *role = i == 0 ? "CPU" : i == 1 ? "GPU" : "device";
+    std::cout << "Using OpenCL " << role << " [" << i << "]: " << name
+              << std::endl;
+  }
+}
@@ -0,0 +1,169 @@
+#pragma once
+
+#include "cl.hpp"
+#include "hj.hpp"
+#include "hugepage.hpp"
+#include "join_result.hpp"
+#include "mapped_view.hpp"
+#include "morsel.hpp"
+#include "param.hpp"
+#include "util.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+// Dictionary encoding in front of the 32-bit kernels. KeyDictionary gives
+// every distinct R key a dense 32-bit code in first-seen order; R and S are
+// rewritten as Tuples of codes, and an S tuple whose key is not in R is
+// dropped while encoding, before any device work. Keys of any width or
+// spread then join on the 32/32 kernels, and since the codes are dense the
+// table is direct-addressed (direct_build/direct_probe in hj.cl).
+// DictionaryJoin keeps the dictionary and the built table, so every further
+// S joined against the same R is only encoded and probed.
+
+const uint32_t NO_CODE = 0xffffffffu;
+
+template <typename K> class KeyDictionary {
+public:
+  explicit KeyDictionary(const huge_vector<BasicTuple<K, uint32_t>> &R) {
+    codes_.reserve(R.size());
+    for (const BasicTuple<K, uint32_t> &t : R) {
+      if (codes_.emplace(t.key, (uint32_t)keys_.size()).second)
+        keys_.push_back(t.key);
+    }
+  }
+
+  uint32_t size() const { return (uint32_t)keys_.size(); }
+
+  // NO_CODE for a key R does not have
+  uint32_t code(K key) const {
+    auto it = codes_.find(key);
+    return it == codes_.end() ? NO_CODE : it->second;
+  }
+
+  K key(uint32_t code) const { return keys_[code]; }
+
+private:
+  std::unordered_map<K, uint32_t> codes_;
+  std::vector<K> keys_;
+};
+
+// `in` with codes for keys, in order; tuples without a code are dropped.
+// Lookups run on `threads` host threads.
+template <typename K>
+inline huge_vector<Tuple>
+encode_tuples(const KeyDictionary<K> &dict,
+              const huge_vector<BasicTuple<K, uint32_t>> &in,
+              unsigned threads) {
+  std::vector<uint32_t> codes(in.size());
+  MorselScheduler sched(threads);
+  sched.reset(in.size(), 65536);
+  sched.run([&](unsigned, const Morsel &m) {
+    for (size_t i = m.begin; i < m.end; i++)
+      codes[i] = dict.code(in[i].key);
+  });
+  huge_vector<Tuple> out;
+  out.reserve(in.size());
+  for (size_t i = 0; i < in.size(); i++) {
+    if (codes[i] != NO_CODE)
+      out.push_back(Tuple{codes[i], in[i].rid});
+  }
+  return out;
+}
+
+template <typename K> class DictionaryJoin {
+public:
+  // Encodes R and builds its direct table on `queue`'s device
+  DictionaryJoin(const cl::Context &context, cl::CommandQueue &queue,
+                 const cl::Program &program,
+                 const huge_vector<BasicTuple<K, uint32_t>> &R,
+                 unsigned threads)
+      : context_(context), queue_(queue), program_(program),
+        threads_(threads), build_(program, "direct_build"),
+        probe_(program, "direct_probe"), dict_(R) {
+    util::Timer timer;
+    timer.reset();
+    huge_vector<Tuple> R_codes = encode_tuples(dict_, R, threads_);
+    double encode_time = timer.getTimeMilliseconds();
+
+    size_t codes = std::max<size_t>(1, dict_.size());
+    rid_counts_ =
+        cl::Buffer(context_, CL_MEM_READ_WRITE, sizeof(uint32_t) * codes);
+    rids_ = cl::Buffer(context_, CL_MEM_READ_WRITE,
+                       sizeof(uint32_t) * codes * MAX_RIDS_PER_KEY);
+    cl::Buffer R_buf(context_, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
+                     sizeof(Tuple) * R_codes.size(), &R_codes[0]);
+    timer.reset();
+    queue_.enqueueFillBuffer(rid_counts_, 0u, 0, sizeof(uint32_t) * codes);
+    build_(cl::EnqueueArgs(queue_, cl::NDRange(R_codes.size())), R_buf,
+           (cl_uint)R_codes.size(), rid_counts_, rids_);
+    queue_.finish();
+    double build_time = timer.getTimeMilliseconds();
+
+    std::cout << "Dictionary: " << dict_.size() << " codes, R encoded in "
+              << encode_time << " ms; direct table "
+              << (sizeof(uint32_t) * codes * (MAX_RIDS_PER_KEY + 1) >> 20)
+              << " MB, built in " << build_time << " ms" << std::endl;
+  }
+
+  // Join S with R; keys come back decoded
+  std::vector<BasicJoinedTuple<K, uint32_t>>
+  probe(const huge_vector<BasicTuple<K, uint32_t>> &S) {
+    util::Timer timer;
+    timer.reset();
+    huge_vector<Tuple> S_codes = encode_tuples(dict_, S, threads_);
+    double encode_time = timer.getTimeMilliseconds();
+    std::vector<BasicJoinedTuple<K, uint32_t>> out;
+    if (S_codes.empty())
+      return out;
+
+    size_t n = S_codes.size();
+    cl::Buffer S_buf(context_, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
+                     sizeof(Tuple) * n, &S_codes[0]);
+    cl::Buffer result_rid(context_, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                          sizeof(uint32_t) * n * MAX_RIDS_PER_KEY);
+    cl::Buffer result_count(context_,
+                            CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                            sizeof(uint32_t) * n);
+    timer.reset();
+    probe_(cl::EnqueueArgs(queue_, cl::NDRange(n)), S_buf, (cl_uint)n,
+           rid_counts_, rids_, result_rid, result_count);
+    queue_.finish();
+    double probe_time = timer.getTimeMilliseconds();
+
+    timer.reset();
+    ResultCompactor compactor(context_, program_, n);
+    MappedView<JoinedTuple> dense =
+        compactor.compact(queue_, S_buf, result_rid, result_count, n);
+    out.reserve(dense.size());
+    for (const JoinedTuple &jt : dense) {
+      BasicJoinedTuple<K, uint32_t> decoded;
+      decoded.key = dict_.key(jt.key);
+      decoded.ridR = jt.ridR;
+      decoded.ridS = jt.ridS;
+      out.push_back(decoded);
+    }
+    double decode_time = timer.getTimeMilliseconds();
+
+    std::cout << "S encoded in " << encode_time << " ms (" << n << " of "
+              << S.size() << " tuples kept), probe " << probe_time
+              << " ms, compaction and decode " << decode_time << " ms"
+              << std::endl;
+    return out;
+  }
+
+private:
+  cl::Context context_;
+  cl::CommandQueue queue_;
+  cl::Program program_;
+  unsigned threads_;
+  cl::make_kernel<cl::Buffer, cl_uint, cl::Buffer, cl::Buffer> build_;
+  cl::make_kernel<cl::Buffer, cl_uint, cl::Buffer, cl::Buffer, cl::Buffer,
+                  cl::Buffer>
+      probe_;
+  KeyDictionary<K> dict_;
+  cl::Buffer rid_counts_, rids_;
+};
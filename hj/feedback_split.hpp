@@ -0,0 +1,192 @@
+#pragma once
+
+#include "cl.hpp"
+#include "dd_dynamic.hpp"
+#include "param.hpp"
+#include "step_graph.hpp"
+#include "util.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Split that follows the devices while a long probe runs, instead of the
+// ratio a quiet --bench sweep found once. S is cut into chunks and every
+// chunk is split by the current GPU share. The kernel times of each chunk
+// (profiling events) give the throughput of the CPU and of the other queues.
+// A controller smooths them (EWMA) and moves the share towards the balance
+// point by a bounded step per chunk, so when another tenant loads the CPU
+// the share follows within a few chunks. Both sides keep a minimum share to
+// stay measured. Two chunks are in flight: chunk c is split with what was
+// measured up to chunk c-2.
+
+class SplitController {
+public:
+  // `warmup` chunks run at `start` and only measure
+  SplitController(long start, long min_share, double alpha = 0.3,
+                  long max_step = 10, int warmup = 3)
+      : share_(clamp(start, min_share)), min_share_(min_share),
+        alpha_(alpha), max_step_(max_step), warmup_(warmup) {}
+
+  long share() const { return share_; }
+
+  // Tuples and busy ms of one chunk on the CPU (queue 0) and on the other
+  // queues together
+  void update(double cpu_tuples, double cpu_ms, double gpu_tuples,
+              double gpu_ms) {
+    smooth(cpu_rate_, cpu_tuples, cpu_ms);
+    smooth(gpu_rate_, gpu_tuples, gpu_ms);
+    if (++chunks_ <= warmup_ || cpu_rate_ <= 0 || gpu_rate_ <= 0)
+      return;
+    long target = (long)(100 * gpu_rate_ / (gpu_rate_ + cpu_rate_) + 0.5);
+    long step = std::max(-max_step_, std::min(max_step_, target - share_));
+    share_ = clamp(share_ + step, min_share_);
+  }
+
+private:
+  static long clamp(long share, long min_share) {
+    return std::max(min_share, std::min(100 - min_share, share));
+  }
+
+  // Tuples per ms; parts too small to time keep the old estimate
+  void smooth(double &rate, double tuples, double ms) {
+    if (tuples <= 0 || ms <= 0)
+      return;
+    double r = tuples / ms;
+    rate = rate > 0 ? alpha_ * r + (1 - alpha_) * rate : r;
+  }
+
+  long share_, min_share_;
+  double alpha_;
+  long max_step_;
+  int warmup_, chunks_{0};
+  double cpu_rate_{0}, gpu_rate_{0};
+};
+
+// One step of the chunk pipeline, fns[q] for queue q. Stages with the same
+// group share one controller (one split).
+struct FeedbackStage {
+  const char *name;
+  int group;
+  std::vector<StepFn> fns;
+};
+
+struct FeedbackResult {
+  double ms{0};
+  size_t chunks{0};
+  std::vector<std::vector<long>> shares; // per group: the share of each chunk
+};
+
+// Smallest share that still gives the GPU side one 4096-tuple piece
+inline long feedback_min_share(size_t chunk) {
+  return std::max<long>(1, (long)((4096 * 100 + chunk - 1) / chunk));
+}
+
+// Run every chunk through `stages`. `chained`: a queue's parts only depend on
+// its own earlier stages (DD, in-order queues need no wait list); otherwise a
+// stage waits for all parts of the stage before it (PL). The split points
+// move from chunk to chunk, so the stage functions must not share one buffer
+// between queues: JoinSteps steps create sub-buffers of every part as it is
+// enqueued, and split_range keeps their origins 4096-aligned.
+inline FeedbackResult
+run_feedback_probe(std::vector<cl::CommandQueue> &queues,
+                   const std::vector<FeedbackStage> &stages,
+                   std::vector<SplitController> &control, bool chained,
+                   size_t chunk_size) {
+  const size_t n = queues.size(), groups = control.size();
+  const size_t chunk = dd_chunk_size(chunk_size);
+  const size_t num_chunks = (S_LENGTH + chunk - 1) / chunk;
+  struct Pending {
+    std::vector<std::vector<cl::Event>> events; // [group * n + q]
+    std::vector<double> tuples;                 // [group * n + q]
+  };
+  auto busy_ms = [](const std::vector<cl::Event> &events) {
+    double ms = 0;
+    for (const cl::Event &e : events) {
+      ms += (e.getProfilingInfo<CL_PROFILING_COMMAND_END>() -
+             e.getProfilingInfo<CL_PROFILING_COMMAND_START>()) *
+            1e-6;
+    }
+    return ms;
+  };
+  auto collect = [&](Pending &p) {
+    for (size_t g = 0; g < groups; g++) {
+      // The other queues run side by side: their tuples add up over the
+      // slowest one's time
+      double t[2] = {0, 0}, ms[2] = {0, 0};
+      for (size_t q = 0; q < n; q++) {
+        const std::vector<cl::Event> &events = p.events[g * n + q];
+        if (events.empty())
+          continue;
+        cl::Event::waitForEvents(events);
+        t[q > 0] += p.tuples[g * n + q];
+        ms[q > 0] = std::max(ms[q > 0], busy_ms(events));
+      }
+      control[g].update(t[0], ms[0], t[1], ms[1]);
+    }
+  };
+
+  FeedbackResult result;
+  result.shares.resize(groups);
+  std::deque<Pending> inflight;
+  util::Timer timer;
+  timer.reset();
+  for (size_t c = 0; c < num_chunks; c++) {
+    Morsel range = {c * chunk, std::min<size_t>((c + 1) * chunk, S_LENGTH)};
+    std::vector<std::vector<Morsel>> parts(groups);
+    for (size_t g = 0; g < groups; g++) {
+      parts[g] = split_range(range, control[g].share(), n);
+      result.shares[g].push_back(control[g].share());
+    }
+    Pending p;
+    p.events.resize(groups * n);
+    p.tuples.assign(groups * n, 0);
+    std::vector<cl::Event> prev;
+    for (const FeedbackStage &stage : stages) {
+      std::vector<cl::Event> done;
+      // Accelerators first, as in the graph plans
+      for (size_t i = 1; i <= n; i++) {
+        size_t q = i % n;
+        const Morsel &part = parts[stage.group][q];
+        if (part.size() == 0)
+          continue;
+        cl::Event e = stage.fns[q](queues[q], part,
+                                   chained ? std::vector<cl::Event>() : prev);
+        queues[q].flush();
+        p.events[stage.group * n + q].push_back(e);
+        p.tuples[stage.group * n + q] = (double)part.size();
+        done.push_back(e);
+      }
+      prev = done;
+    }
+    inflight.push_back(p);
+    if (inflight.size() >= 2) {
+      collect(inflight.front());
+      inflight.pop_front();
+    }
+  }
+  for (Pending &p : inflight)
+    collect(p);
+  for (cl::CommandQueue &queue : queues)
+    queue.finish();
+  result.ms = timer.getTimeMilliseconds();
+  result.chunks = num_chunks;
+  return result;
+}
+
+// The share of every group over the run, sampled at ten points
+inline void print_feedback(const FeedbackResult &result,
+                           const std::vector<std::string> &group_names) {
+  std::cout << "Feedback split: " << result.chunks << " chunks, " << result.ms
+            << " ms" << std::endl;
+  for (size_t g = 0; g < result.shares.size(); g++) {
+    const std::vector<long> &s = result.shares[g];
+    std::cout << "  " << group_names[g] << " GPU share (%):";
+    size_t stride = std::max<size_t>(1, s.size() / 10);
+    for (size_t c = 0; c < s.size(); c += stride)
+      std::cout << " " << s[c];
+    std::cout << " -> " << s.back() << std::endl;
+  }
+}
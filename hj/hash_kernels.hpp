@@ -0,0 +1,110 @@
+#pragma once
+
+#include "cl.hpp"
+#include "param.hpp"
+#include "util.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// b1/p1 are one multiply-mod per tuple, so with one work-item per tuple the
+// CPU device spends most of its time scheduling work-items. The hash_v*
+// kernels in hj.cl load the keys of VW tuples at once and let each work-item
+// walk `per_item` vectors; the variant is picked per device at runtime.
+
+struct HashVariant {
+  cl_uint width{1};    // keys per load: 1, 4, 8 or 16
+  cl_uint per_item{1}; // vectors per work-item
+};
+
+inline std::string to_string(const HashVariant &v) {
+  return "uint" + (v.width == 1 ? std::string() : std::to_string(v.width)) +
+         " x" + std::to_string(v.per_item);
+}
+
+// Starting point without measuring: CPUs want the native SIMD width and
+// enough work per item to amortise scheduling; GPUs want many work-items
+// with 16-byte loads.
+inline HashVariant default_hash_variant(const cl::Device &device) {
+  HashVariant v;
+  if (device.getInfo<CL_DEVICE_TYPE>() & CL_DEVICE_TYPE_GPU) {
+    v.width = 4;
+    v.per_item = 1;
+    return v;
+  }
+  cl_uint native = device.getInfo<CL_DEVICE_PREFERRED_VECTOR_WIDTH_INT>();
+  v.width = native >= 16 ? 16 : native >= 8 ? 8 : 4;
+  v.per_item = 16;
+  return v;
+}
+
+class HashKernels {
+public:
+  explicit HashKernels(const cl::Program &program)
+      : v1_(program, "hash_v1"), v4_(program, "hash_v4"),
+        v8_(program, "hash_v8"), v16_(program, "hash_v16") {}
+
+  // Hash the keys of tuples[begin, n) into bucket_ids[begin, n) for a table
+  // of `num_buckets` buckets. `begin` is applied as a global work offset and
+  // must be a multiple of width * per_item. The kernel waits on `wait` first.
+  cl::Event operator()(cl::CommandQueue &queue, const HashVariant &v,
+                       const cl::Buffer &tuples, const cl::Buffer &bucket_ids,
+                       cl_uint num_buckets, cl_uint n, cl_uint begin = 0,
+                       const std::vector<cl::Event> &wait = {}) {
+    size_t per_item = (size_t)v.width * v.per_item;
+    cl::EnqueueArgs args(queue, wait, cl::NDRange(begin / per_item),
+                         cl::NDRange((n - begin + per_item - 1) / per_item),
+                         cl::NullRange);
+    switch (v.width) {
+    case 4:
+      return v4_(args, tuples, bucket_ids, n, v.per_item, num_buckets);
+    case 8:
+      return v8_(args, tuples, bucket_ids, n, v.per_item, num_buckets);
+    case 16:
+      return v16_(args, tuples, bucket_ids, n, v.per_item, num_buckets);
+    default:
+      return v1_(args, tuples, bucket_ids, n, v.per_item, num_buckets);
+    }
+  }
+
+  // Time every width x per_item combination on this queue (best of
+  // `repeats`) and return the fastest
+  HashVariant tune(cl::CommandQueue &queue, const cl::Buffer &tuples,
+                   const cl::Buffer &bucket_ids, cl_uint num_buckets,
+                   cl_uint n, int repeats = 3) {
+    const cl_uint widths[] = {1, 4, 8, 16};
+    const cl_uint per_items[] = {1, 4, 16, 64};
+    HashVariant best;
+    double best_ms = -1;
+    util::Timer timer;
+    for (cl_uint w : widths) {
+      for (cl_uint k : per_items) {
+        HashVariant v;
+        v.width = w;
+        v.per_item = k;
+        double ms = -1;
+        for (int r = 0; r < repeats; r++) {
+          timer.reset();
+          (*this)(queue, v, tuples, bucket_ids, num_buckets, n);
+          queue.finish();
+          double t = timer.getTimeMilliseconds();
+          ms = ms < 0 ? t : std::min(ms, t);
+        }
+        std::cout << "  " << to_string(v) << ": " << ms << " ms" << std::endl;
+        if (best_ms < 0 || ms < best_ms) {
+          best_ms = ms;
+          best = v;
+        }
+      }
+    }
+    std::cout << "  fastest: " << to_string(best) << " (" << best_ms << " ms)"
+              << std::endl;
+    return best;
+  }
+
+private:
+  cl::make_kernel<cl::Buffer, cl::Buffer, cl_uint, cl_uint, cl_uint> v1_, v4_,
+      v8_, v16_;
+};
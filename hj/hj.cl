@@ -1,47 +1,100 @@
 #include "param.hpp"
 
-// b1: compute hash bucket number
-__kernel void b1(__global const uint *R_keys, __global uint *bucket_ids) {
-  uint gid = get_global_id(0);
-  if (gid >= R_LENGTH) {
-    return;
-  }
-  uint h = R_keys[gid] * HASH_SEED % (BUCKET_HEADER_NUMBER);
-  bucket_ids[gid] = h;
-}
-
-__kernel void b2(__global const uint *bucket_ids, __global uint *bucket_total) {
-  uint gid = get_global_id(0);
-  if (gid >= R_LENGTH) {
-    return;
-  }
+// Helpers shared by the staged kernels (b1..b4, p1..p4) and the fused
+// build/probe kernels. The staged kernels pass bucket ids, key slots and
+// match flags through global buffers so each step can run on a different
+// device; the fused kernels keep them in registers.
+//
+// R and S are read as the host's Tuple arrays (uint2: key in .x, rid in .y),
+// wrapped in place with CL_MEM_USE_HOST_PTR, so there is no key/rid column
+// copy on the host.
+//
+// Key and rid widths are build options: hj.cl is built as is for 32-bit
+// keys and rids, and with -DKEY_BITS=64 and/or -DRID_BITS=64 by
+// wide_join.hpp. Only the helpers and the fused build/probe kernels are
+// width-generic; a wide tuple is a struct laid out like BasicTuple<K, V>
+// (hj.hpp). The staged, hash_v*, routing and compaction kernels are built
+// for 32/32 only.
+
+#ifndef KEY_BITS
+#define KEY_BITS 32
+#endif
+#ifndef RID_BITS
+#define RID_BITS 32
+#endif
+#define NARROW_TUPLES (KEY_BITS == 32 && RID_BITS == 32)
+
+#if KEY_BITS == 64
+typedef ulong key_type;
+#else
+typedef uint key_type;
+#endif
+#if RID_BITS == 64
+typedef ulong rid_type;
+#else
+typedef uint rid_type;
+#endif
+
+#if NARROW_TUPLES
+typedef uint2 tuple_type;
+#define TUPLE_KEY(t) ((t).x)
+#define TUPLE_RID(t) ((t).y)
+#else
+typedef struct {
+  key_type key;
+  rid_type rid;
+} tuple_type;
+#define TUPLE_KEY(t) ((t).key)
+#define TUPLE_RID(t) ((t).rid)
+#endif
+
+#define EMPTY_KEY ((key_type)-1)
+#define EMPTY_RID ((rid_type)-1)
+
+// Rid slots per key slot in bucket_key_rids, a build option: one when every
+// key of R is unique, MAX_RIDS_PER_KEY otherwise (table_build_options in
+// table_size.hpp). The result slots of an S tuple stay MAX_RIDS_PER_KEY wide.
+#ifndef TABLE_RIDS_PER_KEY
+#define TABLE_RIDS_PER_KEY MAX_RIDS_PER_KEY
+#endif
+#if TABLE_RIDS_PER_KEY > MAX_RIDS_PER_KEY
+#error "TABLE_RIDS_PER_KEY must not exceed MAX_RIDS_PER_KEY"
+#endif
+
+// The bucket count is a kernel argument (sized at runtime from R and a load
+// factor); multiply-shift maps the hash onto [0, num_buckets) without a
+// division. A 64-bit key is folded to 32 bits first (bucket_of in
+// table_size.hpp).
+uint hash_key(key_type key, uint num_buckets) {
+#if KEY_BITS == 64
+  uint folded = (uint)key ^ (uint)(key >> 32);
+#else
+  uint folded = key;
+#endif
+  return mul_hi(folded * HASH_SEED, num_buckets);
 }
 
-__kernel void b3(__global const uint *R_keys, __global uint *bucket_ids,
-                 __global uint *bucket_keys, __global int *key_indices) {
-  uint gid = get_global_id(0);
-  if (gid >= R_LENGTH) {
-    return;
-  }
-
-  uint key = R_keys[gid];
-  uint original_bucket_id = bucket_ids[gid];
-  uint bucket_id = original_bucket_id;
+// Find `key` or claim an empty slot for it, starting at *bucket_id_io.
+// Returns the slot within the bucket (-1 if none was claimed) and moves
+// *bucket_id_io to the bucket that holds the key.
+int claim_key(key_type key, uint *bucket_id_io,
+              __global key_type *bucket_keys, uint num_buckets) {
+  uint bucket_id = *bucket_id_io;
   int key_idx = -1;
 
   // Linear probing: search current bucket, if full move to next bu
-  for (uint probe = 0; probe < BUCKET_HEADER_NUMBER; probe++) {
+  for (uint probe = 0; probe < num_buckets; probe++) {
     uint bucket_offset = bucket_id * MAX_KEYS_PER_BUCKET;
 
     // Search current bucket for existing key or empty slot
     for (int i = 0; i < MAX_KEYS_PER_BUCKET; i++) {
-      uint current_key = bucket_keys[bucket_offset + i];
+      key_type current_key = bucket_keys[bucket_offset + i];
 
       if (current_key == key) {
         // Found existing key
         key_idx = i;
         break;
-      } else if (current_key == 0xffffffffu) {
+      } else if (current_key == EMPTY_KEY) {
         // Found empty slot, try to claim it with retry mechanism
         // Instead of atomic_cmpxchg, use retry loop with verification
         bool claimed = false;
@@ -49,19 +102,19 @@ __kernel void b3(__global const uint *R_keys, __global uint *bucket_ids,
 
         for (int retry = 0; retry < max_retries; retry++) {
           // Double-check: read again to ensure slot is still empty
-          uint check_key = bucket_keys[bucket_offset + i];
+          key_type check_key = bucket_keys[bucket_offset + i];
 
           if (check_key == key) {
             // Another thread inserted our key
             key_idx = i;
             claimed = true;
             break;
-          } else if (check_key == 0xffffffffu) {
+          } else if (check_key == EMPTY_KEY) {
             // Slot is still empty, try to write our key
             bucket_keys[bucket_offset + i] = key;
 
             // Verify: read back to check if we successfully claimed it
-            uint verify_key = bucket_keys[bucket_offset + i];
+            key_type verify_key = bucket_keys[bucket_offset + i];
 
             if (verify_key == key) {
               // Successfully claimed this slot
@@ -86,35 +139,28 @@ __kernel void b3(__global const uint *R_keys, __global uint *bucket_ids,
     if (key_idx != -1) {
       // Found or inserted key successfully
       // Update bucket_id if it changed due to linear probing
-      bucket_ids[gid] = bucket_id;
+      *bucket_id_io = bucket_id;
       break;
     }
 
     // Current bucket is full, move to next bucket (linear probing)
-    bucket_id = (bucket_id + 1) % BUCKET_HEADER_NUMBER;
+    bucket_id = (bucket_id + 1) % num_buckets;
   }
 
-  key_indices[gid] = key_idx;
+  return key_idx;
 }
 
-__kernel void b4(__global const uint *R_rids, __global const uint *bucket_ids,
-                 __global const int *key_indices,
-                 __global uint *bucket_key_rids) {
-  uint gid = get_global_id(0);
-  if (gid >= R_LENGTH) {
-    return;
-  }
-  uint rid = R_rids[gid];
-  uint bucket_id = bucket_ids[gid];
-  int key_idx = key_indices[gid];
+// Append `rid` to the rid list of key slot `key_idx` in `bucket_id`
+void insert_rid(rid_type rid, uint bucket_id, int key_idx,
+                __global rid_type *bucket_key_rids) {
   if (key_idx < 0 || key_idx >= MAX_KEYS_PER_BUCKET) {
     return;
   }
 
   uint bucket_key_offset = bucket_id * MAX_KEYS_PER_BUCKET + key_idx;
-  for (int i = 0; i < MAX_RIDS_PER_KEY; i++) {
-    int tmp = bucket_key_offset * MAX_RIDS_PER_KEY + i;
-    if (bucket_key_rids[tmp] == 0xffffffffu) {
+  for (int i = 0; i < TABLE_RIDS_PER_KEY; i++) {
+    int tmp = bucket_key_offset * TABLE_RIDS_PER_KEY + i;
+    if (bucket_key_rids[tmp] == EMPTY_RID) {
       // Found empty slot, try to claim it with retry mechanism
       // Instead of atomic_cmpxchg, use retry loop with verification
       bool claimed = false;
@@ -122,18 +168,18 @@ __kernel void b4(__global const uint *R_rids, __global const uint *bucket_ids,
 
       for (int retry = 0; retry < max_retries; retry++) {
         // Double-check: read again to ensure slot is still empty
-        uint check_rid = bucket_key_rids[tmp];
+        rid_type check_rid = bucket_key_rids[tmp];
 
         if (check_rid == rid) {
           // Another thread inserted our rid
           claimed = true;
           break;
-        } else if (check_rid == 0xffffffffu) {
+        } else if (check_rid == EMPTY_RID) {
           // Slot is still empty, try to write our rid
           bucket_key_rids[tmp] = rid;
 
           // Verify: read back to check if we successfully claimed it
-          uint verify_rid = bucket_key_rids[tmp];
+          rid_type verify_rid = bucket_key_rids[tmp];
 
           if (verify_rid == rid) {
             // Successfully claimed this slot
@@ -155,45 +201,23 @@ __kernel void b4(__global const uint *R_rids, __global const uint *bucket_ids,
   }
 }
 
-__kernel void p1(__global const uint *S_keys, __global uint *bucket_ids) {
-  uint gid = get_global_id(0);
-  if (gid >= S_LENGTH) {
-    return;
-  }
-  uint h = S_keys[gid] * HASH_SEED % (BUCKET_HEADER_NUMBER);
-  bucket_ids[gid] = h;
-}
-
-__kernel void p2(__global uint *bucket_ids, __global uint *bucket_total) {
-  uint gid = get_global_id(0);
-
-  // Check bounds
-  if (gid >= S_LENGTH) {
-    return;
-  }
-}
-
-__kernel void p3(__global const uint *S_keys, __global uint *bucket_ids,
-                 __global const uint *bucket_keys, __global int *key_indices,
-                 __global uint *match_found) {
-  uint gid = get_global_id(0);
-  if (gid >= S_LENGTH) {
-    return;
-  }
-  uint original_bucket_id = bucket_ids[gid];
-  uint key = S_keys[gid];
+// Look up `key` starting at *bucket_id_io. Returns the slot within the
+// bucket (-1 on a miss) and moves *bucket_id_io to the bucket holding it.
+int find_key(key_type key, uint *bucket_id_io,
+             __global const key_type *bucket_keys, uint num_buckets) {
+  uint original_bucket_id = *bucket_id_io;
   uint bucket_id = original_bucket_id;
   bool found = false;
   int key_idx = -1;
 
   // Linear probing: search current bucket, if not found move to next bucket
-  for (uint probe = 0; probe < BUCKET_HEADER_NUMBER; probe++) {
+  for (uint probe = 0; probe < num_buckets; probe++) {
     uint bucket_offset = bucket_id * MAX_KEYS_PER_BUCKET;
 
-    // Search until we find the key or hit an empty slot (0xffffffffu)
+    // Search until we find the key or hit an empty slot (EMPTY_KEY)
     for (int i = 0; i < MAX_KEYS_PER_BUCKET; i++) {
-      uint bucket_key = bucket_keys[bucket_offset + i];
-      if (bucket_key == 0xffffffffu) {
+      key_type bucket_key = bucket_keys[bucket_offset + i];
+      if (bucket_key == EMPTY_KEY) {
         // Empty slot means key doesn't exist in this bucket
         break;
       }
@@ -201,7 +225,7 @@ __kernel void p3(__global const uint *S_keys, __global uint *bucket_ids,
         found = true;
         key_idx = i;
         // Update bucket_id if it changed due to linear probing
-        bucket_ids[gid] = bucket_id;
+        *bucket_id_io = bucket_id;
         break;
       }
     }
@@ -211,7 +235,7 @@ __kernel void p3(__global const uint *S_keys, __global uint *bucket_ids,
     }
 
     // Key not found in current bucket, move to next bucket
-    bucket_id = (bucket_id + 1) % BUCKET_HEADER_NUMBER;
+    bucket_id = (bucket_id + 1) % num_buckets;
 
     // Stop if we've wrapped around to the original bucket
     if (bucket_id == original_bucket_id && probe > 0) {
@@ -219,16 +243,163 @@ __kernel void p3(__global const uint *S_keys, __global uint *bucket_ids,
     }
   }
 
+  return key_idx;
+}
+
+// Write the R rids matching S tuple `gid` into its MAX_RIDS_PER_KEY result
+// slots and return how many were written. The key and S rid are not stored:
+// the host reads them from S at the slot's S position (join_result.hpp).
+uint emit_matches(uint gid, uint bucket_id, int key_idx,
+                  __global const rid_type *bucket_key_rids,
+                  __global rid_type *result_rid) {
+  uint bucket_key_offset = bucket_id * MAX_KEYS_PER_BUCKET + key_idx;
+
+  // Each thread writes to its pre-allocated space: NO ATOMIC OPERATIONS
+  // gid * MAX_RIDS_PER_KEY is the base offset for this thread
+  uint base_offset = gid * MAX_RIDS_PER_KEY;
+  uint i;
+  for (i = 0; i < TABLE_RIDS_PER_KEY; i++) {
+    rid_type rid = bucket_key_rids[bucket_key_offset * TABLE_RIDS_PER_KEY + i];
+    if (rid == EMPTY_RID)
+      break;
+    result_rid[base_offset + i] = rid;
+  }
+  return i;
+}
+
+#if NARROW_TUPLES
+// b1: compute hash bucket number
+__kernel void b1(__global const uint2 *R, __global uint *bucket_ids,
+                 uint num_buckets) {
+  uint gid = get_global_id(0);
+  if (gid >= R_LENGTH) {
+    return;
+  }
+  bucket_ids[gid] = hash_key(R[gid].x, num_buckets);
+}
+
+__kernel void b2(__global const uint *bucket_ids, __global uint *bucket_total) {
+  uint gid = get_global_id(0);
+  if (gid >= R_LENGTH) {
+    return;
+  }
+}
+
+__kernel void b3(__global const uint2 *R, __global uint *bucket_ids,
+                 __global uint *bucket_keys, __global int *key_indices,
+                 uint num_buckets) {
+  uint gid = get_global_id(0);
+  if (gid >= R_LENGTH) {
+    return;
+  }
+
+  uint bucket_id = bucket_ids[gid];
+  int key_idx = claim_key(R[gid].x, &bucket_id, bucket_keys, num_buckets);
+  if (key_idx != -1) {
+    // Update bucket_id if it changed due to linear probing
+    bucket_ids[gid] = bucket_id;
+  }
   key_indices[gid] = key_idx;
-  match_found[gid] = found ? 1 : 0;
 }
 
-__kernel void p4(__global const uint *S_keys, __global const uint *S_rids,
+__kernel void b4(__global const uint2 *R, __global const uint *bucket_ids,
                  __global const int *key_indices,
+                 __global uint *bucket_key_rids) {
+  uint gid = get_global_id(0);
+  if (gid >= R_LENGTH) {
+    return;
+  }
+  insert_rid(R[gid].y, bucket_ids[gid], key_indices[gid], bucket_key_rids);
+}
+
+__kernel void p1(__global const uint2 *S, __global uint *bucket_ids,
+                 uint num_buckets) {
+  uint gid = get_global_id(0);
+  if (gid >= S_LENGTH) {
+    return;
+  }
+  bucket_ids[gid] = hash_key(S[gid].x, num_buckets);
+}
+
+// b1/p1 variants: each work-item hashes `per_item` consecutive vectors of
+// VW keys (vstoreVW), so the CPU device schedules 1/(VW*per_item) as many
+// work-items. `n` is the number of tuples; the last partial vector is hashed
+// scalar. Used for both R (build) and S (probe) tuples.
+__kernel void hash_v1(__global const uint2 *tuples, __global uint *bucket_ids,
+                      uint n, uint per_item, uint num_buckets) {
+  uint first = get_global_id(0) * per_item;
+  for (uint i = first; i < first + per_item && i < n; i++) {
+    bucket_ids[i] = hash_key(tuples[i].x, num_buckets);
+  }
+}
+
+// Keys of tuples [v * VW, (v + 1) * VW): the even words of 2 * VW loaded
+uint4 load_keys4(uint v, __global const uint *words) {
+  return vload8(v, words).even;
+}
+
+uint8 load_keys8(uint v, __global const uint *words) {
+  return vload16(v, words).even;
+}
+
+uint16 load_keys16(uint v, __global const uint *words) {
+  return (uint16)(vload16(2 * v, words).even, vload16(2 * v + 1, words).even);
+}
+
+#define HASH_VEC_KERNEL(VW)                                                    \
+  __kernel void hash_v##VW(__global const uint2 *tuples,                       \
+                           __global uint *bucket_ids, uint n, uint per_item,   \
+                           uint num_buckets) {                                 \
+    uint first = get_global_id(0) * per_item;                                  \
+    for (uint v = first; v < first + per_item; v++) {                          \
+      uint base = v * VW;                                                      \
+      if (base + VW <= n) {                                                    \
+        uint##VW k = load_keys##VW(v, (__global const uint *)tuples);          \
+        vstore##VW(mul_hi(k * HASH_SEED, (uint##VW)(num_buckets)), v,          \
+                   bucket_ids);                                                \
+      } else {                                                                 \
+        for (uint i = base; i < n; i++) {                                      \
+          bucket_ids[i] = hash_key(tuples[i].x, num_buckets);                  \
+        }                                                                      \
+        return;                                                                \
+      }                                                                        \
+    }                                                                          \
+  }
+
+HASH_VEC_KERNEL(4)
+HASH_VEC_KERNEL(8)
+HASH_VEC_KERNEL(16)
+
+__kernel void p2(__global uint *bucket_ids, __global uint *bucket_total) {
+  uint gid = get_global_id(0);
+
+  // Check bounds
+  if (gid >= S_LENGTH) {
+    return;
+  }
+}
+
+__kernel void p3(__global const uint2 *S, __global uint *bucket_ids,
+                 __global const uint *bucket_keys, __global int *key_indices,
+                 __global uint *match_found, uint num_buckets) {
+  uint gid = get_global_id(0);
+  if (gid >= S_LENGTH) {
+    return;
+  }
+  uint bucket_id = bucket_ids[gid];
+  int key_idx = find_key(S[gid].x, &bucket_id, bucket_keys, num_buckets);
+  if (key_idx >= 0) {
+    // Update bucket_id if it changed due to linear probing
+    bucket_ids[gid] = bucket_id;
+  }
+  key_indices[gid] = key_idx;
+  match_found[gid] = key_idx >= 0 ? 1 : 0;
+}
+
+__kernel void p4(__global const int *key_indices,
                  __global const uint *match_found,
                  __global const uint *bucket_key_rids,
-                 __global const uint *bucket_ids, __global uint *result_key,
-                 __global uint *result_rid, __global uint *result_sid,
+                 __global const uint *bucket_ids, __global uint *result_rid,
                  __global uint *result_count) {
   uint gid = get_global_id(0);
   if (gid >= S_LENGTH) {
@@ -240,28 +411,195 @@ __kernel void p4(__global const uint *S_keys, __global const uint *S_rids,
     return;
   }
 
-  uint bucket_id = bucket_ids[gid];
   int key_idx = key_indices[gid];
-
   if (key_idx < 0) {
     return;
   }
 
-  uint bucket_key_offset = bucket_id * MAX_KEYS_PER_BUCKET + key_idx;
+  result_count[gid] =
+      emit_matches(gid, bucket_ids[gid], key_idx, bucket_key_rids, result_rid);
+}
+#endif // NARROW_TUPLES
 
-  // Each thread writes to its pre-allocated space: NO ATOMIC OPERATIONS
-  // gid * MAX_RIDS_PER_KEY is the base offset for this thread
-  uint base_offset = gid * MAX_RIDS_PER_KEY;
-  uint s_key = S_keys[gid];
-  uint s_rid = S_rids[gid];
-  uint i;
-  for (i = 0; i < MAX_RIDS_PER_KEY; i++) {
-    uint rid = bucket_key_rids[bucket_key_offset * MAX_RIDS_PER_KEY + i];
-    if (rid == 0xffffffffu)
-      break;
-    result_rid[base_offset + i] = rid;
-    result_key[base_offset + i] = s_key;
-    result_sid[base_offset + i] = s_rid;
+// build: b1+b3+b4 in one pass; bucket id and key slot stay in registers
+// (b2 is a no-op)
+__kernel void build(__global const tuple_type *R,
+                    __global key_type *bucket_keys,
+                    __global rid_type *bucket_key_rids, uint num_buckets) {
+  uint gid = get_global_id(0);
+  if (gid >= R_LENGTH) {
+    return;
+  }
+  tuple_type tuple = R[gid];
+  key_type key = TUPLE_KEY(tuple);
+  uint bucket_id = hash_key(key, num_buckets);
+  int key_idx = claim_key(key, &bucket_id, bucket_keys, num_buckets);
+  insert_rid(TUPLE_RID(tuple), bucket_id, key_idx, bucket_key_rids);
+}
+
+// probe: p1+p3+p4 in one pass. Writes result_count for every S tuple, so
+// the count buffer needs no initialization.
+__kernel void probe(__global const tuple_type *S,
+                    __global const key_type *bucket_keys,
+                    __global const rid_type *bucket_key_rids,
+                    __global rid_type *result_rid, __global uint *result_count,
+                    uint num_buckets) {
+  uint gid = get_global_id(0);
+  if (gid >= S_LENGTH) {
+    return;
+  }
+  key_type key = TUPLE_KEY(S[gid]);
+  uint bucket_id = hash_key(key, num_buckets);
+  int key_idx = find_key(key, &bucket_id, bucket_keys, num_buckets);
+  result_count[gid] =
+      key_idx < 0 ? 0
+                  : emit_matches(gid, bucket_id, key_idx, bucket_key_rids,
+                                 result_rid);
+}
+
+#if NARROW_TUPLES
+// DD sharding: the GPU owns buckets [0, boundary), the CPU the rest. Each
+// work-group routes one ROUTE_BLOCK of tuples. route_count counts the GPU's
+// tuples per block; the host turns the counts into per-block offsets and
+// route_scatter moves every tuple and its bucket id into the GPU part
+// [0, n_gpu) or the CPU part, which starts at cpu_begin, of the routed arrays.
+// Order within a block is not kept.
+__kernel void route_count(__global const uint *bucket_ids, uint n,
+                          uint boundary, __global uint *block_counts) {
+  __local uint count;
+  uint lid = get_local_id(0);
+  uint begin = get_group_id(0) * ROUTE_BLOCK;
+  uint end = min(begin + ROUTE_BLOCK, n);
+  if (lid == 0) {
+    count = 0;
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+  uint mine = 0;
+  for (uint i = begin + lid; i < end; i += get_local_size(0)) {
+    mine += bucket_ids[i] < boundary;
+  }
+  atomic_add(&count, mine);
+  barrier(CLK_LOCAL_MEM_FENCE);
+  if (lid == 0) {
+    block_counts[get_group_id(0)] = count;
+  }
+}
+
+__kernel void route_scatter(__global const uint2 *tuples,
+                            __global const uint *bucket_ids, uint n,
+                            uint boundary, uint cpu_begin,
+                            __global const uint *block_offsets,
+                            __global uint2 *out_tuples,
+                            __global uint *out_bucket_ids) {
+  __local uint gpu_next, cpu_next;
+  uint lid = get_local_id(0);
+  uint begin = get_group_id(0) * ROUTE_BLOCK;
+  uint end = min(begin + ROUTE_BLOCK, n);
+  // GPU tuples before this block go first; CPU tuples start at cpu_begin
+  uint gpu_base = block_offsets[get_group_id(0)];
+  uint cpu_base = cpu_begin + begin - gpu_base;
+  if (lid == 0) {
+    gpu_next = 0;
+    cpu_next = 0;
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+  for (uint i = begin + lid; i < end; i += get_local_size(0)) {
+    uint bucket_id = bucket_ids[i];
+    uint dst = bucket_id < boundary ? gpu_base + atomic_inc(&gpu_next)
+                                    : cpu_base + atomic_inc(&cpu_next);
+    out_tuples[dst] = tuples[i];
+    out_bucket_ids[dst] = bucket_id;
+  }
+}
+
+// Dense join output. compact_count sums result_count over each ROUTE_BLOCK
+// of S; the host turns the sums into per-block offsets and compact_scatter
+// writes the matches of every S tuple as JoinedTuple words (key, R rid, S
+// rid) to out[offset, offset + result_count[i]). Order within a block is not
+// kept.
+__kernel void compact_count(__global const uint *result_count, uint n,
+                            __global uint *block_counts) {
+  __local uint count;
+  uint lid = get_local_id(0);
+  uint begin = get_group_id(0) * ROUTE_BLOCK;
+  uint end = min(begin + ROUTE_BLOCK, n);
+  if (lid == 0) {
+    count = 0;
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+  uint mine = 0;
+  for (uint i = begin + lid; i < end; i += get_local_size(0)) {
+    mine += result_count[i];
+  }
+  atomic_add(&count, mine);
+  barrier(CLK_LOCAL_MEM_FENCE);
+  if (lid == 0) {
+    block_counts[get_group_id(0)] = count;
+  }
+}
+
+__kernel void compact_scatter(__global const uint2 *S,
+                              __global const uint *result_rid,
+                              __global const uint *result_count, uint n,
+                              __global const uint *block_offsets,
+                              __global uint *out) {
+  __local uint next;
+  uint lid = get_local_id(0);
+  uint begin = get_group_id(0) * ROUTE_BLOCK;
+  uint end = min(begin + ROUTE_BLOCK, n);
+  uint base = block_offsets[get_group_id(0)];
+  if (lid == 0) {
+    next = 0;
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+  for (uint i = begin + lid; i < end; i += get_local_size(0)) {
+    uint count = result_count[i];
+    if (count == 0) {
+      continue;
+    }
+    uint dst = base + atomic_add(&next, count);
+    uint2 s = S[i];
+    for (uint j = 0; j < count; j++) {
+      out[3 * (dst + j)] = s.x;
+      out[3 * (dst + j) + 1] = result_rid[i * MAX_RIDS_PER_KEY + j];
+      out[3 * (dst + j) + 2] = s.y;
+    }
+  }
+}
+
+// Direct-addressed table over dictionary codes (dict_join.hpp): R and S keys
+// are dense codes in [0, num_codes), so code c owns rid slots
+// [c * MAX_RIDS_PER_KEY, (c + 1) * MAX_RIDS_PER_KEY) and rid_counts[c]. No
+// hashing, no probing sequence and no key compare; rids past
+// MAX_RIDS_PER_KEY are dropped like in the hash table.
+__kernel void direct_build(__global const uint2 *R, uint n,
+                           __global uint *rid_counts, __global uint *rids) {
+  uint gid = get_global_id(0);
+  if (gid >= n) {
+    return;
+  }
+  uint2 tuple = R[gid];
+  uint slot = atomic_inc(&rid_counts[tuple.x]);
+  if (slot < MAX_RIDS_PER_KEY) {
+    rids[tuple.x * MAX_RIDS_PER_KEY + slot] = tuple.y;
+  }
+}
+
+// p4 result layout (join_result.hpp) for S tuple gid
+__kernel void direct_probe(__global const uint2 *S, uint n,
+                           __global const uint *rid_counts,
+                           __global const uint *rids,
+                           __global uint *result_rid,
+                           __global uint *result_count) {
+  uint gid = get_global_id(0);
+  if (gid >= n) {
+    return;
+  }
+  uint code = S[gid].x;
+  uint count = min(rid_counts[code], (uint)MAX_RIDS_PER_KEY);
+  for (uint i = 0; i < count; i++) {
+    result_rid[gid * MAX_RIDS_PER_KEY + i] = rids[code * MAX_RIDS_PER_KEY + i];
   }
-  result_count[gid] = i;
+  result_count[gid] = count;
 }
+#endif // NARROW_TUPLES
@@ -1,10 +1,32 @@
 #include "hj.hpp"
 #include "datagen.cpp"
+#include "hugepage.hpp"
 #include "param.hpp"
 #include "util.hpp"
 
+#include "buffer_placement.hpp"
 #include "cl.hpp"
+#include "coro_probe.hpp"
+#include "cost_model.hpp"
+#include "dd_dynamic.hpp"
+#include "dd_shard.hpp"
 #include "device_picker.hpp"
+#include "device_set.hpp"
+#include "dict_join.hpp"
+#include "feedback_split.hpp"
+#include "hash_kernels.hpp"
+#include "host_join.hpp"
+#include "join_context.hpp"
+#include "join_result.hpp"
+#include "mem_budget.hpp"
+#include "mem_tracker.hpp"
+#include "pl_pipeline.hpp"
+#include "placement_search.hpp"
+#include "step_graph.hpp"
+#include "svm_join.hpp"
+#include "table_size.hpp"
+#include "tune_cache.hpp"
+#include "wide_join.hpp"
 #include <CL/cl.h>
 #include <cstddef>
 #include <cstdint>
@@ -19,8 +41,8 @@
 #include <vector>
 
 static std::vector<JoinedTuple>
-run_standard_hash_join(const std::vector<Tuple> &R,
-                       const std::vector<Tuple> &S) {
+run_standard_hash_join(const huge_vector<Tuple> &R,
+                       const huge_vector<Tuple> &S) {
   // Build hash table from R: key -> list of R rids
   std::unordered_map<uint32_t, std::vector<uint32_t>> rIndex;
   rIndex.reserve(static_cast<size_t>(R_LENGTH) * 2);
@@ -48,8 +70,24 @@ run_standard_hash_join(const std::vector<Tuple> &R,
   return out;
 }
 
+// Per-key multiset comparison, same check as the OpenCL verifications
+static bool same_join_result(const std::vector<JoinedTuple> &a,
+                             const std::vector<JoinedTuple> &b) {
+  if (a.size() != b.size())
+    return false;
+  std::unordered_map<uint32_t, uint64_t> aKeyCount;
+  std::unordered_map<uint32_t, uint64_t> bKeyCount;
+  aKeyCount.reserve(R_LENGTH);
+  bKeyCount.reserve(R_LENGTH);
+  for (const auto &jt : a)
+    aKeyCount[jt.key]++;
+  for (const auto &jt : b)
+    bKeyCount[jt.key]++;
+  return aKeyCount == bKeyCount;
+}
+
 uint32_t hash(uint32_t key) {
-  return (key * 2654435769U) % (BUCKET_HEADER_NUMBER);
+  return (key * 2654435769U) % (R_LENGTH);
 }
 
 int main(int argc, char *argv[]) {
@@ -59,6 +97,26 @@ int main(int argc, char *argv[]) {
   bool run_cpu_join = false;
   bool run_std_join = false;
   bool run_bench = false;
+  bool run_morsel_join_flag = false;
+  bool run_coro_bench = false;
+  bool run_vec_bench = false;
+  bool dd_dynamic = false;
+  FissionSpec fission;
+  bool dd_shard = false;
+  bool run_feedback = false;
+  bool pl_pipeline = false;
+  bool run_search = false;
+  size_t dd_chunk = 1 << 18;
+  bool force_retune = false;
+  double load_factor = DEFAULT_LOAD_FACTOR;
+  size_t mem_budget = 0; // bytes, 0 = no budget
+  bool run_lf_bench = false;
+  bool run_svm = false;
+  bool run_width_bench = false;
+  bool run_dict = false;
+  std::string tune_cache_path = "hj_tune.cache";
+  MorselJoinConfig morsel_cfg;
+  morsel_cfg.threads = std::max(1u, std::thread::hardware_concurrency());
 
   for (int arg_i = 1; arg_i < argc; arg_i++) {
     if (strcmp(argv[arg_i], "--cpu") == 0) {
@@ -67,6 +125,53 @@ int main(int argc, char *argv[]) {
       run_std_join = true;
     } else if (strcmp(argv[arg_i], "--bench") == 0) {
       run_bench = true;
+    } else if (strcmp(argv[arg_i], "--no-hugepages") == 0) {
+      hugepage::enabled() = false;
+    } else if (strcmp(argv[arg_i], "--morsel") == 0) {
+      run_morsel_join_flag = true;
+    } else if (strcmp(argv[arg_i], "--coro") == 0) {
+      run_coro_bench = true;
+    } else if (strcmp(argv[arg_i], "--vec-bench") == 0) {
+      run_vec_bench = true;
+    } else if (strcmp(argv[arg_i], "--dynamic") == 0) {
+      dd_dynamic = true;
+    } else if (strcmp(argv[arg_i], "--fission") == 0) {
+      fission.kind = FissionSpec::EQUALLY;
+      if (arg_i + 1 < argc && parse_fission_spec(argv[arg_i + 1], fission))
+        arg_i++;
+    } else if (strcmp(argv[arg_i], "--shard") == 0) {
+      dd_shard = true;
+    } else if (strcmp(argv[arg_i], "--feedback") == 0) {
+      run_feedback = true;
+    } else if (strcmp(argv[arg_i], "--pipeline") == 0) {
+      pl_pipeline = true;
+    } else if (strcmp(argv[arg_i], "--search") == 0) {
+      run_search = true;
+    } else if (strcmp(argv[arg_i], "--chunk-size") == 0 && arg_i + 1 < argc) {
+      dd_chunk = std::max(1, atoi(argv[++arg_i]));
+    } else if (strcmp(argv[arg_i], "--retune") == 0) {
+      force_retune = true;
+    } else if (strcmp(argv[arg_i], "--tune-cache") == 0 && arg_i + 1 < argc) {
+      tune_cache_path = argv[++arg_i];
+    } else if (strcmp(argv[arg_i], "--load-factor") == 0 && arg_i + 1 < argc) {
+      load_factor = std::min(0.95, std::max(0.05, atof(argv[++arg_i])));
+    } else if (strcmp(argv[arg_i], "--mem-budget") == 0 && arg_i + 1 < argc) {
+      mem_budget = (size_t)(std::max(0.0, atof(argv[++arg_i])) * (1 << 20));
+    } else if (strcmp(argv[arg_i], "--lf-bench") == 0) {
+      run_lf_bench = true;
+    } else if (strcmp(argv[arg_i], "--svm") == 0) {
+      run_svm = true;
+    } else if (strcmp(argv[arg_i], "--width-bench") == 0) {
+      run_width_bench = true;
+    } else if (strcmp(argv[arg_i], "--dict") == 0) {
+      run_dict = true;
+    } else if (strcmp(argv[arg_i], "--morsel-devices") == 0) {
+      run_morsel_join_flag = true;
+      morsel_cfg.use_devices = true;
+    } else if (strcmp(argv[arg_i], "--threads") == 0 && arg_i + 1 < argc) {
+      morsel_cfg.threads = std::max(1, atoi(argv[++arg_i]));
+    } else if (strcmp(argv[arg_i], "--morsel-size") == 0 && arg_i + 1 < argc) {
+      morsel_cfg.morsel_size = std::max(1, atoi(argv[++arg_i]));
     } else if (strcmp(argv[arg_i], "--help") == 0 ||
                strcmp(argv[arg_i], "-h") == 0) {
       std::cout
@@ -75,6 +180,44 @@ int main(int argc, char *argv[]) {
           << "  --cpu     Run CPU hash join\n"
           << "  --std     Run standard hash join\n"
           << "  --bench   Benchmark to find optimal WORK_RATIO_GPU\n"
+          << "  --retune  DD/OL/PL: recalibrate the cost model even on a "
+             "cache hit\n"
+          << "  --tune-cache F  Tuned config cache (default hj_tune.cache)\n"
+          << "  --load-factor F Size the hash table for this share of used "
+             "key slots (default 0.75)\n"
+          << "  --lf-bench      Single device: table memory and probe "
+             "throughput for load factors 0.5-0.9\n"
+          << "  --svm           Single device: chained hash table in shared "
+             "virtual memory, probed by the device and host threads\n"
+          << "  --width-bench   Single device: fused join with 32-bit and "
+             "64-bit keys\n"
+          << "  --dict          Single device: dictionary-encode the keys "
+             "and join the codes on a direct table\n"
+          << "  --mem-budget MB Single device: run the staged, fused or "
+             "chunked-probe join, whichever fits in MB\n"
+          << "  --no-hugepages  Back host arrays with 4KB pages only\n"
+          << "  --morsel  Run morsel-driven host join (work stealing)\n"
+          << "  --morsel-devices  Same, with OpenCL devices as extra "
+             "probe workers\n"
+          << "  --coro    Benchmark plain/prefetch/coroutine host probes\n"
+          << "  --vec-bench     Time every b1/p1 vector width per device and "
+             "use the fastest\n"
+          << "  --dynamic       DD: probe with dynamic chunks instead of "
+             "WORK_RATIO_GPU\n"
+          << "  --chunk-size N  DD/PL: tuples per dynamic/pipeline chunk "
+             "(default 262144)\n"
+          << "  --fission [N|numa|l3]  DD/OL/PL: run on sub-devices of the "
+             "CPU (default 2 equal parts) plus the other devices\n"
+          << "  --shard         DD: per-device tables over a share of the "
+             "hash space, routed build and probe\n"
+          << "  --feedback      DD/PL: re-split every chunk from measured "
+             "device throughput\n"
+          << "  --pipeline      PL: overlap p1/p3/p4 of consecutive chunks "
+             "instead of a barrier per step\n"
+          << "  --search        OL: search the GPU share of all eight steps "
+             "(coordinate descent)\n"
+          << "  --threads N     Host worker threads (default: all cores)\n"
+          << "  --morsel-size N Tuples per morsel (default 65536)\n"
           << "  --help, -h     Show this help message\n"
           << "\nExample:\n"
           << "  " << argv[0]
@@ -87,11 +230,28 @@ int main(int argc, char *argv[]) {
     }
   }
 
-  std::vector<BucketHeader> bucketList(BUCKET_HEADER_NUMBER);
+  // Winners of the DD/OL/PL tuners, keyed by devices and data size
+  TuneCache tune_cache(tune_cache_path);
 
   // Generate datasets using datagen.cpp functions
-  std::vector<Tuple> R = RGenerator();
-  std::vector<Tuple> S = SGenerator(R);
+  memtrack::tracker().phase("generate");
+  // In huge pages (counted as huge-page arrays), page aligned for the
+  // USE_HOST_PTR buffers that wrap them
+  huge_vector<Tuple> R = RGenerator();
+  huge_vector<Tuple> S = SGenerator(R);
+
+  // Hash table size for every join, from a sample of R's keys
+  KeySample key_sample = sample_keys(R);
+  TableSize table = size_table(key_sample, R.size(), load_factor);
+  print_table_size(table, key_sample, R.size(), load_factor);
+  morsel_cfg.table = table;
+
+  // Single-device plan under --mem-budget
+  JoinPlan plan;
+  if (mem_budget > 0) {
+    plan = choose_plan(mem_budget, table);
+    print_plan(plan, mem_budget);
+  }
 
   std::vector<JoinedTuple> res;
 
@@ -100,6 +260,9 @@ int main(int argc, char *argv[]) {
   // CPU-based Hash Join
   if (run_cpu_join) {
     std::cout << "=== CPU Hash Join ===\n";
+    std::vector<BucketHeader> bucketList(R_LENGTH);
+    memtrack::tracker().add("bucketList", memtrack::HOST,
+                            sizeof(BucketHeader) * R_LENGTH);
     timer.reset();
     for (int i = 0; i < R_LENGTH; i++) {
       // b1: compute hash bucket number
@@ -173,6 +336,30 @@ int main(int argc, char *argv[]) {
               << "ms\n";
   }
 
+  // Morsel-driven host join
+  if (run_morsel_join_flag) {
+    std::cout << "\n=== Morsel-Driven Host Join ===" << std::endl;
+    try {
+      std::vector<JoinedTuple> morselRes = run_morsel_join(R, S, morsel_cfg);
+      std::cout << "Morsel Join: " << morselRes.size() << " tuples"
+                << std::endl;
+      if (run_std_join) {
+        std::cout << "Morsel Verification: "
+                  << (same_join_result(morselRes, stdRes) ? "PASS" : "FAIL")
+                  << "\n";
+      }
+    } catch (cl::Error err) {
+      std::cerr << "ERROR: " << err.what() << "(" << err_code(err.err())
+                << ")" << std::endl;
+    }
+  }
+
+  if (run_coro_bench) {
+    std::cout << "\n=== Host Probe Benchmark (plain / prefetch / coroutine) ==="
+              << std::endl;
+    run_probe_benchmark(R, S, morsel_cfg);
+  }
+
   // ===================== OpenCL Join ==========================
 
   try {
@@ -195,7 +382,32 @@ int main(int argc, char *argv[]) {
     unsigned numDevices = getDeviceList(devices);
 
     if (!partitioned_join) {
-      if (deviceIndex < numDevices) {
+      if (plan.kind != PLAN_STAGED && deviceIndex < numDevices) {
+        // --mem-budget ruled out the staged join below
+        cl::Device device = devices[deviceIndex];
+
+        std::string name;
+        getDeviceName(device, name);
+        std::cout << "\nUsing OpenCL Device: " << name << "\n";
+
+        std::vector<cl::Device> chosen_device(1, device);
+        cl::Context context(chosen_device);
+        cl::CommandQueue queue(context, device, CL_QUEUE_PROFILING_ENABLE);
+        cl::Program program = build_join_program(context, table.rids_per_key);
+
+        std::cout << "\n=== OpenCL " << to_string(plan) << " Join ==="
+                  << std::endl;
+        std::vector<JoinedTuple> opencl_res =
+            run_planned_join(context, queue, program, R, S, table, plan);
+        std::cout << "OpenCL produced " << opencl_res.size()
+                  << " joined tuples" << std::endl;
+        if (run_std_join) {
+          std::cout << "OpenCL Verification: "
+                    << (same_join_result(opencl_res, stdRes) ? "PASS"
+                                                             : "FAIL")
+                    << "\n";
+        }
+      } else if (deviceIndex < numDevices) {
         cl::Device device = devices[deviceIndex];
 
         std::string name;
@@ -208,44 +420,33 @@ int main(int argc, char *argv[]) {
         cl::CommandQueue queue(context, device, CL_QUEUE_PROFILING_ENABLE);
 
         // Create programs and kernels
-        cl::Program program(context, util::loadProgram("hj.cl"), true);
+        cl::Program program = build_join_program(context, table.rids_per_key);
 
-        cl::make_kernel<cl::Buffer, cl::Buffer> b1(program, "b1");
         cl::make_kernel<cl::Buffer, cl::Buffer> b2(program, "b2");
-        cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer> b3(
-            program, "b3");
+        cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer, cl_uint>
+            b3(program, "b3");
         cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer> b4(
             program, "b4");
-        cl::make_kernel<cl::Buffer, cl::Buffer> p1(program, "p1");
+        HashKernels hash_keys(program);
         cl::make_kernel<cl::Buffer, cl::Buffer> p2(program, "p2");
         cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer,
-                        cl::Buffer>
+                        cl::Buffer, cl_uint>
             p3(program, "p3");
         cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer,
-                        cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer,
                         cl::Buffer, cl::Buffer>
             p4(program, "p4");
+        // Fused b1+b3+b4 / p1+p3+p4
+        cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl_uint> build(
+            program, "build");
+        cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer,
+                        cl::Buffer, cl_uint>
+            probe(program, "probe");
 
-        std::vector<uint32_t> R_keys(R_LENGTH), R_rids(R_LENGTH),
-            S_keys(S_LENGTH), S_rids(S_LENGTH);
-        for (int i = 0; i < R_LENGTH; i++) {
-          R_keys[i] = R[i].key;
-          R_rids[i] = R[i].rid;
-        }
-        for (int i = 0; i < S_LENGTH; i++) {
-          S_keys[i] = S[i].key;
-          S_rids[i] = S[i].rid;
-        }
-
-        // buffer init
-        cl::Buffer R_keys_buf(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
-                              sizeof(uint32_t) * R_LENGTH, &R_keys[0]);
-        cl::Buffer S_keys_buf(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
-                              sizeof(uint32_t) * S_LENGTH, &S_keys[0]);
-        cl::Buffer R_rids_buf(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
-                              sizeof(uint32_t) * R_LENGTH, &R_rids[0]);
-        cl::Buffer S_rids_buf(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
-                              sizeof(uint32_t) * S_LENGTH, &S_rids[0]);
+        // buffer init: the kernels read R and S in place (Tuple as uint2)
+        cl::Buffer R_buf(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
+                         sizeof(Tuple) * R_LENGTH, &R[0]);
+        cl::Buffer S_buf(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
+                         sizeof(Tuple) * S_LENGTH, &S[0]);
 
         // b1
         cl::Buffer R_bucket_ids_buf(context,
@@ -255,20 +456,21 @@ int main(int argc, char *argv[]) {
         // b2
         cl::Buffer bucket_total_buf(context,
                                     CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-                                    sizeof(uint32_t) * BUCKET_HEADER_NUMBER);
+                                    sizeof(uint32_t) * table.buckets);
 
-        // b3
+        // b3 - hash table lives in huge-page backed host memory
+        huge_vector<uint32_t> bucket_keys(table.key_slots(), 0xffffffffu);
         cl::Buffer bucket_keys_buf(
-            context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-            sizeof(uint32_t) * BUCKET_HEADER_NUMBER * MAX_KEYS_PER_BUCKET);
+            context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR,
+            sizeof(uint32_t) * table.key_slots(), &bucket_keys[0]);
         cl::Buffer key_indices_buf(context, CL_MEM_READ_WRITE,
                                    sizeof(uint32_t) * R_LENGTH);
 
         // b4
+        huge_vector<uint32_t> bucket_key_rids(table.rid_slots(), 0xffffffffu);
         cl::Buffer bucket_key_rids_buf(
-            context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-            sizeof(uint32_t) * BUCKET_HEADER_NUMBER * MAX_KEYS_PER_BUCKET *
-                MAX_RIDS_PER_KEY);
+            context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR,
+            sizeof(uint32_t) * table.rid_slots(), &bucket_key_rids[0]);
 
         // p1
         cl::Buffer S_bucket_ids_buf(context,
@@ -287,56 +489,53 @@ int main(int argc, char *argv[]) {
 
         // p4 - Pre-allocate large buffer: S_LENGTH * MAX_RIDS_PER_KEY
         // Each S tuple gets MAX_RIDS_PER_KEY slots - NO ATOMIC OPERATIONS
-        // NEEDED
+        // NEEDED. Only R rids are stored (join_result.hpp).
         size_t max_result_size = (size_t)S_LENGTH * MAX_RIDS_PER_KEY;
-        cl::Buffer result_key_buf(context,
-                                  CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-                                  sizeof(uint32_t) * max_result_size);
         cl::Buffer result_rid_buf(context,
                                   CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
                                   sizeof(uint32_t) * max_result_size);
-        cl::Buffer result_sid_buf(context,
-                                  CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-                                  sizeof(uint32_t) * max_result_size);
         cl::Buffer result_count_buf(context,
                                     CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
                                     sizeof(uint32_t) * S_LENGTH);
 
-        std::vector<uint32_t> bucket_totalNumcounts(BUCKET_HEADER_NUMBER, 0);
-
-        // Initialize buffers to zero
-        queue.enqueueWriteBuffer(bucket_total_buf, CL_TRUE, 0,
-                                 sizeof(uint32_t) * BUCKET_HEADER_NUMBER,
-                                 &bucket_totalNumcounts[0]);
-
-        // Zero-initialize large buffers
-        std::vector<uint32_t> bucket_key_rids_init(
-            BUCKET_HEADER_NUMBER * MAX_KEYS_PER_BUCKET * MAX_RIDS_PER_KEY,
-            0xffffffffu);
-        std::vector<uint32_t> bucket_keys_init(
-            BUCKET_HEADER_NUMBER * MAX_KEYS_PER_BUCKET, 0xffffffffu);
-        std::vector<uint32_t> result_count_init(S_LENGTH, 0);
-        queue.enqueueWriteBuffer(bucket_key_rids_buf, CL_TRUE, 0,
-                                 sizeof(uint32_t) * BUCKET_HEADER_NUMBER *
-                                     MAX_KEYS_PER_BUCKET * MAX_RIDS_PER_KEY,
-                                 &bucket_key_rids_init[0]);
-        queue.enqueueWriteBuffer(bucket_keys_buf, CL_TRUE, 0,
-                                 sizeof(uint32_t) * BUCKET_HEADER_NUMBER *
-                                     MAX_KEYS_PER_BUCKET,
-                                 &bucket_keys_init[0]);
-        queue.enqueueWriteBuffer(result_count_buf, CL_TRUE, 0,
-                                 sizeof(uint32_t) * S_LENGTH,
-                                 &result_count_init[0]);
+        // Zero counts on the device; the hash table host storage is already
+        // filled with 0xffffffff
+        queue.enqueueFillBuffer(bucket_total_buf, 0u, 0,
+                                sizeof(uint32_t) * table.buckets);
+        queue.enqueueFillBuffer(result_count_buf, 0u, 0,
+                                sizeof(uint32_t) * S_LENGTH);
+        queue.finish();
+        track_buffer("R_bucket_ids", R_bucket_ids_buf);
+        track_buffer("bucket_total", bucket_total_buf);
+        track_buffer("key_indices", key_indices_buf);
+        track_buffer("S_bucket_ids", S_bucket_ids_buf);
+        track_buffer("S_key_indices", S_key_indices_buf);
+        track_buffer("S_match_found", S_match_found_buf);
+        track_buffer("result_rid", result_rid_buf);
+        track_buffer("result_count", result_count_buf);
+
+        // b1/p1: vector width and tuples per work-item for this device
+        HashVariant hash_variant = default_hash_variant(device);
+        if (run_vec_bench) {
+          std::cout << "\n=== b1/p1 Variant Benchmark (" << name << ") ==="
+                    << std::endl;
+          hash_variant = hash_keys.tune(queue, R_buf, R_bucket_ids_buf,
+                                        table.buckets, R_LENGTH);
+        }
+        std::cout << "b1/p1 variant: " << to_string(hash_variant) << std::endl;
+
+        hugepage::print_stats(std::cout);
 
         // Build Phase
+        memtrack::tracker().phase("build");
         std::cout << "\n=== OpenCL Build Phase ===" << std::endl;
 
         util::Timer opencl_timer, step_timer;
         opencl_timer.reset();
         step_timer.reset();
         // b1: compute hash bucket number
-        b1(cl::EnqueueArgs(queue, cl::NDRange(R_LENGTH)), R_keys_buf,
-           R_bucket_ids_buf);
+        hash_keys(queue, hash_variant, R_buf, R_bucket_ids_buf,
+                  table.buckets, R_LENGTH);
         queue.finish();
         double b1_time = step_timer.getTimeMilliseconds();
 
@@ -349,13 +548,13 @@ int main(int argc, char *argv[]) {
 
         // b3: manage key lists
         step_timer.reset();
-        b3(cl::EnqueueArgs(queue, cl::NDRange(R_LENGTH)), R_keys_buf,
-           R_bucket_ids_buf, bucket_keys_buf, key_indices_buf);
+        b3(cl::EnqueueArgs(queue, cl::NDRange(R_LENGTH)), R_buf,
+           R_bucket_ids_buf, bucket_keys_buf, key_indices_buf, table.buckets);
         queue.finish();
         double b3_time = step_timer.getTimeMilliseconds();
         // b4: insert record ids
         step_timer.reset();
-        b4(cl::EnqueueArgs(queue, cl::NDRange(R_LENGTH)), R_rids_buf,
+        b4(cl::EnqueueArgs(queue, cl::NDRange(R_LENGTH)), R_buf,
            R_bucket_ids_buf, key_indices_buf, bucket_key_rids_buf);
         queue.finish();
         double b4_time = step_timer.getTimeMilliseconds();
@@ -366,13 +565,14 @@ int main(int argc, char *argv[]) {
         std::cout << "Build Phase Total: " << build_time << " ms" << std::endl;
 
         // Probe Phase
+        memtrack::tracker().phase("probe");
         std::cout << "\n=== OpenCL Probe Phase ===" << std::endl;
 
         // p1: compute hash bucket number
         opencl_timer.reset();
         step_timer.reset();
-        p1(cl::EnqueueArgs(queue, cl::NDRange(S_LENGTH)), S_keys_buf,
-           S_bucket_ids_buf);
+        hash_keys(queue, hash_variant, S_buf, S_bucket_ids_buf,
+                  table.buckets, S_LENGTH);
         queue.finish();
         double p1_time = step_timer.getTimeMilliseconds();
 
@@ -384,17 +584,16 @@ int main(int argc, char *argv[]) {
         double p2_time = step_timer.getTimeMilliseconds();
         // p3: search key lists
         step_timer.reset();
-        p3(cl::EnqueueArgs(queue, cl::NDRange(S_LENGTH)), S_keys_buf,
+        p3(cl::EnqueueArgs(queue, cl::NDRange(S_LENGTH)), S_buf,
            S_bucket_ids_buf, bucket_keys_buf, S_key_indices_buf,
-           S_match_found_buf);
+           S_match_found_buf, table.buckets);
         queue.finish();
         double p3_time = step_timer.getTimeMilliseconds();
         // p4: join matching records (NO ATOMIC OPERATIONS!)
         step_timer.reset();
-        p4(cl::EnqueueArgs(queue, cl::NDRange(S_LENGTH)), S_keys_buf,
-           S_rids_buf, S_key_indices_buf, S_match_found_buf,
-           bucket_key_rids_buf, S_bucket_ids_buf, result_key_buf,
-           result_rid_buf, result_sid_buf, result_count_buf);
+        p4(cl::EnqueueArgs(queue, cl::NDRange(S_LENGTH)), S_key_indices_buf,
+           S_match_found_buf, bucket_key_rids_buf, S_bucket_ids_buf,
+           result_rid_buf, result_count_buf);
         queue.finish();
         double p4_time = step_timer.getTimeMilliseconds();
         double probe_time = opencl_timer.getTimeMilliseconds();
@@ -402,73 +601,26 @@ int main(int argc, char *argv[]) {
                   << "\np3 time: " << p3_time << "\np4 time: " << p4_time
                   << std::endl;
         std::cout << "Probe Phase Total: " << probe_time << " ms" << std::endl;
+        std::cout << "Probe throughput: "
+                  << (probe_time > 0 ? S_LENGTH / probe_time / 1000.0 : 0)
+                  << " M tuples/s" << std::endl;
 
         std::cout << "\nOpenCL Join Total: " << build_time + probe_time << " ms"
                   << std::endl;
 
-        // Read back result counts directly from GPU
-        std::vector<uint32_t> result_counts(S_LENGTH);
-        queue.enqueueReadBuffer(result_count_buf, CL_TRUE, 0,
-                                sizeof(uint32_t) * S_LENGTH, &result_counts[0]);
-
-        // Calculate total number of results
-        uint32_t num_results = 0;
-        for (uint32_t i = 0; i < S_LENGTH; i++) {
-          num_results += result_counts[i];
-        }
-
-        std::cout << "OpenCL produced " << num_results << " joined tuples"
+        memtrack::tracker().phase("compact");
+        // Dense results from the device: only the matches are read back
+        util::Timer compact_timer;
+        compact_timer.reset();
+        ResultCompactor compactor(context, program, S_LENGTH);
+        MappedView<JoinedTuple> opencl_res = compactor.compact(
+            queue, S_buf, result_rid_buf, result_count_buf, S_LENGTH);
+        uint32_t num_results = (uint32_t)opencl_res.size();
+
+        std::cout << "OpenCL produced " << num_results << " joined tuples ("
+                  << compact_timer.getTimeMilliseconds() << " ms compaction)"
                   << std::endl;
 
-        std::vector<JoinedTuple> opencl_res;
-
-        if (num_results > 0) {
-          // Read the sparse result buffers
-          std::vector<uint32_t> sparse_keys(max_result_size);
-          std::vector<uint32_t> sparse_rids(max_result_size);
-          std::vector<uint32_t> sparse_sids(max_result_size);
-
-          queue.enqueueReadBuffer(result_key_buf, CL_TRUE, 0,
-                                  sizeof(uint32_t) * max_result_size,
-                                  &sparse_keys[0]);
-          queue.enqueueReadBuffer(result_rid_buf, CL_TRUE, 0,
-                                  sizeof(uint32_t) * max_result_size,
-                                  &sparse_rids[0]);
-          queue.enqueueReadBuffer(result_sid_buf, CL_TRUE, 0,
-                                  sizeof(uint32_t) * max_result_size,
-                                  &sparse_sids[0]);
-
-          // Compact results: remove empty slots
-          std::vector<uint32_t> result_keys;
-          std::vector<uint32_t> result_rids;
-          std::vector<uint32_t> result_sids;
-          result_keys.reserve(num_results);
-          result_rids.reserve(num_results);
-          result_sids.reserve(num_results);
-
-          for (uint32_t i = 0; i < S_LENGTH; i++) {
-            uint32_t count = result_counts[i];
-            if (count > 0) {
-              uint32_t base_offset = i * MAX_RIDS_PER_KEY;
-              for (uint32_t j = 0; j < count; j++) {
-                result_keys.push_back(sparse_keys[base_offset + j]);
-                result_rids.push_back(sparse_rids[base_offset + j]);
-                result_sids.push_back(sparse_sids[base_offset + j]);
-              }
-            }
-          }
-
-          // Convert to JoinedTuple format
-          opencl_res.reserve(num_results);
-          for (uint32_t i = 0; i < num_results; i++) {
-            JoinedTuple jt;
-            jt.key = result_keys[i];
-            jt.ridR = result_rids[i];
-            jt.ridS = result_sids[i];
-            opencl_res.push_back(jt);
-          }
-        }
-
         // Compare OpenCL result with Standard join result
         if (run_std_join && opencl_res.size() > 0) {
           bool opencl_pass = (opencl_res.size() == stdRes.size());
@@ -496,227 +648,291 @@ int main(int argc, char *argv[]) {
           std::cout << "OpenCL Verification: "
                     << (opencl_pass ? "PASS" : "FAIL") << "\n";
         }
-      } else if (deviceIndex == 2) { // DD optimization
-        cl::Device CPU = devices[0];
-        cl::Device GPU = devices[1];
 
-        std::string name;
-        getDeviceName(CPU, name);
-        std::cout << "\nUsing OpenCL CPU: " << name << "\n";
-        getDeviceName(GPU, name);
-        std::cout << "\nUsing OpenCL GPU: " << name << "\n";
+        // Same join with the fused kernels on a fresh table: no bucket id,
+        // key index or match flag buffers round-trip through global memory
+        std::cout << "\n=== OpenCL Fused Kernels ===" << std::endl;
+        queue.enqueueFillBuffer(bucket_keys_buf, 0xffffffffu, 0,
+                                sizeof(uint32_t) * table.key_slots());
+        queue.enqueueFillBuffer(bucket_key_rids_buf, 0xffffffffu, 0,
+                                sizeof(uint32_t) * table.rid_slots());
+        queue.finish();
 
-        std::vector<cl::Device> chosen_device;
-        chosen_device.push_back(CPU);
-        chosen_device.push_back(GPU);
-        cl::Context context(chosen_device);
-        cl::CommandQueue cpu_queue(context, CPU, CL_QUEUE_PROFILING_ENABLE);
-        cl::CommandQueue gpu_queue(context, GPU, CL_QUEUE_PROFILING_ENABLE);
+        opencl_timer.reset();
+        build(cl::EnqueueArgs(queue, cl::NDRange(R_LENGTH)), R_buf,
+              bucket_keys_buf, bucket_key_rids_buf, table.buckets);
+        queue.finish();
+        double fused_build_time = opencl_timer.getTimeMilliseconds();
+
+        opencl_timer.reset();
+        probe(cl::EnqueueArgs(queue, cl::NDRange(S_LENGTH)), S_buf,
+              bucket_keys_buf, bucket_key_rids_buf, result_rid_buf,
+              result_count_buf, table.buckets);
+        queue.finish();
+        double fused_probe_time = opencl_timer.getTimeMilliseconds();
+
+        uint32_t fused_results =
+            (uint32_t)compactor.count(queue, result_count_buf, S_LENGTH);
+
+        std::cout << "Fused build: " << fused_build_time
+                  << " ms\nFused probe: " << fused_probe_time << " ms"
+                  << std::endl;
+        std::cout << "Fused produced " << fused_results << " joined tuples"
+                  << (fused_results == num_results ? "" : " (MISMATCH)")
+                  << std::endl;
+        std::cout << "End-to-end: staged " << build_time + probe_time
+                  << " ms, fused " << fused_build_time + fused_probe_time
+                  << " ms" << std::endl;
+
+        // Same join on a pointer-based table the host can walk too
+        if (run_svm) {
+          std::cout << "\n=== OpenCL SVM Chained Table ===" << std::endl;
+          if (svm_supported(device)) {
+            size_t svm_results =
+                run_svm_join(context, queue, R, S, table, morsel_cfg.threads);
+            if (svm_results != num_results)
+              std::cout << "SVM result count MISMATCH" << std::endl;
+          } else {
+            std::cout << "SVM not supported on " << name
+                      << "; buffer path only" << std::endl;
+          }
+        }
+
+        if (run_width_bench) {
+          std::cout << "\n=== Key Width Benchmark ===" << std::endl;
+          run_width_benchmark(context, queue, R, S, table);
+        }
+
+        // Keys replaced by dense codes of R's keys; the 64-bit run joins
+        // wide keys on the same 32-bit kernels
+        if (run_dict) {
+          std::cout << "\n=== Dictionary-Encoded Join ===" << std::endl;
+          DictionaryJoin<uint32_t> dict_join(context, queue, program, R,
+                                             morsel_cfg.threads);
+          size_t dict_results = dict_join.probe(S).size();
+          std::cout << "Dictionary join produced " << dict_results
+                    << " joined tuples"
+                    << (dict_results == num_results ? "" : " (MISMATCH)")
+                    << std::endl;
+
+          std::cout << "64-bit keys:" << std::endl;
+          huge_vector<BasicTuple<uint64_t, uint32_t>> R64 = widen_keys(R);
+          huge_vector<BasicTuple<uint64_t, uint32_t>> S64 = widen_keys(S);
+          DictionaryJoin<uint64_t> wide_dict(context, queue, program, R64,
+                                             morsel_cfg.threads);
+          size_t wide_results = wide_dict.probe(S64).size();
+          std::cout << "Dictionary join produced " << wide_results
+                    << " joined tuples"
+                    << (wide_results == num_results ? "" : " (MISMATCH)")
+                    << std::endl;
+        }
 
-        cl::Program program(context, util::loadProgram("hj.cl"), true);
-        cl::make_kernel<cl::Buffer, cl::Buffer> b1(program, "b1");
+        // Fused join on a table sized for each load factor from the same
+        // key sample: memory against probe throughput
+        if (run_lf_bench) {
+          std::cout << "\n=== Load Factor Benchmark ===" << std::endl;
+          for (int i = 5; i <= 9; i++) {
+            double lf = i / 10.0;
+            TableSize t = size_table(key_sample, R.size(), lf);
+            huge_vector<uint32_t> lf_keys(t.key_slots(), 0xffffffffu);
+            huge_vector<uint32_t> lf_rids(t.rid_slots(), 0xffffffffu);
+            cl::Buffer lf_keys_buf(context,
+                                   CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR,
+                                   sizeof(uint32_t) * t.key_slots(),
+                                   &lf_keys[0]);
+            cl::Buffer lf_rids_buf(context,
+                                   CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR,
+                                   sizeof(uint32_t) * t.rid_slots(),
+                                   &lf_rids[0]);
+
+            opencl_timer.reset();
+            build(cl::EnqueueArgs(queue, cl::NDRange(R_LENGTH)), R_buf,
+                  lf_keys_buf, lf_rids_buf, t.buckets);
+            queue.finish();
+            double lf_build_time = opencl_timer.getTimeMilliseconds();
+
+            opencl_timer.reset();
+            probe(cl::EnqueueArgs(queue, cl::NDRange(S_LENGTH)), S_buf,
+                  lf_keys_buf, lf_rids_buf, result_rid_buf, result_count_buf,
+                  t.buckets);
+            queue.finish();
+            double lf_probe_time = opencl_timer.getTimeMilliseconds();
+
+            uint32_t lf_results =
+                (uint32_t)compactor.count(queue, result_count_buf, S_LENGTH);
+
+            std::cout << "Load factor " << lf << ": " << t.buckets
+                      << " buckets, " << t.bytes() / (1 << 20)
+                      << " MB, build " << lf_build_time << " ms, probe "
+                      << lf_probe_time << " ms ("
+                      << (lf_probe_time > 0
+                              ? S_LENGTH / lf_probe_time / 1000.0
+                              : 0)
+                      << " M tuples/s)"
+                      << (lf_results == num_results ? "" : " (MISMATCH)")
+                      << std::endl;
+          }
+        }
+      } else if (deviceIndex == 2) { // DD optimization
+        std::cout << std::endl;
+        std::vector<cl::Device> chosen_device = pick_devices(devices, fission);
+        print_device_set(chosen_device, fission);
+        cl::Device CPU = chosen_device[STEP_CPU];
+        cl::Device GPU = chosen_device[STEP_GPU];
+        // Context, queues, program and pooled buffers for this mode
+        JoinContext jc(chosen_device, table);
+        cl::Context &context = jc.context();
+        cl::CommandQueue &cpu_queue = jc.queue(STEP_CPU);
+        cl::CommandQueue &gpu_queue = jc.queue(STEP_GPU);
+
+        cl::Program &program = jc.program();
         cl::make_kernel<cl::Buffer, cl::Buffer> b2(program, "b2");
-        cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer> b3(
-            program, "b3");
+        cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer, cl_uint>
+            b3(program, "b3");
         cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer> b4(
             program, "b4");
-        cl::make_kernel<cl::Buffer, cl::Buffer> p1(program, "p1");
+        HashKernels hash_keys(program);
         cl::make_kernel<cl::Buffer, cl::Buffer> p2(program, "p2");
         cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer,
-                        cl::Buffer>
+                        cl::Buffer, cl_uint>
             p3(program, "p3");
         cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer,
-                        cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer,
                         cl::Buffer, cl::Buffer>
             p4(program, "p4");
 
-        std::vector<uint32_t> R_keys(R_LENGTH), R_rids(R_LENGTH),
-            S_keys(S_LENGTH), S_rids(S_LENGTH);
-        for (int i = 0; i < R_LENGTH; i++) {
-          R_keys[i] = R[i].key;
-          R_rids[i] = R[i].rid;
-        }
-        for (int i = 0; i < S_LENGTH; i++) {
-          S_keys[i] = S[i].key;
-          S_rids[i] = S[i].rid;
-        }
-
-        // buffer init
-        cl::Buffer R_keys_buf(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
-                              sizeof(uint32_t) * R_LENGTH, &R_keys[0]);
-        cl::Buffer S_keys_buf(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
-                              sizeof(uint32_t) * S_LENGTH, &S_keys[0]);
-        cl::Buffer R_rids_buf(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
-                              sizeof(uint32_t) * R_LENGTH, &R_rids[0]);
-        cl::Buffer S_rids_buf(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
-                              sizeof(uint32_t) * S_LENGTH, &S_rids[0]);
-
-        // Separated hash tables: CPU and GPU each have their own hash tables
-        // Build phase: R data is split between CPU and GPU according to
-        // WORK_RATIO_GPU
-
-        // R portion 계산: WORK_RATIO_GPU 비율에 따라 분할 (4096의 배수로 조정)
-        size_t gpu_R_portion =
-            ((R_LENGTH * WORK_RATIO_GPU / 100) / 4096) * 4096;
-        size_t cpu_R_portion = ((R_LENGTH - gpu_R_portion) / 4096) * 4096;
-        gpu_R_portion = R_LENGTH - cpu_R_portion;
-
-        // gpu_R_portion의 최소값을 4096으로 보장
-        if (gpu_R_portion == 0 && R_LENGTH >= 4096) {
-          gpu_R_portion = 4096;
-          cpu_R_portion = R_LENGTH - gpu_R_portion;
-        }
-
-        std::cout << "\nR data distribution: GPU " << gpu_R_portion
-                  << " tuples, CPU " << cpu_R_portion << " tuples" << std::endl;
-
-        // CPU용 R sub-buffers
-        cl_buffer_region cpu_R_keys_region = {0,
-                                              sizeof(uint32_t) * cpu_R_portion};
-        cl_buffer_region cpu_R_rids_region = {0,
-                                              sizeof(uint32_t) * cpu_R_portion};
-        cl::Buffer R_keys_cpu_buf = R_keys_buf.createSubBuffer(
-            CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION, &cpu_R_keys_region);
-        cl::Buffer R_rids_cpu_buf = R_rids_buf.createSubBuffer(
-            CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION, &cpu_R_rids_region);
-
-        // GPU용 R sub-buffers
-        cl_buffer_region gpu_R_keys_region = {sizeof(uint32_t) * cpu_R_portion,
-                                              sizeof(uint32_t) * gpu_R_portion};
-        cl_buffer_region gpu_R_rids_region = {sizeof(uint32_t) * cpu_R_portion,
-                                              sizeof(uint32_t) * gpu_R_portion};
-        cl::Buffer R_keys_gpu_buf = R_keys_buf.createSubBuffer(
-            CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION, &gpu_R_keys_region);
-        cl::Buffer R_rids_gpu_buf = R_rids_buf.createSubBuffer(
-            CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION, &gpu_R_rids_region);
-
-        // CPU hash table buffers
-        cl::Buffer R_bucket_ids_cpu_buf(
-            context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-            sizeof(uint32_t) * cpu_R_portion);
-        cl::Buffer bucket_total_cpu_buf(
-            context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-            sizeof(uint32_t) * BUCKET_HEADER_NUMBER);
-        cl::Buffer bucket_keys_cpu_buf(
-            context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-            sizeof(uint32_t) * BUCKET_HEADER_NUMBER * MAX_KEYS_PER_BUCKET);
-        cl::Buffer key_indices_cpu_buf(context, CL_MEM_READ_WRITE,
-                                       sizeof(uint32_t) * cpu_R_portion);
-        cl::Buffer bucket_key_rids_cpu_buf(
-            context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-            sizeof(uint32_t) * BUCKET_HEADER_NUMBER * MAX_KEYS_PER_BUCKET *
-                MAX_RIDS_PER_KEY);
-
-        // GPU hash table buffers
-        cl::Buffer R_bucket_ids_gpu_buf(
-            context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-            sizeof(uint32_t) * gpu_R_portion);
-        cl::Buffer bucket_total_gpu_buf(
-            context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-            sizeof(uint32_t) * BUCKET_HEADER_NUMBER);
-        cl::Buffer bucket_keys_gpu_buf(
-            context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-            sizeof(uint32_t) * BUCKET_HEADER_NUMBER * MAX_KEYS_PER_BUCKET);
-        cl::Buffer key_indices_gpu_buf(context, CL_MEM_READ_WRITE,
-                                       sizeof(uint32_t) * gpu_R_portion);
-        cl::Buffer bucket_key_rids_gpu_buf(
-            context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-            sizeof(uint32_t) * BUCKET_HEADER_NUMBER * MAX_KEYS_PER_BUCKET *
-                MAX_RIDS_PER_KEY);
+        // buffer init: the kernels read R and S in place (Tuple as uint2)
+        cl::Buffer R_buf(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
+                         sizeof(Tuple) * R_LENGTH, &R[0]);
+        cl::Buffer S_buf(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
+                         sizeof(Tuple) * S_LENGTH, &S[0]);
+
+        // The CPU builds the one table every probe reads (sharded DD adds a
+        // GPU table of its own below); each device has its own bucket_total
+        cl::Buffer &bucket_total_cpu_buf =
+            jc.buffer("bucket_total_cpu",
+                      CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                      sizeof(uint32_t) * table.buckets, 0u);
+        cl::Buffer &bucket_keys_cpu_buf =
+            jc.host_table("bucket_keys_cpu",
+                          sizeof(uint32_t) * table.key_slots(), 0xffffffffu);
+        cl::Buffer &bucket_key_rids_cpu_buf =
+            jc.host_table("bucket_key_rids_cpu",
+                          sizeof(uint32_t) * table.rid_slots(), 0xffffffffu);
+        cl::Buffer &bucket_total_gpu_buf =
+            jc.buffer("bucket_total_gpu",
+                      CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                      sizeof(uint32_t) * table.buckets, 0u);
 
         // p1
-        cl::Buffer S_bucket_ids_buf(context,
-                                    CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-                                    sizeof(uint32_t) * S_LENGTH);
+        cl::Buffer &S_bucket_ids_buf =
+            jc.buffer("S_bucket_ids", CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                      sizeof(uint32_t) * S_LENGTH);
 
         // p2
 
-        // p3
-        cl::Buffer S_key_indices_buf(context,
-                                     CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-                                     sizeof(int) * S_LENGTH);
-        cl::Buffer S_match_found_buf(context,
-                                     CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-                                     sizeof(uint32_t) * S_LENGTH);
+        // p3; the sharded layout has a gap before the CPU's S tuples
+        size_t dd_S_slots = dd_shard ? shard_slots(S_LENGTH) : S_LENGTH;
+        cl::Buffer &S_key_indices_buf =
+            jc.buffer("S_key_indices",
+                      CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                      sizeof(int) * dd_S_slots);
+        cl::Buffer &S_match_found_buf =
+            jc.buffer("S_match_found",
+                      CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                      sizeof(uint32_t) * dd_S_slots);
 
         // p4 - Pre-allocate large buffer: S_LENGTH * MAX_RIDS_PER_KEY
         // Each S tuple gets MAX_RIDS_PER_KEY slots - NO ATOMIC OPERATIONS
         // NEEDED
-        size_t max_result_size = (size_t)S_LENGTH * MAX_RIDS_PER_KEY;
-        cl::Buffer result_key_buf(context,
-                                  CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-                                  sizeof(uint32_t) * max_result_size);
-        cl::Buffer result_rid_buf(context,
-                                  CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-                                  sizeof(uint32_t) * max_result_size);
-        cl::Buffer result_sid_buf(context,
-                                  CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-                                  sizeof(uint32_t) * max_result_size);
-        cl::Buffer result_count_buf(context,
-                                    CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-                                    sizeof(uint32_t) * S_LENGTH);
-
-        std::vector<uint32_t> bucket_totalNumcounts(BUCKET_HEADER_NUMBER, 0);
-
-        // Initialize CPU hash table buffers
-        cpu_queue.enqueueWriteBuffer(bucket_total_cpu_buf, CL_TRUE, 0,
-                                     sizeof(uint32_t) * BUCKET_HEADER_NUMBER,
-                                     &bucket_totalNumcounts[0]);
-        std::vector<uint32_t> bucket_key_rids_init(
-            BUCKET_HEADER_NUMBER * MAX_KEYS_PER_BUCKET * MAX_RIDS_PER_KEY,
-            0xffffffffu);
-        std::vector<uint32_t> bucket_keys_init(
-            BUCKET_HEADER_NUMBER * MAX_KEYS_PER_BUCKET, 0xffffffffu);
-        cpu_queue.enqueueWriteBuffer(bucket_key_rids_cpu_buf, CL_TRUE, 0,
-                                     sizeof(uint32_t) * BUCKET_HEADER_NUMBER *
-                                         MAX_KEYS_PER_BUCKET * MAX_RIDS_PER_KEY,
-                                     &bucket_key_rids_init[0]);
-        cpu_queue.enqueueWriteBuffer(bucket_keys_cpu_buf, CL_TRUE, 0,
-                                     sizeof(uint32_t) * BUCKET_HEADER_NUMBER *
-                                         MAX_KEYS_PER_BUCKET,
-                                     &bucket_keys_init[0]);
-
-        // Initialize GPU hash table buffers
-        gpu_queue.enqueueWriteBuffer(bucket_total_gpu_buf, CL_TRUE, 0,
-                                     sizeof(uint32_t) * BUCKET_HEADER_NUMBER,
-                                     &bucket_totalNumcounts[0]);
-        gpu_queue.enqueueWriteBuffer(bucket_key_rids_gpu_buf, CL_TRUE, 0,
-                                     sizeof(uint32_t) * BUCKET_HEADER_NUMBER *
-                                         MAX_KEYS_PER_BUCKET * MAX_RIDS_PER_KEY,
-                                     &bucket_key_rids_init[0]);
-        gpu_queue.enqueueWriteBuffer(bucket_keys_gpu_buf, CL_TRUE, 0,
-                                     sizeof(uint32_t) * BUCKET_HEADER_NUMBER *
-                                         MAX_KEYS_PER_BUCKET,
-                                     &bucket_keys_init[0]);
-
-        // Initialize result buffers
-        std::vector<uint32_t> result_count_init(S_LENGTH, 0);
-        cpu_queue.enqueueWriteBuffer(result_count_buf, CL_TRUE, 0,
-                                     sizeof(uint32_t) * S_LENGTH,
-                                     &result_count_init[0]);
+        size_t max_result_size = dd_S_slots * MAX_RIDS_PER_KEY;
+        cl::Buffer &result_rid_buf =
+            jc.buffer("result_rid", CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                      sizeof(uint32_t) * max_result_size);
+        cl::Buffer &result_count_buf =
+            jc.buffer("result_count", CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                      sizeof(uint32_t) * dd_S_slots, 0u);
+
+        // Empty tables and zero counts, filled on the device
+        jc.reset();
+
+        // b1/p1: vector width and tuples per work-item for each device
+        HashVariant cpu_hash = default_hash_variant(CPU);
+        HashVariant gpu_hash = default_hash_variant(GPU);
+        if (run_vec_bench) {
+          std::cout << "\n=== b1/p1 Variant Benchmark (CPU) ===" << std::endl;
+          cpu_hash = hash_keys.tune(cpu_queue, S_buf, S_bucket_ids_buf,
+                                    table.buckets, S_LENGTH);
+          std::cout << "\n=== b1/p1 Variant Benchmark (GPU) ===" << std::endl;
+          gpu_hash = hash_keys.tune(gpu_queue, S_buf, S_bucket_ids_buf,
+                                    table.buckets, S_LENGTH);
+        }
+        std::cout << "b1/p1 variant: CPU " << to_string(cpu_hash) << ", GPU "
+                  << to_string(gpu_hash) << std::endl;
 
+        hugepage::print_stats(std::cout);
         std::cout << "\n=== OpenCL Build Phase (CPU-only Hash Table) ==="
                   << std::endl;
         util::Timer opencl_timer;
         opencl_timer.reset();
         // Build phase: CPU builds the entire hash table
-        cl::Buffer R_bucket_ids_buf(context, CL_MEM_READ_WRITE,
-                                    sizeof(uint32_t) * R_LENGTH);
-        cl::Buffer key_indices_buf(context, CL_MEM_READ_WRITE,
-                                   sizeof(uint32_t) * R_LENGTH);
-
-        b1(cl::EnqueueArgs(cpu_queue, cl::NDRange(R_LENGTH)), R_keys_buf,
-           R_bucket_ids_buf);
+        cl::Buffer &R_bucket_ids_buf =
+            jc.buffer("R_bucket_ids", CL_MEM_READ_WRITE,
+                      sizeof(uint32_t) * R_LENGTH);
+        cl::Buffer &key_indices_buf =
+            jc.buffer("key_indices", CL_MEM_READ_WRITE,
+                      sizeof(uint32_t) * R_LENGTH);
+
+        hash_keys(cpu_queue, cpu_hash, R_buf, R_bucket_ids_buf,
+                  table.buckets, R_LENGTH);
         b2(cl::EnqueueArgs(cpu_queue, cl::NDRange(R_LENGTH)), R_bucket_ids_buf,
            bucket_total_cpu_buf);
-        b3(cl::EnqueueArgs(cpu_queue, cl::NDRange(R_LENGTH)), R_keys_buf,
-           R_bucket_ids_buf, bucket_keys_cpu_buf, key_indices_buf);
-        b4(cl::EnqueueArgs(cpu_queue, cl::NDRange(R_LENGTH)), R_rids_buf,
+        b3(cl::EnqueueArgs(cpu_queue, cl::NDRange(R_LENGTH)), R_buf,
+           R_bucket_ids_buf, bucket_keys_cpu_buf, key_indices_buf,
+           table.buckets);
+        b4(cl::EnqueueArgs(cpu_queue, cl::NDRange(R_LENGTH)), R_buf,
            R_bucket_ids_buf, key_indices_buf, bucket_key_rids_cpu_buf);
         cpu_queue.finish();
         double build_time = opencl_timer.getTimeMilliseconds();
         std::cout << "Build Phase Total: " << build_time << " ms" << std::endl;
 
+        // Dynamic chunking works on the full-length S and result buffers
+        std::vector<cl::CommandQueue> &dd_queues = jc.queues();
+        std::vector<HashVariant> dd_variants = {cpu_hash, gpu_hash};
+        for (size_t i = 2; i < chosen_device.size(); i++)
+          dd_variants.push_back(default_hash_variant(chosen_device[i]));
+        DDProbeBuffers dd_bufs;
+        dd_bufs.S = S_buf;
+        dd_bufs.S_bucket_ids = S_bucket_ids_buf;
+        dd_bufs.S_key_indices = S_key_indices_buf;
+        dd_bufs.S_match_found = S_match_found_buf;
+        dd_bufs.bucket_total = bucket_total_cpu_buf;
+        dd_bufs.bucket_keys = bucket_keys_cpu_buf;
+        dd_bufs.bucket_key_rids = bucket_key_rids_cpu_buf;
+        dd_bufs.result_rid = result_rid_buf;
+        dd_bufs.result_count = result_count_buf;
+        dd_bufs.table = table;
+
+        // Split: cache hit, otherwise plan it from the cost model (miss,
+        // --retune); --bench still sweeps every ratio
+        std::string dd_key = TuneCache::make_key("DD", chosen_device,
+                                                 table.buckets);
+        TuneValues dd_tuned;
+        bool dd_hit = !force_retune && tune_cache.lookup(dd_key, dd_tuned);
+        long dd_ratio = tune_value(dd_tuned, "gpu_ratio", WORK_RATIO_GPU);
+        if (dd_hit) {
+          std::cout << "\nTuned config from " << tune_cache.path() << ":";
+          print_tune_values(dd_tuned);
+        } else if (!run_bench) {
+          CalibrationBuffers cal_bufs = {R_buf, bucket_keys_cpu_buf,
+                                         bucket_key_rids_cpu_buf, table};
+          CostPlan cost_plan =
+              calibrate_and_plan(context, program, cpu_queue, gpu_queue,
+                                 cpu_hash, gpu_hash, cal_bufs, false);
+          dd_ratio = cost_plan.dd_ratio;
+          tune_cache.store(dd_key, {{"gpu_ratio", dd_ratio}});
+          std::cout << "Stored in " << tune_cache.path() << std::endl;
+        }
+
         // Probe Phase
         if (run_bench) {
           std::cout << "\n=== OpenCL Probe Phase DD Benchmark ===" << std::endl;
@@ -743,70 +959,37 @@ int main(int argc, char *argv[]) {
             }
 
             // GPU용 sub-buffers 생성 (ratio당 한 번만 생성)
-            cl_buffer_region gpu_keys_region = {0,
-                                                sizeof(uint32_t) * gpu_portion};
-            cl_buffer_region gpu_rids_region = {0,
-                                                sizeof(uint32_t) * gpu_portion};
-            cl_buffer_region gpu_result_key_region = {
-                0, sizeof(uint32_t) * gpu_portion * MAX_RIDS_PER_KEY};
+            cl_buffer_region gpu_S_region = {0, sizeof(Tuple) * gpu_portion};
             cl_buffer_region gpu_result_rid_region = {
                 0, sizeof(uint32_t) * gpu_portion * MAX_RIDS_PER_KEY};
-            cl_buffer_region gpu_result_sid_region = {
-                0, sizeof(uint32_t) * gpu_portion * MAX_RIDS_PER_KEY};
             cl_buffer_region gpu_result_count_region = {0, sizeof(uint32_t) *
                                                                gpu_portion};
 
-            cl::Buffer S_keys_gpu_buf = S_keys_buf.createSubBuffer(
-                CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION,
-                &gpu_keys_region);
-            cl::Buffer S_rids_gpu_buf = S_rids_buf.createSubBuffer(
+            cl::Buffer S_gpu_buf = S_buf.createSubBuffer(
                 CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION,
-                &gpu_rids_region);
-            cl::Buffer result_key_gpu_buf = result_key_buf.createSubBuffer(
-                CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-                &gpu_result_key_region);
+                &gpu_S_region);
             cl::Buffer result_rid_gpu_buf = result_rid_buf.createSubBuffer(
                 CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
                 &gpu_result_rid_region);
-            cl::Buffer result_sid_gpu_buf = result_sid_buf.createSubBuffer(
-                CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-                &gpu_result_sid_region);
             cl::Buffer result_count_gpu_buf = result_count_buf.createSubBuffer(
                 CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
                 &gpu_result_count_region);
 
             // CPU용 sub-buffers 생성
-            cl_buffer_region cpu_keys_region = {sizeof(uint32_t) * gpu_portion,
-                                                sizeof(uint32_t) * cpu_portion};
-            cl_buffer_region cpu_rids_region = {sizeof(uint32_t) * gpu_portion,
-                                                sizeof(uint32_t) * cpu_portion};
-            cl_buffer_region cpu_result_key_region = {
-                sizeof(uint32_t) * gpu_portion * MAX_RIDS_PER_KEY,
-                sizeof(uint32_t) * cpu_portion * MAX_RIDS_PER_KEY};
+            cl_buffer_region cpu_S_region = {sizeof(Tuple) * gpu_portion,
+                                             sizeof(Tuple) * cpu_portion};
             cl_buffer_region cpu_result_rid_region = {
                 sizeof(uint32_t) * gpu_portion * MAX_RIDS_PER_KEY,
                 sizeof(uint32_t) * cpu_portion * MAX_RIDS_PER_KEY};
-            cl_buffer_region cpu_result_sid_region = {
-                sizeof(uint32_t) * gpu_portion * MAX_RIDS_PER_KEY,
-                sizeof(uint32_t) * cpu_portion * MAX_RIDS_PER_KEY};
             cl_buffer_region cpu_result_count_region = {
                 sizeof(uint32_t) * gpu_portion, sizeof(uint32_t) * cpu_portion};
 
-            cl::Buffer S_keys_cpu_buf = S_keys_buf.createSubBuffer(
+            cl::Buffer S_cpu_buf = S_buf.createSubBuffer(
                 CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION,
-                &cpu_keys_region);
-            cl::Buffer S_rids_cpu_buf = S_rids_buf.createSubBuffer(
-                CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION,
-                &cpu_rids_region);
-            cl::Buffer result_key_cpu_buf = result_key_buf.createSubBuffer(
-                CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-                &cpu_result_key_region);
+                &cpu_S_region);
             cl::Buffer result_rid_cpu_buf = result_rid_buf.createSubBuffer(
                 CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
                 &cpu_result_rid_region);
-            cl::Buffer result_sid_cpu_buf = result_sid_buf.createSubBuffer(
-                CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-                &cpu_result_sid_region);
             cl::Buffer result_count_cpu_buf = result_count_buf.createSubBuffer(
                 CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
                 &cpu_result_count_region);
@@ -815,19 +998,25 @@ int main(int argc, char *argv[]) {
             const int num_iterations = 10;
 
             for (int iter = 0; iter < num_iterations; iter++) {
-              // 매 iteration마다 새로 생성하는 버퍼들 (상태가 변경되므로)
-              cl::Buffer S_bucket_ids_gpu_buf(context, CL_MEM_READ_WRITE,
-                                              sizeof(uint32_t) * gpu_portion);
-              cl::Buffer S_key_indices_gpu_buf(context, CL_MEM_READ_WRITE,
-                                               sizeof(int) * gpu_portion);
-              cl::Buffer S_match_found_gpu_buf(context, CL_MEM_READ_WRITE,
-                                               sizeof(uint32_t) * gpu_portion);
-              cl::Buffer S_bucket_ids_cpu_buf(context, CL_MEM_READ_WRITE,
-                                              sizeof(uint32_t) * cpu_portion);
-              cl::Buffer S_key_indices_cpu_buf(context, CL_MEM_READ_WRITE,
-                                               sizeof(int) * cpu_portion);
-              cl::Buffer S_match_found_cpu_buf(context, CL_MEM_READ_WRITE,
-                                               sizeof(uint32_t) * cpu_portion);
+              // Pooled at full length: p1/p3 overwrite them every iteration
+              cl::Buffer &S_bucket_ids_gpu_buf =
+                  jc.buffer("S_bucket_ids_gpu", CL_MEM_READ_WRITE,
+                            sizeof(uint32_t) * S_LENGTH);
+              cl::Buffer &S_key_indices_gpu_buf =
+                  jc.buffer("S_key_indices_gpu", CL_MEM_READ_WRITE,
+                            sizeof(int) * S_LENGTH);
+              cl::Buffer &S_match_found_gpu_buf =
+                  jc.buffer("S_match_found_gpu", CL_MEM_READ_WRITE,
+                            sizeof(uint32_t) * S_LENGTH);
+              cl::Buffer &S_bucket_ids_cpu_buf =
+                  jc.buffer("S_bucket_ids_cpu", CL_MEM_READ_WRITE,
+                            sizeof(uint32_t) * S_LENGTH);
+              cl::Buffer &S_key_indices_cpu_buf =
+                  jc.buffer("S_key_indices_cpu", CL_MEM_READ_WRITE,
+                            sizeof(int) * S_LENGTH);
+              cl::Buffer &S_match_found_cpu_buf =
+                  jc.buffer("S_match_found_cpu", CL_MEM_READ_WRITE,
+                            sizeof(uint32_t) * S_LENGTH);
 
               // Probe phase 실행
               util::Timer probe_timer;
@@ -837,33 +1026,31 @@ int main(int argc, char *argv[]) {
               // GPU probe phase - GPU hash table only
 
               // CPU probe phase - CPU hash table only
-              p1(cl::EnqueueArgs(cpu_queue, cl::NDRange(cpu_portion)),
-                 S_keys_cpu_buf, S_bucket_ids_cpu_buf);
+              hash_keys(cpu_queue, cpu_hash, S_cpu_buf,
+                        S_bucket_ids_cpu_buf, table.buckets, cpu_portion);
               p2(cl::EnqueueArgs(cpu_queue, cl::NDRange(cpu_portion)),
                  S_bucket_ids_cpu_buf, bucket_total_cpu_buf);
               p3(cl::EnqueueArgs(cpu_queue, cl::NDRange(cpu_portion)),
-                 S_keys_cpu_buf, S_bucket_ids_cpu_buf, bucket_keys_cpu_buf,
-                 S_key_indices_cpu_buf, S_match_found_cpu_buf);
+                 S_cpu_buf, S_bucket_ids_cpu_buf, bucket_keys_cpu_buf,
+                 S_key_indices_cpu_buf, S_match_found_cpu_buf, table.buckets);
               probe_events[1] = p4(
                   cl::EnqueueArgs(cpu_queue, cl::NDRange(cpu_portion)),
-                  S_keys_cpu_buf, S_rids_cpu_buf, S_key_indices_cpu_buf,
-                  S_match_found_cpu_buf, bucket_key_rids_cpu_buf,
-                  S_bucket_ids_cpu_buf, result_key_cpu_buf, result_rid_cpu_buf,
-                  result_sid_cpu_buf, result_count_cpu_buf);
+                  S_key_indices_cpu_buf, S_match_found_cpu_buf,
+                  bucket_key_rids_cpu_buf, S_bucket_ids_cpu_buf,
+                  result_rid_cpu_buf, result_count_cpu_buf);
               cpu_queue.flush();
-              p1(cl::EnqueueArgs(gpu_queue, cl::NDRange(gpu_portion)),
-                 S_keys_gpu_buf, S_bucket_ids_gpu_buf);
+              hash_keys(gpu_queue, gpu_hash, S_gpu_buf,
+                        S_bucket_ids_gpu_buf, table.buckets, gpu_portion);
               p2(cl::EnqueueArgs(gpu_queue, cl::NDRange(gpu_portion)),
                  S_bucket_ids_gpu_buf, bucket_total_gpu_buf);
               p3(cl::EnqueueArgs(gpu_queue, cl::NDRange(gpu_portion)),
-                 S_keys_gpu_buf, S_bucket_ids_gpu_buf, bucket_keys_cpu_buf,
-                 S_key_indices_gpu_buf, S_match_found_gpu_buf);
+                 S_gpu_buf, S_bucket_ids_gpu_buf, bucket_keys_cpu_buf,
+                 S_key_indices_gpu_buf, S_match_found_gpu_buf, table.buckets);
               probe_events[0] = p4(
                   cl::EnqueueArgs(gpu_queue, cl::NDRange(gpu_portion)),
-                  S_keys_gpu_buf, S_rids_gpu_buf, S_key_indices_gpu_buf,
-                  S_match_found_gpu_buf, bucket_key_rids_cpu_buf,
-                  S_bucket_ids_gpu_buf, result_key_gpu_buf, result_rid_gpu_buf,
-                  result_sid_gpu_buf, result_count_gpu_buf);
+                  S_key_indices_gpu_buf, S_match_found_gpu_buf,
+                  bucket_key_rids_cpu_buf, S_bucket_ids_gpu_buf,
+                  result_rid_gpu_buf, result_count_gpu_buf);
               gpu_queue.flush();
 
               // 두 device의 probe phase 완료 대기
@@ -889,209 +1076,156 @@ int main(int argc, char *argv[]) {
                     << std::endl;
           std::cout << "Best Average Time: " << best_avg_time << " ms"
                     << std::endl;
-        } else {
-          std::cout << "\n=== OpenCL Probe Phase ===" << std::endl;
-
-          // Probe phase: S 데이터를 나눠서 처리 (work distribution)
-          // WORK_RATIO_GPU에 따라 분할 (각 portion은 4096의 배수)
-          // GPU portion 계산: WORK_RATIO_GPU 비율에 따라 계산하고 4096의 배수로
-          // 조정
-          size_t gpu_portion =
-              ((S_LENGTH * WORK_RATIO_GPU / 100) / 4096) * 4096;
-          // CPU portion 계산: 나머지를 4096의 배수로 조정
-          size_t cpu_portion = ((S_LENGTH - gpu_portion) / 4096) * 4096;
-          // 합이 정확히 S_LENGTH가 되도록 GPU portion 재조정
-          gpu_portion = S_LENGTH - cpu_portion;
-
-          // GPU용 sub-buffers 생성 (cl_buffer_region 사용)
-          // GPU는 앞부분 처리 (0부터 gpu_portion까지)
-          cl_buffer_region gpu_keys_region = {0,
-                                              sizeof(uint32_t) * gpu_portion};
-          cl_buffer_region gpu_rids_region = {0,
-                                              sizeof(uint32_t) * gpu_portion};
-          cl_buffer_region gpu_result_key_region = {
-              0, sizeof(uint32_t) * gpu_portion * MAX_RIDS_PER_KEY};
-          cl_buffer_region gpu_result_rid_region = {
-              0, sizeof(uint32_t) * gpu_portion * MAX_RIDS_PER_KEY};
-          cl_buffer_region gpu_result_sid_region = {
-              0, sizeof(uint32_t) * gpu_portion * MAX_RIDS_PER_KEY};
-          cl_buffer_region gpu_result_count_region = {0, sizeof(uint32_t) *
-                                                             gpu_portion};
-
-          cl::Buffer S_keys_gpu_buf = S_keys_buf.createSubBuffer(
-              CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION, &gpu_keys_region);
-          cl::Buffer S_rids_gpu_buf = S_rids_buf.createSubBuffer(
-              CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION, &gpu_rids_region);
-          cl::Buffer S_bucket_ids_gpu_buf(context, CL_MEM_READ_WRITE,
-                                          sizeof(uint32_t) * gpu_portion);
-          cl::Buffer S_key_indices_gpu_buf(context, CL_MEM_READ_WRITE,
-                                           sizeof(int) * gpu_portion);
-          cl::Buffer S_match_found_gpu_buf(context, CL_MEM_READ_WRITE,
-                                           sizeof(uint32_t) * gpu_portion);
-          cl::Buffer result_key_gpu_buf = result_key_buf.createSubBuffer(
-              CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-              &gpu_result_key_region);
-          cl::Buffer result_rid_gpu_buf = result_rid_buf.createSubBuffer(
-              CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-              &gpu_result_rid_region);
-          cl::Buffer result_sid_gpu_buf = result_sid_buf.createSubBuffer(
-              CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-              &gpu_result_sid_region);
-          cl::Buffer result_count_gpu_buf = result_count_buf.createSubBuffer(
-              CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-              &gpu_result_count_region);
-
-          // CPU용 sub-buffers 생성
-          // CPU는 뒷부분 처리 (gpu_portion부터 S_LENGTH까지)
-          cl_buffer_region cpu_keys_region = {sizeof(uint32_t) * gpu_portion,
-                                              sizeof(uint32_t) * cpu_portion};
-          cl_buffer_region cpu_rids_region = {sizeof(uint32_t) * gpu_portion,
-                                              sizeof(uint32_t) * cpu_portion};
-          cl_buffer_region cpu_result_key_region = {
-              sizeof(uint32_t) * gpu_portion * MAX_RIDS_PER_KEY,
-              sizeof(uint32_t) * cpu_portion * MAX_RIDS_PER_KEY};
-          cl_buffer_region cpu_result_rid_region = {
-              sizeof(uint32_t) * gpu_portion * MAX_RIDS_PER_KEY,
-              sizeof(uint32_t) * cpu_portion * MAX_RIDS_PER_KEY};
-          cl_buffer_region cpu_result_sid_region = {
-              sizeof(uint32_t) * gpu_portion * MAX_RIDS_PER_KEY,
-              sizeof(uint32_t) * cpu_portion * MAX_RIDS_PER_KEY};
-          cl_buffer_region cpu_result_count_region = {
-              sizeof(uint32_t) * gpu_portion, sizeof(uint32_t) * cpu_portion};
-
-          cl::Buffer S_keys_cpu_buf = S_keys_buf.createSubBuffer(
-              CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION, &cpu_keys_region);
-          cl::Buffer S_rids_cpu_buf = S_rids_buf.createSubBuffer(
-              CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION, &cpu_rids_region);
-          cl::Buffer S_bucket_ids_cpu_buf(context, CL_MEM_READ_WRITE,
-                                          sizeof(uint32_t) * cpu_portion);
-          cl::Buffer S_key_indices_cpu_buf(context, CL_MEM_READ_WRITE,
-                                           sizeof(int) * cpu_portion);
-          cl::Buffer S_match_found_cpu_buf(context, CL_MEM_READ_WRITE,
-                                           sizeof(uint32_t) * cpu_portion);
-          cl::Buffer result_key_cpu_buf = result_key_buf.createSubBuffer(
-              CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-              &cpu_result_key_region);
-          cl::Buffer result_rid_cpu_buf = result_rid_buf.createSubBuffer(
-              CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-              &cpu_result_rid_region);
-          cl::Buffer result_sid_cpu_buf = result_sid_buf.createSubBuffer(
-              CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-              &cpu_result_sid_region);
-          cl::Buffer result_count_cpu_buf = result_count_buf.createSubBuffer(
-              CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-              &cpu_result_count_region);
-
-          opencl_timer.reset();
-          cl::Event probe_events[2];
-
-          // GPU probe phase - GPU hash table only
-          p1(cl::EnqueueArgs(cpu_queue, cl::NDRange(cpu_portion)),
-             S_keys_cpu_buf, S_bucket_ids_cpu_buf);
-          p2(cl::EnqueueArgs(cpu_queue, cl::NDRange(cpu_portion)),
-             S_bucket_ids_cpu_buf, bucket_total_cpu_buf);
-          p3(cl::EnqueueArgs(cpu_queue, cl::NDRange(cpu_portion)),
-             S_keys_cpu_buf, S_bucket_ids_cpu_buf, bucket_keys_cpu_buf,
-             S_key_indices_cpu_buf, S_match_found_cpu_buf);
-          probe_events[1] =
-              p4(cl::EnqueueArgs(cpu_queue, cl::NDRange(cpu_portion)),
-                 S_keys_cpu_buf, S_rids_cpu_buf, S_key_indices_cpu_buf,
-                 S_match_found_cpu_buf, bucket_key_rids_cpu_buf,
-                 S_bucket_ids_cpu_buf, result_key_cpu_buf, result_rid_cpu_buf,
-                 result_sid_cpu_buf, result_count_cpu_buf);
-          cpu_queue.flush();
-          p1(cl::EnqueueArgs(gpu_queue, cl::NDRange(gpu_portion)),
-             S_keys_gpu_buf, S_bucket_ids_gpu_buf);
-          p2(cl::EnqueueArgs(gpu_queue, cl::NDRange(gpu_portion)),
-             S_bucket_ids_gpu_buf, bucket_total_gpu_buf);
-          p3(cl::EnqueueArgs(gpu_queue, cl::NDRange(gpu_portion)),
-             S_keys_gpu_buf, S_bucket_ids_gpu_buf, bucket_keys_cpu_buf,
-             S_key_indices_gpu_buf, S_match_found_gpu_buf);
-          probe_events[0] =
-              p4(cl::EnqueueArgs(gpu_queue, cl::NDRange(gpu_portion)),
-                 S_keys_gpu_buf, S_rids_gpu_buf, S_key_indices_gpu_buf,
-                 S_match_found_gpu_buf, bucket_key_rids_cpu_buf,
-                 S_bucket_ids_gpu_buf, result_key_gpu_buf, result_rid_gpu_buf,
-                 result_sid_gpu_buf, result_count_gpu_buf);
-          gpu_queue.flush();
-
-          // CPU probe phase - CPU hash table only
-
-          // 두 device의 probe phase 완료 대기
-          cl_event event_handles[2] = {probe_events[0](), probe_events[1]()};
-          clWaitForEvents(2, event_handles);
-          double probe_time = opencl_timer.getTimeMilliseconds();
-          std::cout << "Probe Phase Total: " << probe_time << " ms"
-                    << std::endl;
-          std::cout << "OpenCL Hash Join Total: " << build_time + probe_time
-                    << " ms" << std::endl;
-          std::cout << "\nWork distribution: GPU " << gpu_portion
-                    << " tuples, CPU " << cpu_portion << " tuples" << std::endl;
-
-          // Read back result counts directly from shared buffer
-          std::vector<uint32_t> result_counts(S_LENGTH);
-          cpu_queue.enqueueReadBuffer(result_count_buf, CL_TRUE, 0,
-                                      sizeof(uint32_t) * S_LENGTH,
-                                      &result_counts[0]);
-
-          // Calculate total number of results
-          uint32_t num_results = 0;
-          for (uint32_t i = 0; i < S_LENGTH; i++) {
-            num_results += result_counts[i];
-          }
-
-          std::cout << "OpenCL produced " << num_results << " joined tuples"
-                    << std::endl;
+          dd_ratio = best_ratio;
+          tune_cache.store(dd_key, {{"gpu_ratio", dd_ratio}});
+          std::cout << "Stored in " << tune_cache.path() << std::endl;
 
-          std::vector<JoinedTuple> opencl_res;
-
-          if (num_results > 0) {
-            // Read the sparse result buffers
-            std::vector<uint32_t> sparse_keys(max_result_size);
-            std::vector<uint32_t> sparse_rids(max_result_size);
-            std::vector<uint32_t> sparse_sids(max_result_size);
-
-            cpu_queue.enqueueReadBuffer(result_key_buf, CL_TRUE, 0,
-                                        sizeof(uint32_t) * max_result_size,
-                                        &sparse_keys[0]);
-            cpu_queue.enqueueReadBuffer(result_rid_buf, CL_TRUE, 0,
-                                        sizeof(uint32_t) * max_result_size,
-                                        &sparse_rids[0]);
-            cpu_queue.enqueueReadBuffer(result_sid_buf, CL_TRUE, 0,
-                                        sizeof(uint32_t) * max_result_size,
-                                        &sparse_sids[0]);
-
-            // Compact results: remove empty slots
-            std::vector<uint32_t> result_keys;
-            std::vector<uint32_t> result_rids;
-            std::vector<uint32_t> result_sids;
-            result_keys.reserve(num_results);
-            result_rids.reserve(num_results);
-            result_sids.reserve(num_results);
-
-            for (uint32_t i = 0; i < S_LENGTH; i++) {
-              uint32_t count = result_counts[i];
-              if (count > 0) {
-                uint32_t base_offset = i * MAX_RIDS_PER_KEY;
-                for (uint32_t j = 0; j < count; j++) {
-                  result_keys.push_back(sparse_keys[base_offset + j]);
-                  result_rids.push_back(sparse_rids[base_offset + j]);
-                  result_sids.push_back(sparse_sids[base_offset + j]);
-                }
-              }
+          if (dd_dynamic) {
+            std::cout << "\n=== Dynamic Chunking (" << dd_chunk_size(dd_chunk)
+                      << " tuples/chunk) ===" << std::endl;
+            const int num_iterations = 10;
+            double total_time = 0.0;
+            std::vector<DDDeviceStats> dd_stats;
+            for (int iter = 0; iter < num_iterations; iter++) {
+              util::Timer probe_timer;
+              probe_timer.reset();
+              dd_stats = run_dd_dynamic_probe(program, dd_queues, dd_variants,
+                                              dd_bufs, dd_chunk);
+              total_time += probe_timer.getTimeMilliseconds();
             }
+            std::cout << "Average = " << total_time / num_iterations
+                      << " ms (best static: " << best_avg_time << " ms at "
+                      << best_ratio << "%)" << std::endl;
+            print_dd_stats(dd_stats);
+          }
+        }
+        if (!run_bench) {
+          std::cout << "\n=== OpenCL Probe Phase ===" << std::endl;
 
-            // Convert to JoinedTuple format
-            opencl_res.reserve(num_results);
-            for (uint32_t i = 0; i < num_results; i++) {
-              JoinedTuple jt;
-              jt.key = result_keys[i];
-              jt.ridR = result_rids[i];
-              jt.ridS = result_sids[i];
-              opencl_res.push_back(jt);
+          // Static and feedback probes: independent chains on the shared
+          // table; each device has its own bucket_total
+          JoinBuffers dd_cpu_bufs;
+          dd_cpu_bufs.bucket_total = bucket_total_cpu_buf;
+          dd_cpu_bufs.bucket_keys = bucket_keys_cpu_buf;
+          dd_cpu_bufs.bucket_key_rids = bucket_key_rids_cpu_buf;
+          dd_cpu_bufs.S = S_buf;
+          dd_cpu_bufs.S_bucket_ids = S_bucket_ids_buf;
+          dd_cpu_bufs.S_key_indices = S_key_indices_buf;
+          dd_cpu_bufs.S_match_found = S_match_found_buf;
+          dd_cpu_bufs.result_rid = result_rid_buf;
+          dd_cpu_bufs.result_count = result_count_buf;
+          dd_cpu_bufs.table = table;
+          JoinBuffers dd_gpu_bufs = dd_cpu_bufs;
+          dd_gpu_bufs.bucket_total = bucket_total_gpu_buf;
+          JoinSteps dd_cpu_steps(program, dd_cpu_bufs);
+          JoinSteps dd_gpu_steps(program, dd_gpu_bufs);
+
+          double probe_time = 0;
+          cl::Buffer shard_S; // routed S when sharded
+          if (dd_shard) {
+            JoinBuffers shard_in;
+            shard_in.R = R_buf;
+            shard_in.R_bucket_ids = R_bucket_ids_buf;
+            shard_in.bucket_total = bucket_total_cpu_buf;
+            shard_in.S = S_buf;
+            shard_in.S_bucket_ids = S_bucket_ids_buf;
+            shard_in.S_key_indices = S_key_indices_buf;
+            shard_in.S_match_found = S_match_found_buf;
+            shard_in.result_rid = result_rid_buf;
+            shard_in.result_count = result_count_buf;
+            shard_in.table = table;
+            // The GPU's table; run_dd_sharded resets both, so it has no
+            // reset pattern
+            cl_mem_flags gpu_table = CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR;
+            ShardTable shard_tables[2];
+            shard_tables[STEP_CPU] = {bucket_keys_cpu_buf,
+                                      bucket_key_rids_cpu_buf};
+            shard_tables[STEP_GPU] = {
+                jc.buffer("bucket_keys_gpu", gpu_table,
+                          sizeof(uint32_t) * table.key_slots()),
+                jc.buffer("bucket_key_rids_gpu", gpu_table,
+                          sizeof(uint32_t) * table.rid_slots())};
+            std::cout << "Sharded tables: GPU owns " << dd_ratio
+                      << "% of the buckets" << std::endl;
+            DDShardStats shard = run_dd_sharded(context, program, dd_queues,
+                                                dd_variants, shard_in,
+                                                shard_tables, dd_ratio);
+            probe_time = shard.hash_ms + shard.route_ms + shard.join_ms;
+            std::cout << "Hash: " << shard.hash_ms << " ms, route: "
+                      << shard.route_ms << " ms, build+probe: "
+                      << shard.join_ms << " ms" << std::endl;
+            std::cout << "Sharded Join Total: " << probe_time << " ms"
+                      << std::endl;
+            std::cout << "\nWork distribution: GPU R " << shard.R_gpu
+                      << ", S " << shard.S_gpu << " tuples" << std::endl;
+            shard_S = shard.S;
+          } else if (dd_dynamic) {
+            std::cout << "Dynamic chunks: " << dd_chunk_size(dd_chunk)
+                      << " tuples" << std::endl;
+            opencl_timer.reset();
+            std::vector<DDDeviceStats> dd_stats = run_dd_dynamic_probe(
+                program, dd_queues, dd_variants, dd_bufs, dd_chunk);
+            probe_time = opencl_timer.getTimeMilliseconds();
+            std::cout << "Probe Phase Total: " << probe_time << " ms"
+                      << std::endl;
+            std::cout << "OpenCL Hash Join Total: " << build_time + probe_time
+                      << " ms" << std::endl;
+            std::cout << "\nWork distribution:" << std::endl;
+            print_dd_stats(dd_stats);
+          } else if (run_feedback) {
+            // One controller for the whole p1..p4 chain of a chunk
+            std::vector<FeedbackStage> stages = {
+                {"p1", 0, {}}, {"p2", 0, {}}, {"p3", 0, {}}, {"p4", 0, {}}};
+            for (size_t d = 0; d < dd_queues.size(); d++) {
+              JoinSteps &steps = d == STEP_CPU ? dd_cpu_steps : dd_gpu_steps;
+              stages[0].fns.push_back(steps.p1(dd_variants[d]));
+              stages[1].fns.push_back(steps.p2());
+              stages[2].fns.push_back(steps.p3());
+              stages[3].fns.push_back(steps.p4());
             }
+            std::vector<SplitController> control = {SplitController(
+                dd_ratio, feedback_min_share(dd_chunk_size(dd_chunk)))};
+            FeedbackResult fb = run_feedback_probe(dd_queues, stages, control,
+                                                   true, dd_chunk);
+            probe_time = fb.ms;
+            std::cout << "Probe Phase Total: " << probe_time << " ms"
+                      << std::endl;
+            std::cout << "OpenCL Hash Join Total: " << build_time + probe_time
+                      << " ms" << std::endl;
+            print_feedback(fb, {"p1-p4"});
+          } else {
+            // Probe phase: S 데이터를 나눠서 처리 (work distribution)
+            // dd_ratio% of S, in multiples of 4096, goes to queues 1..
+            std::vector<Morsel> dd_parts =
+                split_range({0, S_LENGTH}, dd_ratio, dd_queues.size());
+
+            StepGraph graph(dd_queues);
+            add_dd_probe_plan(graph, dd_cpu_steps, dd_gpu_steps, dd_parts,
+                              dd_variants);
+            probe_time = graph.run();
+            std::cout << "Probe Phase Total: " << probe_time << " ms"
+                      << std::endl;
+            std::cout << "OpenCL Hash Join Total: " << build_time + probe_time
+                      << " ms" << std::endl;
+            std::cout << "\nWork distribution:";
+            for (size_t d = 0; d < dd_parts.size(); d++)
+              std::cout << " [" << d << "] " << dd_parts[d].size();
+            std::cout << " tuples" << std::endl;
           }
 
+          // Dense results from the device: only the matches are read back
+          const cl::Buffer &probe_S = dd_shard ? shard_S : S_buf;
+          util::Timer compact_timer;
+          compact_timer.reset();
+          ResultCompactor compactor(context, program, dd_S_slots);
+          MappedView<JoinedTuple> opencl_res = compactor.compact(
+              cpu_queue, probe_S, result_rid_buf, result_count_buf, dd_S_slots);
+          uint32_t num_results = (uint32_t)opencl_res.size();
+
+          std::cout << "OpenCL produced " << num_results << " joined tuples ("
+                    << compact_timer.getTimeMilliseconds() << " ms compaction)"
+                    << std::endl;
+
           // Compare OpenCL result with Standard join result
           if (run_std_join && opencl_res.size() > 0) {
             bool opencl_pass = (opencl_res.size() == stdRes.size());
@@ -1119,142 +1253,136 @@ int main(int argc, char *argv[]) {
             std::cout << "OpenCL Verification: "
                       << (opencl_pass ? "PASS" : "FAIL") << "\n";
           }
-        } // end of else block (normal mode probe phase)
+        } // end of normal mode probe phase
       } else if (deviceIndex == 3) { // OL optimization
-        cl::Device CPU = devices[0];
-        cl::Device GPU = devices[1];
-
-        std::string name;
-        getDeviceName(CPU, name);
         std::cout << "\n=== OL Optimization Mode ===" << std::endl;
-        std::cout << "Using OpenCL CPU: " << name << "\n";
-        getDeviceName(GPU, name);
-        std::cout << "Using OpenCL GPU: " << name << "\n";
+        std::vector<cl::Device> chosen_device = pick_devices(devices, fission);
+        print_device_set(chosen_device, fission);
+        cl::Device CPU = chosen_device[STEP_CPU];
+        cl::Device GPU = chosen_device[STEP_GPU];
         std::cout << "Step assignment: b1,b2,b3->CPU, b4->GPU, "
                   << "p1,p2,p3->CPU, p4->GPU\n"
                   << std::endl;
 
-        std::vector<cl::Device> chosen_device;
-        chosen_device.push_back(CPU);
-        chosen_device.push_back(GPU);
-        cl::Context context(chosen_device);
-        cl::CommandQueue cpu_queue(context, CPU, CL_QUEUE_PROFILING_ENABLE);
-        cl::CommandQueue gpu_queue(context, GPU, CL_QUEUE_PROFILING_ENABLE);
+        // Context, queues, program and pooled buffers for this mode
+        JoinContext jc(chosen_device, table);
+        cl::Context &context = jc.context();
+        cl::CommandQueue &cpu_queue = jc.queue(STEP_CPU);
+        cl::CommandQueue &gpu_queue = jc.queue(STEP_GPU);
 
-        cl::Program program(context, util::loadProgram("hj.cl"), true);
-        cl::make_kernel<cl::Buffer, cl::Buffer> b1(program, "b1");
-        cl::make_kernel<cl::Buffer, cl::Buffer> b2(program, "b2");
-        cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer> b3(
-            program, "b3");
-        cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer> b4(
-            program, "b4");
-        cl::make_kernel<cl::Buffer, cl::Buffer> p1(program, "p1");
-        cl::make_kernel<cl::Buffer, cl::Buffer> p2(program, "p2");
-        cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer,
-                        cl::Buffer>
-            p3(program, "p3");
-        cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer,
-                        cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer,
-                        cl::Buffer, cl::Buffer>
-            p4(program, "p4");
+        cl::Program &program = jc.program();
+        HashKernels hash_keys(program);
 
-        std::vector<uint32_t> R_keys(R_LENGTH), R_rids(R_LENGTH),
-            S_keys(S_LENGTH), S_rids(S_LENGTH);
-        for (int i = 0; i < R_LENGTH; i++) {
-          R_keys[i] = R[i].key;
-          R_rids[i] = R[i].rid;
-        }
-        for (int i = 0; i < S_LENGTH; i++) {
-          S_keys[i] = S[i].key;
-          S_rids[i] = S[i].rid;
-        }
-
-        // buffer init
-        cl::Buffer R_keys_buf(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
-                              sizeof(uint32_t) * R_LENGTH, &R_keys[0]);
-        cl::Buffer S_keys_buf(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
-                              sizeof(uint32_t) * S_LENGTH, &S_keys[0]);
-        cl::Buffer R_rids_buf(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
-                              sizeof(uint32_t) * R_LENGTH, &R_rids[0]);
-        cl::Buffer S_rids_buf(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
-                              sizeof(uint32_t) * S_LENGTH, &S_rids[0]);
+        // buffer init: the kernels read R and S in place (Tuple as uint2)
+        cl::Buffer R_buf(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
+                         sizeof(Tuple) * R_LENGTH, &R[0]);
+        cl::Buffer S_buf(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
+                         sizeof(Tuple) * S_LENGTH, &S[0]);
 
         // b1
-        cl::Buffer R_bucket_ids_buf(context,
-                                    CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-                                    sizeof(uint32_t) * R_LENGTH);
+        cl::Buffer &R_bucket_ids_buf =
+            jc.buffer("R_bucket_ids", CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                      sizeof(uint32_t) * R_LENGTH);
 
         // b2
-        cl::Buffer bucket_total_buf(context,
-                                    CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-                                    sizeof(uint32_t) * BUCKET_HEADER_NUMBER);
-
-        // b3
-        cl::Buffer bucket_keys_buf(
-            context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-            sizeof(uint32_t) * BUCKET_HEADER_NUMBER * MAX_KEYS_PER_BUCKET);
-        cl::Buffer key_indices_buf(context, CL_MEM_READ_WRITE,
-                                   sizeof(uint32_t) * R_LENGTH);
+        cl::Buffer &bucket_total_buf =
+            jc.buffer("bucket_total", CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                      sizeof(uint32_t) * table.buckets, 0u);
+
+        // b3 - hash table lives in huge-page backed host memory
+        cl::Buffer &bucket_keys_buf =
+            jc.host_table("bucket_keys",
+                          sizeof(uint32_t) * table.key_slots(), 0xffffffffu);
+        cl::Buffer &key_indices_buf =
+            jc.buffer("key_indices", CL_MEM_READ_WRITE,
+                      sizeof(uint32_t) * R_LENGTH);
 
         // b4
-        cl::Buffer bucket_key_rids_buf(
-            context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-            sizeof(uint32_t) * BUCKET_HEADER_NUMBER * MAX_KEYS_PER_BUCKET *
-                MAX_RIDS_PER_KEY);
+        cl::Buffer &bucket_key_rids_buf =
+            jc.host_table("bucket_key_rids",
+                          sizeof(uint32_t) * table.rid_slots(), 0xffffffffu);
 
         // p1
-        cl::Buffer S_bucket_ids_buf(context,
-                                    CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-                                    sizeof(uint32_t) * S_LENGTH);
+        cl::Buffer &S_bucket_ids_buf =
+            jc.buffer("S_bucket_ids", CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                      sizeof(uint32_t) * S_LENGTH);
 
         // p3
-        cl::Buffer S_key_indices_buf(context,
-                                     CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-                                     sizeof(int) * S_LENGTH);
-        cl::Buffer S_match_found_buf(context,
-                                     CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-                                     sizeof(uint32_t) * S_LENGTH);
+        cl::Buffer &S_key_indices_buf =
+            jc.buffer("S_key_indices",
+                      CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                      sizeof(int) * S_LENGTH);
+        cl::Buffer &S_match_found_buf =
+            jc.buffer("S_match_found",
+                      CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                      sizeof(uint32_t) * S_LENGTH);
 
         // p4
         size_t max_result_size = (size_t)S_LENGTH * MAX_RIDS_PER_KEY;
-        cl::Buffer result_key_buf(context,
-                                  CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-                                  sizeof(uint32_t) * max_result_size);
-        cl::Buffer result_rid_buf(context,
-                                  CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-                                  sizeof(uint32_t) * max_result_size);
-        cl::Buffer result_sid_buf(context,
-                                  CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-                                  sizeof(uint32_t) * max_result_size);
-        cl::Buffer result_count_buf(context,
-                                    CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-                                    sizeof(uint32_t) * S_LENGTH);
-
-        std::vector<uint32_t> bucket_totalNumcounts(BUCKET_HEADER_NUMBER, 0);
-
-        // Initialize buffers to zero
-        cpu_queue.enqueueWriteBuffer(bucket_total_buf, CL_TRUE, 0,
-                                     sizeof(uint32_t) * BUCKET_HEADER_NUMBER,
-                                     &bucket_totalNumcounts[0]);
-
-        // Zero-initialize large buffers
-        std::vector<uint32_t> bucket_key_rids_init(
-            BUCKET_HEADER_NUMBER * MAX_KEYS_PER_BUCKET * MAX_RIDS_PER_KEY,
-            0xffffffffu);
-        std::vector<uint32_t> bucket_keys_init(
-            BUCKET_HEADER_NUMBER * MAX_KEYS_PER_BUCKET, 0xffffffffu);
-        std::vector<uint32_t> result_count_init(S_LENGTH, 0);
-        cpu_queue.enqueueWriteBuffer(bucket_key_rids_buf, CL_TRUE, 0,
-                                     sizeof(uint32_t) * BUCKET_HEADER_NUMBER *
-                                         MAX_KEYS_PER_BUCKET * MAX_RIDS_PER_KEY,
-                                     &bucket_key_rids_init[0]);
-        cpu_queue.enqueueWriteBuffer(bucket_keys_buf, CL_TRUE, 0,
-                                     sizeof(uint32_t) * BUCKET_HEADER_NUMBER *
-                                         MAX_KEYS_PER_BUCKET,
-                                     &bucket_keys_init[0]);
-        cpu_queue.enqueueWriteBuffer(result_count_buf, CL_TRUE, 0,
-                                     sizeof(uint32_t) * S_LENGTH,
-                                     &result_count_init[0]);
+        cl::Buffer &result_rid_buf =
+            jc.buffer("result_rid", CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                      sizeof(uint32_t) * max_result_size);
+        cl::Buffer &result_count_buf =
+            jc.buffer("result_count", CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                      sizeof(uint32_t) * S_LENGTH, 0u);
+
+        // Empty table and zero counts, filled on the device
+        jc.reset();
+
+        // b1/p1 run on the CPU unless a --search result moves them
+        HashVariant cpu_hash = default_hash_variant(CPU);
+        HashVariant gpu_hash = default_hash_variant(GPU);
+        if (run_vec_bench) {
+          std::cout << "\n=== b1/p1 Variant Benchmark (CPU) ===" << std::endl;
+          cpu_hash = hash_keys.tune(cpu_queue, S_buf, S_bucket_ids_buf,
+                                    table.buckets, S_LENGTH);
+        }
+        std::cout << "b1/p1 variant: CPU " << to_string(cpu_hash) << std::endl;
+
+        // Every OL run is an add_ol_plan graph over these buffers
+        std::vector<cl::CommandQueue> &ol_queues = jc.queues();
+        std::vector<HashVariant> ol_variants = {cpu_hash, gpu_hash};
+        for (size_t i = 2; i < chosen_device.size(); i++)
+          ol_variants.push_back(default_hash_variant(chosen_device[i]));
+        JoinBuffers ol_bufs;
+        ol_bufs.R = R_buf;
+        ol_bufs.R_bucket_ids = R_bucket_ids_buf;
+        ol_bufs.key_indices = key_indices_buf;
+        ol_bufs.bucket_total = bucket_total_buf;
+        ol_bufs.bucket_keys = bucket_keys_buf;
+        ol_bufs.bucket_key_rids = bucket_key_rids_buf;
+        ol_bufs.S = S_buf;
+        ol_bufs.S_bucket_ids = S_bucket_ids_buf;
+        ol_bufs.S_key_indices = S_key_indices_buf;
+        ol_bufs.S_match_found = S_match_found_buf;
+        ol_bufs.result_rid = result_rid_buf;
+        ol_bufs.result_count = result_count_buf;
+        ol_bufs.table = table;
+        JoinSteps ol_steps(program, ol_bufs);
+
+        hugepage::print_stats(std::cout);
+
+        // Step placement bits [b3][b4][p3][p4] (1 = GPU); default b4+p4 on
+        // the GPU. Cache hit, otherwise plan it from the cost model (miss,
+        // --retune); --bench still runs every combination
+        std::string ol_key = TuneCache::make_key("OL", chosen_device,
+                                                 table.buckets);
+        TuneValues ol_tuned;
+        bool ol_hit = !force_retune && tune_cache.lookup(ol_key, ol_tuned);
+        long ol_placement = tune_value(ol_tuned, "placement", 2 | 8);
+        if (ol_hit) {
+          std::cout << "\nTuned config from " << tune_cache.path() << ":";
+          print_tune_values(ol_tuned);
+        } else if (!run_bench) {
+          CalibrationBuffers cal_bufs = {R_buf, bucket_keys_buf,
+                                         bucket_key_rids_buf, table};
+          CostPlan cost_plan =
+              calibrate_and_plan(context, program, cpu_queue, gpu_queue,
+                                 cpu_hash, gpu_hash, cal_bufs, true);
+          ol_placement = cost_plan.ol_placement;
+          tune_cache.store(ol_key, {{"placement", ol_placement}});
+          std::cout << "Stored in " << tune_cache.path() << std::endl;
+        }
 
         if (run_bench) {
           std::cout << "\n=== OL Step Combination Benchmark ===" << std::endl;
@@ -1278,97 +1406,12 @@ int main(int argc, char *argv[]) {
             const int num_iterations = 10;
 
             for (int iter = 0; iter < num_iterations; iter++) {
-              // Re-initialize buffers for each iteration
-              cpu_queue.enqueueWriteBuffer(bucket_total_buf, CL_TRUE, 0,
-                                           sizeof(uint32_t) *
-                                               BUCKET_HEADER_NUMBER,
-                                           &bucket_totalNumcounts[0]);
-              cpu_queue.enqueueWriteBuffer(
-                  bucket_key_rids_buf, CL_TRUE, 0,
-                  sizeof(uint32_t) * BUCKET_HEADER_NUMBER *
-                      MAX_KEYS_PER_BUCKET * MAX_RIDS_PER_KEY,
-                  &bucket_key_rids_init[0]);
-              cpu_queue.enqueueWriteBuffer(
-                  bucket_keys_buf, CL_TRUE, 0,
-                  sizeof(uint32_t) * BUCKET_HEADER_NUMBER * MAX_KEYS_PER_BUCKET,
-                  &bucket_keys_init[0]);
-              cpu_queue.enqueueWriteBuffer(result_count_buf, CL_TRUE, 0,
-                                           sizeof(uint32_t) * S_LENGTH,
-                                           &result_count_init[0]);
-
-              util::Timer iteration_timer;
-              iteration_timer.reset();
-
-              // Build Phase
-              // b1: CPU (always)
-              b1(cl::EnqueueArgs(cpu_queue, cl::NDRange(R_LENGTH)), R_keys_buf,
-                 R_bucket_ids_buf);
-
-              // b2: CPU (always)
-              b2(cl::EnqueueArgs(cpu_queue, cl::NDRange(R_LENGTH)),
-                 R_bucket_ids_buf, bucket_total_buf);
-
-              // b3: conditional (CPU or GPU)
-              if (b3_on_gpu) {
-                b3(cl::EnqueueArgs(gpu_queue, cl::NDRange(R_LENGTH)),
-                   R_keys_buf, R_bucket_ids_buf, bucket_keys_buf,
-                   key_indices_buf);
-              } else {
-                b3(cl::EnqueueArgs(cpu_queue, cl::NDRange(R_LENGTH)),
-                   R_keys_buf, R_bucket_ids_buf, bucket_keys_buf,
-                   key_indices_buf);
-              }
-
-              // b4: conditional (CPU or GPU)
-              if (b4_on_gpu) {
-                b4(cl::EnqueueArgs(gpu_queue, cl::NDRange(R_LENGTH)),
-                   R_rids_buf, R_bucket_ids_buf, key_indices_buf,
-                   bucket_key_rids_buf);
-              } else {
-                b4(cl::EnqueueArgs(cpu_queue, cl::NDRange(R_LENGTH)),
-                   R_rids_buf, R_bucket_ids_buf, key_indices_buf,
-                   bucket_key_rids_buf);
-              }
-
-              // Probe Phase
-              // p1: CPU (always)
-              p1(cl::EnqueueArgs(cpu_queue, cl::NDRange(S_LENGTH)), S_keys_buf,
-                 S_bucket_ids_buf);
-
-              // p2: CPU (always)
-              p2(cl::EnqueueArgs(cpu_queue, cl::NDRange(S_LENGTH)),
-                 S_bucket_ids_buf, bucket_total_buf);
-
-              // p3: conditional (CPU or GPU)
-              if (p3_on_gpu) {
-                p3(cl::EnqueueArgs(gpu_queue, cl::NDRange(S_LENGTH)),
-                   S_keys_buf, S_bucket_ids_buf, bucket_keys_buf,
-                   S_key_indices_buf, S_match_found_buf);
-              } else {
-                p3(cl::EnqueueArgs(cpu_queue, cl::NDRange(S_LENGTH)),
-                   S_keys_buf, S_bucket_ids_buf, bucket_keys_buf,
-                   S_key_indices_buf, S_match_found_buf);
-              }
+              // Reset the table and counts for each iteration
+              jc.reset();
 
-              // p4: conditional (CPU or GPU)
-              cl::Event p4_event;
-              if (p4_on_gpu) {
-                p4_event = p4(cl::EnqueueArgs(gpu_queue, cl::NDRange(S_LENGTH)),
-                              S_keys_buf, S_rids_buf, S_key_indices_buf,
-                              S_match_found_buf, bucket_key_rids_buf,
-                              S_bucket_ids_buf, result_key_buf, result_rid_buf,
-                              result_sid_buf, result_count_buf);
-              } else {
-                p4_event = p4(cl::EnqueueArgs(cpu_queue, cl::NDRange(S_LENGTH)),
-                              S_keys_buf, S_rids_buf, S_key_indices_buf,
-                              S_match_found_buf, bucket_key_rids_buf,
-                              S_bucket_ids_buf, result_key_buf, result_rid_buf,
-                              result_sid_buf, result_count_buf);
-              }
-              cpu_queue.flush();
-              gpu_queue.flush();
-              p4_event.wait();
-              total_time += iteration_timer.getTimeMilliseconds();
+              StepGraph graph(ol_queues);
+              add_ol_plan(graph, ol_steps, combo, cpu_hash);
+              total_time += graph.run();
             }
 
             double avg_time = total_time / num_iterations;
@@ -1397,106 +1440,74 @@ int main(int argc, char *argv[]) {
           std::cout << "  p4: " << (best_p4_gpu ? "GPU" : "CPU") << std::endl;
           std::cout << "Best Average Time: " << best_avg_time << " ms"
                     << std::endl;
-        } else {
+          ol_placement = best_combination;
+          tune_cache.store(ol_key, {{"placement", ol_placement}});
+          std::cout << "Stored in " << tune_cache.path() << std::endl;
+        }
+
+        // Per-step GPU shares: a valid cached --search result, otherwise the
+        // placement
+        StepShares ol_shares = shares_from_placement(ol_placement);
+        if (ol_hit && !run_bench)
+          load_shares(ol_tuned, ol_shares);
+        if (run_search) {
+          std::cout << "\n=== Step Share Search (OL) ===" << std::endl;
+          std::cout << "Start: [" << to_string(ol_shares) << "]" << std::endl;
+          // Each candidate runs the way the final join will: on buffers
+          // placed for its shares (pooled in jc, so set up once per
+          // placement), with the migrator
+          PlacementSearch search([&](const StepShares &shares) {
+            jc.reset();
+            JoinBuffers placed = place_buffers(jc, ol_bufs, shares, false);
+            JoinSteps placed_steps(program, placed);
+            BufferMigrator migrator(placed);
+            StepGraph graph(ol_queues);
+            add_shares_plan(graph, placed_steps, shares, ol_variants,
+                            migrator.hook());
+            return graph.run();
+          }, table);
+          ol_shares = search.search(ol_shares);
+          std::cout << "Pareto front (time vs GPU-resident bytes):"
+                    << std::endl;
+          print_pareto_front(search.pareto_front());
+          TuneValues values = {{"placement", ol_placement}};
+          store_shares(ol_shares, values);
+          tune_cache.store(ol_key, values);
+          std::cout << "Stored in " << tune_cache.path() << std::endl;
+        }
+        if (!run_bench) {
+          if (!ol_hit || run_search) {
+            // Calibration and the search leave a table behind
+            jc.reset();
+          }
           std::cout << "\n=== OpenCL Build Phase (OL) ===" << std::endl;
-          std::cout << "b1: CPU, b2: CPU, b3: CPU, b4: GPU" << std::endl;
-          std::cout << "p1: CPU, p2: CPU, p3: CPU, p4: GPU" << std::endl;
-          util::Timer opencl_timer;
-          opencl_timer.reset();
-
-          b1(cl::EnqueueArgs(cpu_queue, cl::NDRange(R_LENGTH)), R_keys_buf,
-             R_bucket_ids_buf);
-
-          b2(cl::EnqueueArgs(cpu_queue, cl::NDRange(R_LENGTH)),
-             R_bucket_ids_buf, bucket_total_buf);
-          b3(cl::EnqueueArgs(cpu_queue, cl::NDRange(R_LENGTH)), R_keys_buf,
-             R_bucket_ids_buf, bucket_keys_buf, key_indices_buf);
-          b4(cl::EnqueueArgs(gpu_queue, cl::NDRange(R_LENGTH)), R_rids_buf,
-             R_bucket_ids_buf, key_indices_buf, bucket_key_rids_buf);
-
-          p1(cl::EnqueueArgs(cpu_queue, cl::NDRange(S_LENGTH)), S_keys_buf,
-             S_bucket_ids_buf);
-          p2(cl::EnqueueArgs(cpu_queue, cl::NDRange(S_LENGTH)),
-             S_bucket_ids_buf, bucket_total_buf);
-          p3(cl::EnqueueArgs(cpu_queue, cl::NDRange(S_LENGTH)), S_keys_buf,
-             S_bucket_ids_buf, bucket_keys_buf, S_key_indices_buf,
-             S_match_found_buf);
-          cl::Event p4_event =
-              p4(cl::EnqueueArgs(gpu_queue, cl::NDRange(S_LENGTH)), S_keys_buf,
-                 S_rids_buf, S_key_indices_buf, S_match_found_buf,
-                 bucket_key_rids_buf, S_bucket_ids_buf, result_key_buf,
-                 result_rid_buf, result_sid_buf, result_count_buf);
-          cpu_queue.flush();
-          gpu_queue.flush();
-          p4_event.wait();
-          double probe_time = opencl_timer.getTimeMilliseconds();
+          std::cout << "GPU share (%): " << to_string(ol_shares) << std::endl;
+          // Intermediates allocated for their consumer and migrated ahead of
+          // the steps that move between devices
+          JoinBuffers ol_placed = place_buffers(jc, ol_bufs, ol_shares);
+          JoinSteps ol_placed_steps(program, ol_placed);
+          BufferMigrator migrator(ol_placed);
+          StepGraph graph(ol_queues);
+          add_shares_plan(graph, ol_placed_steps, ol_shares, ol_variants,
+                          migrator.hook());
+          double probe_time = graph.run();
           std::cout << "OpenCL Hash Join Total: " << probe_time << " ms"
                     << std::endl;
-
-          // Read back result counts
-          std::vector<uint32_t> result_counts(S_LENGTH);
-          cpu_queue.enqueueReadBuffer(result_count_buf, CL_TRUE, 0,
-                                      sizeof(uint32_t) * S_LENGTH,
-                                      &result_counts[0]);
-
-          // Calculate total number of results
-          uint32_t num_results = 0;
-          for (uint32_t i = 0; i < S_LENGTH; i++) {
-            num_results += result_counts[i];
-          }
-
-          std::cout << "OpenCL produced " << num_results << " joined tuples"
+          migrator.print(std::cout);
+
+          // Dense results from the device: only the matches are read back
+          util::Timer compact_timer;
+          compact_timer.reset();
+          ResultCompactor compactor(context, program, S_LENGTH);
+          MappedView<JoinedTuple> opencl_res = compactor.compact(
+              cpu_queue, S_buf, ol_placed.result_rid, ol_placed.result_count,
+              S_LENGTH);
+          uint32_t num_results = (uint32_t)opencl_res.size();
+
+          std::cout << "OpenCL produced " << num_results << " joined tuples ("
+                    << compact_timer.getTimeMilliseconds() << " ms compaction)"
                     << std::endl;
 
-          std::vector<JoinedTuple> opencl_res;
-
-          if (num_results > 0) {
-            // Read the sparse result buffers
-            std::vector<uint32_t> sparse_keys(max_result_size);
-            std::vector<uint32_t> sparse_rids(max_result_size);
-            std::vector<uint32_t> sparse_sids(max_result_size);
-
-            cpu_queue.enqueueReadBuffer(result_key_buf, CL_TRUE, 0,
-                                        sizeof(uint32_t) * max_result_size,
-                                        &sparse_keys[0]);
-            cpu_queue.enqueueReadBuffer(result_rid_buf, CL_TRUE, 0,
-                                        sizeof(uint32_t) * max_result_size,
-                                        &sparse_rids[0]);
-            cpu_queue.enqueueReadBuffer(result_sid_buf, CL_TRUE, 0,
-                                        sizeof(uint32_t) * max_result_size,
-                                        &sparse_sids[0]);
-
-            // Compact results: remove empty slots
-            std::vector<uint32_t> result_keys;
-            std::vector<uint32_t> result_rids;
-            std::vector<uint32_t> result_sids;
-            result_keys.reserve(num_results);
-            result_rids.reserve(num_results);
-            result_sids.reserve(num_results);
-
-            for (uint32_t i = 0; i < S_LENGTH; i++) {
-              uint32_t count = result_counts[i];
-              if (count > 0) {
-                uint32_t base_offset = i * MAX_RIDS_PER_KEY;
-                for (uint32_t j = 0; j < count; j++) {
-                  result_keys.push_back(sparse_keys[base_offset + j]);
-                  result_rids.push_back(sparse_rids[base_offset + j]);
-                  result_sids.push_back(sparse_sids[base_offset + j]);
-                }
-              }
-            }
-
-            // Convert to JoinedTuple format
-            opencl_res.reserve(num_results);
-            for (uint32_t i = 0; i < num_results; i++) {
-              JoinedTuple jt;
-              jt.key = result_keys[i];
-              jt.ridR = result_rids[i];
-              jt.ridS = result_sids[i];
-              opencl_res.push_back(jt);
-            }
-          }
-
           // Compare OpenCL result with Standard join result
           if (run_std_join && opencl_res.size() > 0) {
             bool opencl_pass = (opencl_res.size() == stdRes.size());
@@ -1524,132 +1535,108 @@ int main(int argc, char *argv[]) {
             std::cout << "OpenCL Verification: "
                       << (opencl_pass ? "PASS" : "FAIL") << "\n";
           }
-        } // end of else block (normal mode)
+        } // end of normal mode
       } else if (deviceIndex == 4) { // PL optimization
-        // CPU + GPU context
-        cl::Device CPU = devices[0];
-        cl::Device GPU = devices[1];
-        std::vector<cl::Device> chosen_device;
-        chosen_device.push_back(CPU);
-        chosen_device.push_back(GPU);
-        cl::Context context(chosen_device);
-        cl::CommandQueue cpu_queue(context, CPU, CL_QUEUE_PROFILING_ENABLE);
-        cl::CommandQueue gpu_queue(context, GPU, CL_QUEUE_PROFILING_ENABLE);
-
-        cl::Program program(context, util::loadProgram("hj.cl"), true);
-        cl::make_kernel<cl::Buffer, cl::Buffer> b1(program, "b1");
+        // CPU + GPU (+ other devices) context
+        std::cout << std::endl;
+        std::vector<cl::Device> chosen_device = pick_devices(devices, fission);
+        print_device_set(chosen_device, fission);
+        cl::Device CPU = chosen_device[STEP_CPU];
+        cl::Device GPU = chosen_device[STEP_GPU];
+        // Context, queues, program and pooled buffers for this mode
+        JoinContext jc(chosen_device, table);
+        cl::Context &context = jc.context();
+        cl::CommandQueue &cpu_queue = jc.queue(STEP_CPU);
+        cl::CommandQueue &gpu_queue = jc.queue(STEP_GPU);
+
+        cl::Program &program = jc.program();
         cl::make_kernel<cl::Buffer, cl::Buffer> b2(program, "b2");
-        cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer> b3(
-            program, "b3");
+        cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer, cl_uint>
+            b3(program, "b3");
         cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer> b4(
             program, "b4");
-        cl::make_kernel<cl::Buffer, cl::Buffer> p1(program, "p1");
+        HashKernels hash_keys(program);
         cl::make_kernel<cl::Buffer, cl::Buffer> p2(program, "p2");
         cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer,
-                        cl::Buffer>
+                        cl::Buffer, cl_uint>
             p3(program, "p3");
         cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer,
-                        cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer,
                         cl::Buffer, cl::Buffer>
             p4(program, "p4");
 
-        // Host buffers
-        std::vector<uint32_t> R_keys(R_LENGTH), R_rids(R_LENGTH),
-            S_keys(S_LENGTH), S_rids(S_LENGTH);
-        for (int i = 0; i < R_LENGTH; i++) {
-          R_keys[i] = R[i].key;
-          R_rids[i] = R[i].rid;
-        }
-        for (int i = 0; i < S_LENGTH; i++) {
-          S_keys[i] = S[i].key;
-          S_rids[i] = S[i].rid;
-        }
-
-        // Device buffers
-        cl::Buffer R_keys_buf(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
-                              sizeof(uint32_t) * R_LENGTH, &R_keys[0]);
-        cl::Buffer S_keys_buf(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
-                              sizeof(uint32_t) * S_LENGTH, &S_keys[0]);
-        cl::Buffer R_rids_buf(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
-                              sizeof(uint32_t) * R_LENGTH, &R_rids[0]);
-        cl::Buffer S_rids_buf(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
-                              sizeof(uint32_t) * S_LENGTH, &S_rids[0]);
+        // Device buffers: the kernels read R and S in place (Tuple as uint2)
+        cl::Buffer R_buf(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
+                         sizeof(Tuple) * R_LENGTH, &R[0]);
+        cl::Buffer S_buf(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
+                         sizeof(Tuple) * S_LENGTH, &S[0]);
 
         // Build-side buffers (single CPU table)
-        cl::Buffer R_bucket_ids_buf(context, CL_MEM_READ_WRITE,
-                                    sizeof(uint32_t) * R_LENGTH);
-        cl::Buffer bucket_total_buf(context,
-                                    CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-                                    sizeof(uint32_t) * BUCKET_HEADER_NUMBER);
-        cl::Buffer bucket_keys_buf(
-            context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-            sizeof(uint32_t) * BUCKET_HEADER_NUMBER * MAX_KEYS_PER_BUCKET);
-        cl::Buffer key_indices_buf(context, CL_MEM_READ_WRITE,
-                                   sizeof(uint32_t) * R_LENGTH);
-        cl::Buffer bucket_key_rids_buf(
-            context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-            sizeof(uint32_t) * BUCKET_HEADER_NUMBER * MAX_KEYS_PER_BUCKET *
-                MAX_RIDS_PER_KEY);
+        cl::Buffer &R_bucket_ids_buf =
+            jc.buffer("R_bucket_ids", CL_MEM_READ_WRITE,
+                      sizeof(uint32_t) * R_LENGTH);
+        cl::Buffer &bucket_total_buf =
+            jc.buffer("bucket_total", CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                      sizeof(uint32_t) * table.buckets, 0u);
+        cl::Buffer &bucket_keys_buf =
+            jc.host_table("bucket_keys",
+                          sizeof(uint32_t) * table.key_slots(), 0xffffffffu);
+        cl::Buffer &key_indices_buf =
+            jc.buffer("key_indices", CL_MEM_READ_WRITE,
+                      sizeof(uint32_t) * R_LENGTH);
+        cl::Buffer &bucket_key_rids_buf =
+            jc.host_table("bucket_key_rids",
+                          sizeof(uint32_t) * table.rid_slots(), 0xffffffffu);
 
         // Probe-side buffers (shared)
-        cl::Buffer S_bucket_ids_buf(context, CL_MEM_READ_WRITE,
-                                    sizeof(uint32_t) * S_LENGTH);
-        cl::Buffer S_key_indices_buf(context, CL_MEM_READ_WRITE,
-                                     sizeof(int) * S_LENGTH);
-        cl::Buffer S_match_found_buf(context, CL_MEM_READ_WRITE,
-                                     sizeof(uint32_t) * S_LENGTH);
+        cl::Buffer &S_bucket_ids_buf =
+            jc.buffer("S_bucket_ids", CL_MEM_READ_WRITE,
+                      sizeof(uint32_t) * S_LENGTH);
+        cl::Buffer &S_key_indices_buf =
+            jc.buffer("S_key_indices", CL_MEM_READ_WRITE,
+                      sizeof(int) * S_LENGTH);
+        cl::Buffer &S_match_found_buf =
+            jc.buffer("S_match_found", CL_MEM_READ_WRITE,
+                      sizeof(uint32_t) * S_LENGTH);
 
         size_t max_result_size = (size_t)S_LENGTH * MAX_RIDS_PER_KEY;
-        cl::Buffer result_key_buf(context,
-                                  CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-                                  sizeof(uint32_t) * max_result_size);
-        cl::Buffer result_rid_buf(context,
-                                  CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-                                  sizeof(uint32_t) * max_result_size);
-        cl::Buffer result_sid_buf(context,
-                                  CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-                                  sizeof(uint32_t) * max_result_size);
-        cl::Buffer result_count_buf(context,
-                                    CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-                                    sizeof(uint32_t) * S_LENGTH);
-
-        // Initialize tables
-        std::vector<uint32_t> bucket_totalNumcounts(BUCKET_HEADER_NUMBER, 0);
-        std::vector<uint32_t> bucket_key_rids_init(
-            BUCKET_HEADER_NUMBER * MAX_KEYS_PER_BUCKET * MAX_RIDS_PER_KEY,
-            0xffffffffu);
-        std::vector<uint32_t> bucket_keys_init(
-            BUCKET_HEADER_NUMBER * MAX_KEYS_PER_BUCKET, 0xffffffffu);
-        std::vector<uint32_t> result_count_init(S_LENGTH, 0);
-
-        cpu_queue.enqueueWriteBuffer(bucket_total_buf, CL_TRUE, 0,
-                                     sizeof(uint32_t) * BUCKET_HEADER_NUMBER,
-                                     &bucket_totalNumcounts[0]);
-        cpu_queue.enqueueWriteBuffer(bucket_key_rids_buf, CL_TRUE, 0,
-                                     sizeof(uint32_t) * BUCKET_HEADER_NUMBER *
-                                         MAX_KEYS_PER_BUCKET * MAX_RIDS_PER_KEY,
-                                     &bucket_key_rids_init[0]);
-        cpu_queue.enqueueWriteBuffer(bucket_keys_buf, CL_TRUE, 0,
-                                     sizeof(uint32_t) * BUCKET_HEADER_NUMBER *
-                                         MAX_KEYS_PER_BUCKET,
-                                     &bucket_keys_init[0]);
-        cpu_queue.enqueueWriteBuffer(result_count_buf, CL_TRUE, 0,
-                                     sizeof(uint32_t) * S_LENGTH,
-                                     &result_count_init[0]);
+        cl::Buffer &result_rid_buf =
+            jc.buffer("result_rid", CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                      sizeof(uint32_t) * max_result_size);
+        cl::Buffer &result_count_buf =
+            jc.buffer("result_count", CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                      sizeof(uint32_t) * S_LENGTH, 0u);
+
+        // Empty table and zero counts, filled on the device
+        jc.reset();
+
+        // b1/p1: vector width and tuples per work-item for each device
+        HashVariant cpu_hash = default_hash_variant(CPU);
+        HashVariant gpu_hash = default_hash_variant(GPU);
+        if (run_vec_bench) {
+          std::cout << "\n=== b1/p1 Variant Benchmark (CPU) ===" << std::endl;
+          cpu_hash = hash_keys.tune(cpu_queue, S_buf, S_bucket_ids_buf,
+                                    table.buckets, S_LENGTH);
+          std::cout << "\n=== b1/p1 Variant Benchmark (GPU) ===" << std::endl;
+          gpu_hash = hash_keys.tune(gpu_queue, S_buf, S_bucket_ids_buf,
+                                    table.buckets, S_LENGTH);
+        }
+        std::cout << "b1/p1 variant: CPU " << to_string(cpu_hash) << ", GPU "
+                  << to_string(gpu_hash) << std::endl;
 
+        hugepage::print_stats(std::cout);
         std::cout << "\n=== PL Optimization ===" << std::endl;
         std::cout << "Build: CPU-only" << std::endl;
 
         // CPU-only build
         util::Timer timer;
         timer.reset();
-        b1(cl::EnqueueArgs(cpu_queue, cl::NDRange(R_LENGTH)), R_keys_buf,
-           R_bucket_ids_buf);
+        hash_keys(cpu_queue, cpu_hash, R_buf, R_bucket_ids_buf,
+                  table.buckets, R_LENGTH);
         b2(cl::EnqueueArgs(cpu_queue, cl::NDRange(R_LENGTH)), R_bucket_ids_buf,
            bucket_total_buf);
-        b3(cl::EnqueueArgs(cpu_queue, cl::NDRange(R_LENGTH)), R_keys_buf,
-           R_bucket_ids_buf, bucket_keys_buf, key_indices_buf);
-        b4(cl::EnqueueArgs(cpu_queue, cl::NDRange(R_LENGTH)), R_rids_buf,
+        b3(cl::EnqueueArgs(cpu_queue, cl::NDRange(R_LENGTH)), R_buf,
+           R_bucket_ids_buf, bucket_keys_buf, key_indices_buf, table.buckets);
+        b4(cl::EnqueueArgs(cpu_queue, cl::NDRange(R_LENGTH)), R_buf,
            R_bucket_ids_buf, key_indices_buf, bucket_key_rids_buf);
         cpu_queue.finish();
         double build_time = timer.getTimeMilliseconds();
@@ -1658,7 +1645,34 @@ int main(int argc, char *argv[]) {
         // Helper to align portions
         auto align4096 = [](size_t v) { return (v / 4096) * 4096; };
 
-        // Benchmark per-step: p1, p3, p4 (only used when run_bench)
+        // Per-step GPU ratios (%). Cache hit, otherwise plan them from the
+        // cost model (miss, --retune); --bench still sweeps every step
+        std::string pl_key = TuneCache::make_key("PL", chosen_device,
+                                                 table.buckets);
+        TuneValues pl_tuned;
+        bool pl_hit = !force_retune && tune_cache.lookup(pl_key, pl_tuned);
+        long p1_ratio = tune_value(pl_tuned, "p1_ratio", 4);
+        long p3_ratio = tune_value(pl_tuned, "p3_ratio", 4);
+        long p4_ratio = tune_value(pl_tuned, "p4_ratio", 2);
+        if (pl_hit) {
+          std::cout << "\nTuned config from " << tune_cache.path() << ":";
+          print_tune_values(pl_tuned);
+        } else if (!run_bench) {
+          CalibrationBuffers cal_bufs = {R_buf, bucket_keys_buf,
+                                         bucket_key_rids_buf, table};
+          CostPlan cost_plan =
+              calibrate_and_plan(context, program, cpu_queue, gpu_queue,
+                                 cpu_hash, gpu_hash, cal_bufs, false);
+          p1_ratio = cost_plan.p1_ratio;
+          p3_ratio = cost_plan.p3_ratio;
+          p4_ratio = cost_plan.p4_ratio;
+          tune_cache.store(pl_key, {{"p1_ratio", p1_ratio},
+                                    {"p3_ratio", p3_ratio},
+                                    {"p4_ratio", p4_ratio}});
+          std::cout << "Stored in " << tune_cache.path() << std::endl;
+        }
+
+        // Benchmark per-step: p1, p3, p4
         if (run_bench) {
           double best_p1_time = 1e9;
           size_t best_p1_gpu_ratio = 0;
@@ -1678,127 +1692,86 @@ int main(int argc, char *argv[]) {
             p1_time = 0;
             p3_time = 0;
             p4_time = 0;
-            for (int iter = 0; iter < num_iterations; iter++) {
-              // Sub-buffers
-              cl_buffer_region gpu_keys_region = {0, sizeof(uint32_t) *
-                                                         gpu_portion};
-              cl_buffer_region gpu_rids_region = {0, sizeof(uint32_t) *
-                                                         gpu_portion};
-              cl_buffer_region gpu_ids_region = {0, sizeof(uint32_t) *
+            // Sub-buffers for this ratio, shared by all iterations
+            cl_buffer_region gpu_S_region = {0, sizeof(Tuple) * gpu_portion};
+            cl_buffer_region gpu_ids_region = {0, sizeof(uint32_t) *
+                                                      gpu_portion};
+            cl_buffer_region gpu_kidx_region = {0, sizeof(int) * gpu_portion};
+            cl_buffer_region gpu_match_region = {0, sizeof(uint32_t) *
                                                         gpu_portion};
-              cl_buffer_region gpu_kidx_region = {0, sizeof(int) * gpu_portion};
-              cl_buffer_region gpu_match_region = {0, sizeof(uint32_t) *
+            cl_buffer_region gpu_res_rid_region = {
+                0, sizeof(uint32_t) * gpu_portion * MAX_RIDS_PER_KEY};
+            cl_buffer_region gpu_res_cnt_region = {0, sizeof(uint32_t) *
                                                           gpu_portion};
-              cl_buffer_region gpu_res_key_region = {
-                  0, sizeof(uint32_t) * gpu_portion * MAX_RIDS_PER_KEY};
-              cl_buffer_region gpu_res_rid_region = {
-                  0, sizeof(uint32_t) * gpu_portion * MAX_RIDS_PER_KEY};
-              cl_buffer_region gpu_res_sid_region = {
-                  0, sizeof(uint32_t) * gpu_portion * MAX_RIDS_PER_KEY};
-              cl_buffer_region gpu_res_cnt_region = {0, sizeof(uint32_t) *
-                                                            gpu_portion};
-
-              cl_buffer_region cpu_keys_region = {
-                  sizeof(uint32_t) * gpu_portion,
-                  sizeof(uint32_t) * cpu_portion};
-              cl_buffer_region cpu_rids_region = {
-                  sizeof(uint32_t) * gpu_portion,
-                  sizeof(uint32_t) * cpu_portion};
-              cl_buffer_region cpu_ids_region = {sizeof(uint32_t) * gpu_portion,
-                                                 sizeof(uint32_t) *
-                                                     cpu_portion};
-              cl_buffer_region cpu_kidx_region = {sizeof(int) *
-                                                      (ptrdiff_t)gpu_portion,
-                                                  sizeof(int) * cpu_portion};
-              cl_buffer_region cpu_match_region = {
-                  sizeof(uint32_t) * gpu_portion,
-                  sizeof(uint32_t) * cpu_portion};
-              cl_buffer_region cpu_res_key_region = {
-                  sizeof(uint32_t) * gpu_portion * MAX_RIDS_PER_KEY,
-                  sizeof(uint32_t) * cpu_portion * MAX_RIDS_PER_KEY};
-              cl_buffer_region cpu_res_rid_region = {
-                  sizeof(uint32_t) * gpu_portion * MAX_RIDS_PER_KEY,
-                  sizeof(uint32_t) * cpu_portion * MAX_RIDS_PER_KEY};
-              cl_buffer_region cpu_res_sid_region = {
-                  sizeof(uint32_t) * gpu_portion * MAX_RIDS_PER_KEY,
-                  sizeof(uint32_t) * cpu_portion * MAX_RIDS_PER_KEY};
-              cl_buffer_region cpu_res_cnt_region = {
-                  sizeof(uint32_t) * gpu_portion,
-                  sizeof(uint32_t) * cpu_portion};
-
-              cl::Buffer S_keys_gpu_buf = S_keys_buf.createSubBuffer(
-                  CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION,
-                  &gpu_keys_region);
-              cl::Buffer S_rids_gpu_buf = S_rids_buf.createSubBuffer(
-                  CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION,
-                  &gpu_rids_region);
-              cl::Buffer S_bucket_ids_gpu_buf =
-                  S_bucket_ids_buf.createSubBuffer(CL_MEM_READ_WRITE,
-                                                   CL_BUFFER_CREATE_TYPE_REGION,
-                                                   &gpu_ids_region);
-              cl::Buffer S_key_indices_gpu_buf =
-                  S_key_indices_buf.createSubBuffer(
-                      CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-                      &gpu_kidx_region);
-              cl::Buffer S_match_found_gpu_buf =
-                  S_match_found_buf.createSubBuffer(
-                      CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-                      &gpu_match_region);
-              cl::Buffer result_key_gpu_buf = result_key_buf.createSubBuffer(
-                  CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-                  &gpu_res_key_region);
-              cl::Buffer result_rid_gpu_buf = result_rid_buf.createSubBuffer(
-                  CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-                  &gpu_res_rid_region);
-              cl::Buffer result_sid_gpu_buf = result_sid_buf.createSubBuffer(
-                  CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-                  &gpu_res_sid_region);
-              cl::Buffer result_count_gpu_buf =
-                  result_count_buf.createSubBuffer(CL_MEM_READ_WRITE,
-                                                   CL_BUFFER_CREATE_TYPE_REGION,
-                                                   &gpu_res_cnt_region);
-
-              cl::Buffer S_keys_cpu_buf = S_keys_buf.createSubBuffer(
-                  CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION,
-                  &cpu_keys_region);
-              cl::Buffer S_rids_cpu_buf = S_rids_buf.createSubBuffer(
-                  CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION,
-                  &cpu_rids_region);
-              cl::Buffer S_bucket_ids_cpu_sub =
-                  S_bucket_ids_buf.createSubBuffer(CL_MEM_READ_WRITE,
-                                                   CL_BUFFER_CREATE_TYPE_REGION,
-                                                   &cpu_ids_region);
-              cl::Buffer S_key_indices_cpu_sub =
-                  S_key_indices_buf.createSubBuffer(
-                      CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-                      &cpu_kidx_region);
-              cl::Buffer S_match_found_cpu_sub =
-                  S_match_found_buf.createSubBuffer(
-                      CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-                      &cpu_match_region);
-              cl::Buffer result_key_cpu_buf = result_key_buf.createSubBuffer(
-                  CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-                  &cpu_res_key_region);
-              cl::Buffer result_rid_cpu_buf = result_rid_buf.createSubBuffer(
-                  CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-                  &cpu_res_rid_region);
-              cl::Buffer result_sid_cpu_buf = result_sid_buf.createSubBuffer(
-                  CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-                  &cpu_res_sid_region);
-              cl::Buffer result_count_cpu_buf =
-                  result_count_buf.createSubBuffer(CL_MEM_READ_WRITE,
-                                                   CL_BUFFER_CREATE_TYPE_REGION,
-                                                   &cpu_res_cnt_region);
 
+            cl_buffer_region cpu_S_region = {sizeof(Tuple) * gpu_portion,
+                                             sizeof(Tuple) * cpu_portion};
+            cl_buffer_region cpu_ids_region = {sizeof(uint32_t) * gpu_portion,
+                                               sizeof(uint32_t) *
+                                                   cpu_portion};
+            cl_buffer_region cpu_kidx_region = {sizeof(int) *
+                                                    (ptrdiff_t)gpu_portion,
+                                                sizeof(int) * cpu_portion};
+            cl_buffer_region cpu_match_region = {
+                sizeof(uint32_t) * gpu_portion,
+                sizeof(uint32_t) * cpu_portion};
+            cl_buffer_region cpu_res_rid_region = {
+                sizeof(uint32_t) * gpu_portion * MAX_RIDS_PER_KEY,
+                sizeof(uint32_t) * cpu_portion * MAX_RIDS_PER_KEY};
+            cl_buffer_region cpu_res_cnt_region = {
+                sizeof(uint32_t) * gpu_portion,
+                sizeof(uint32_t) * cpu_portion};
+
+            cl::Buffer S_gpu_buf = S_buf.createSubBuffer(
+                CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION,
+                &gpu_S_region);
+            cl::Buffer &S_bucket_ids_gpu_buf =
+                jc.view("S_bucket_ids", gpu_ids_region.origin,
+                        gpu_ids_region.size);
+            cl::Buffer &S_key_indices_gpu_buf =
+                jc.view("S_key_indices", gpu_kidx_region.origin,
+                        gpu_kidx_region.size);
+            cl::Buffer &S_match_found_gpu_buf =
+                jc.view("S_match_found", gpu_match_region.origin,
+                        gpu_match_region.size);
+            cl::Buffer &result_rid_gpu_buf =
+                jc.view("result_rid", gpu_res_rid_region.origin,
+                        gpu_res_rid_region.size);
+            cl::Buffer &result_count_gpu_buf =
+                jc.view("result_count", gpu_res_cnt_region.origin,
+                        gpu_res_cnt_region.size);
+
+            cl::Buffer S_cpu_buf = S_buf.createSubBuffer(
+                CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION,
+                &cpu_S_region);
+            cl::Buffer &S_bucket_ids_cpu_sub =
+                jc.view("S_bucket_ids", cpu_ids_region.origin,
+                        cpu_ids_region.size);
+            cl::Buffer &S_key_indices_cpu_sub =
+                jc.view("S_key_indices", cpu_kidx_region.origin,
+                        cpu_kidx_region.size);
+            cl::Buffer &S_match_found_cpu_sub =
+                jc.view("S_match_found", cpu_match_region.origin,
+                        cpu_match_region.size);
+            cl::Buffer &result_rid_cpu_buf =
+                jc.view("result_rid", cpu_res_rid_region.origin,
+                        cpu_res_rid_region.size);
+            cl::Buffer &result_count_cpu_buf =
+                jc.view("result_count", cpu_res_cnt_region.origin,
+                        cpu_res_cnt_region.size);
+
+            for (int iter = 0; iter < num_iterations; iter++) {
               util::Timer t;
               t.reset();
               cl::Event evs[2];
 
-              evs[0] = p1(cl::EnqueueArgs(cpu_queue, cl::NDRange(cpu_portion)),
-                          S_keys_cpu_buf, S_bucket_ids_cpu_sub);
+              evs[0] = hash_keys(cpu_queue, cpu_hash, S_cpu_buf,
+                                 S_bucket_ids_cpu_sub, table.buckets,
+                                 cpu_portion);
               cpu_queue.flush();
-              evs[1] = p1(cl::EnqueueArgs(gpu_queue, cl::NDRange(gpu_portion)),
-                          S_keys_gpu_buf, S_bucket_ids_gpu_buf);
+              evs[1] = hash_keys(gpu_queue, gpu_hash, S_gpu_buf,
+                                 S_bucket_ids_gpu_buf, table.buckets,
+                                 gpu_portion);
               gpu_queue.flush();
               cl_event hs[2] = {evs[0](), evs[1]()};
               clWaitForEvents(2, hs);
@@ -1809,12 +1782,14 @@ int main(int argc, char *argv[]) {
               t3.reset();
               cl::Event ev3[2];
               ev3[0] = p3(cl::EnqueueArgs(gpu_queue, cl::NDRange(gpu_portion)),
-                          S_keys_gpu_buf, S_bucket_ids_gpu_buf, bucket_keys_buf,
-                          S_key_indices_gpu_buf, S_match_found_gpu_buf);
+                          S_gpu_buf, S_bucket_ids_gpu_buf, bucket_keys_buf,
+                          S_key_indices_gpu_buf, S_match_found_gpu_buf,
+                          table.buckets);
               // p3 for cpu
               ev3[1] = p3(cl::EnqueueArgs(cpu_queue, cl::NDRange(cpu_portion)),
-                          S_keys_cpu_buf, S_bucket_ids_cpu_sub, bucket_keys_buf,
-                          S_key_indices_cpu_sub, S_match_found_cpu_sub);
+                          S_cpu_buf, S_bucket_ids_cpu_sub, bucket_keys_buf,
+                          S_key_indices_cpu_sub, S_match_found_cpu_sub,
+                          table.buckets);
               cpu_queue.flush();
               gpu_queue.flush();
               cl_event eh3[2] = {ev3[0](), ev3[1]()};
@@ -1827,18 +1802,14 @@ int main(int argc, char *argv[]) {
               t4.reset();
               cl::Event ev4[2];
               ev4[0] = p4(cl::EnqueueArgs(gpu_queue, cl::NDRange(gpu_portion)),
-                          S_keys_gpu_buf, S_rids_gpu_buf, S_key_indices_gpu_buf,
-                          S_match_found_gpu_buf, bucket_key_rids_buf,
-                          S_bucket_ids_gpu_buf, result_key_gpu_buf,
-                          result_rid_gpu_buf, result_sid_gpu_buf,
-                          result_count_gpu_buf);
+                          S_key_indices_gpu_buf, S_match_found_gpu_buf,
+                          bucket_key_rids_buf, S_bucket_ids_gpu_buf,
+                          result_rid_gpu_buf, result_count_gpu_buf);
               // p4 for cpu
               ev4[1] = p4(cl::EnqueueArgs(cpu_queue, cl::NDRange(cpu_portion)),
-                          S_keys_cpu_buf, S_rids_cpu_buf, S_key_indices_cpu_sub,
-                          S_match_found_cpu_sub, bucket_key_rids_buf,
-                          S_bucket_ids_cpu_sub, result_key_cpu_buf,
-                          result_rid_cpu_buf, result_sid_cpu_buf,
-                          result_count_cpu_buf);
+                          S_key_indices_cpu_sub, S_match_found_cpu_sub,
+                          bucket_key_rids_buf, S_bucket_ids_cpu_sub,
+                          result_rid_cpu_buf, result_count_cpu_buf);
               cpu_queue.flush();
               gpu_queue.flush();
               cl_event eh4[2] = {ev4[0](), ev4[1]()};
@@ -1865,205 +1836,75 @@ int main(int argc, char *argv[]) {
               best_p4_gpu_ratio = ratio;
             }
           }
-        } else {
-          size_t p1_gpu = 667648, p3_gpu = 667648, p4_gpu = 331776;
-          size_t p1_cpu = S_LENGTH - p1_gpu;
-          std::cout << "p1 GPU: " << p1_gpu << ", p3 GPU: " << p3_gpu
-                    << ", p4 GPU: " << p4_gpu << std::endl;
-
-          util::Timer probe_timer;
-          probe_timer.reset();
-
-          // Run p1 with best split to prepare for p3
-          cl_buffer_region p1_gpu_keys_region = {0, sizeof(uint32_t) * p1_gpu};
-          cl_buffer_region p1_gpu_ids_region = {0, sizeof(uint32_t) * p1_gpu};
-          cl_buffer_region p1_cpu_keys_region = {sizeof(uint32_t) * p1_gpu,
-                                                 sizeof(uint32_t) * p1_cpu};
-          cl_buffer_region p1_cpu_ids_region = {sizeof(uint32_t) * p1_gpu,
-                                                sizeof(uint32_t) * p1_cpu};
-          cl::Buffer p1_S_keys_gpu = S_keys_buf.createSubBuffer(
-              CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION,
-              &p1_gpu_keys_region);
-          cl::Buffer p1_S_keys_cpu = S_keys_buf.createSubBuffer(
-              CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION,
-              &p1_cpu_keys_region);
-          cl::Buffer p1_ids_gpu = S_bucket_ids_buf.createSubBuffer(
-              CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-              &p1_gpu_ids_region);
-          cl::Buffer p1_ids_cpu = S_bucket_ids_buf.createSubBuffer(
-              CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-              &p1_cpu_ids_region);
-
-          cl::Event p1_events[2];
-          p1_events[0] = p1(cl::EnqueueArgs(gpu_queue, cl::NDRange(p1_gpu)),
-                            p1_S_keys_gpu, p1_ids_gpu);
-          p1_events[1] = p1(cl::EnqueueArgs(cpu_queue, cl::NDRange(p1_cpu)),
-                            p1_S_keys_cpu, p1_ids_cpu);
-          cpu_queue.flush();
-          gpu_queue.flush();
-          cl_event p1_eh[2] = {p1_events[0](), p1_events[1]()};
-          clWaitForEvents(2, p1_eh);
-          size_t p3_cpu = S_LENGTH - p3_gpu;
-          size_t p4_cpu = S_LENGTH - p4_gpu;
-
-          // p3 with best split
-          cl_buffer_region p3_gpu_keys_region = {0, sizeof(uint32_t) * p3_gpu};
-          cl_buffer_region p3_gpu_ids_region = {0, sizeof(uint32_t) * p3_gpu};
-          cl_buffer_region p3_gpu_kidx_region = {0, sizeof(int) * p3_gpu};
-          cl_buffer_region p3_gpu_match_region = {0, sizeof(uint32_t) * p3_gpu};
-          cl_buffer_region p3_cpu_keys_region = {sizeof(uint32_t) * p3_gpu,
-                                                 sizeof(uint32_t) * p3_cpu};
-          cl_buffer_region p3_cpu_ids_region = {sizeof(uint32_t) * p3_gpu,
-                                                sizeof(uint32_t) * p3_cpu};
-          cl_buffer_region p3_cpu_kidx_region = {
-              sizeof(int) * (ptrdiff_t)p3_gpu, sizeof(int) * p3_cpu};
-          cl_buffer_region p3_cpu_match_region = {sizeof(uint32_t) * p3_gpu,
-                                                  sizeof(uint32_t) * p3_cpu};
-          cl::Buffer p3_S_keys_gpu = S_keys_buf.createSubBuffer(
-              CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION,
-              &p3_gpu_keys_region);
-          cl::Buffer p3_S_keys_cpu = S_keys_buf.createSubBuffer(
-              CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION,
-              &p3_cpu_keys_region);
-          cl::Buffer p3_ids_gpu = S_bucket_ids_buf.createSubBuffer(
-              CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-              &p3_gpu_ids_region);
-          cl::Buffer p3_ids_cpu = S_bucket_ids_buf.createSubBuffer(
-              CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-              &p3_cpu_ids_region);
-          cl::Buffer p3_kidx_gpu = S_key_indices_buf.createSubBuffer(
-              CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-              &p3_gpu_kidx_region);
-          cl::Buffer p3_kidx_cpu = S_key_indices_buf.createSubBuffer(
-              CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-              &p3_cpu_kidx_region);
-          cl::Buffer p3_match_gpu = S_match_found_buf.createSubBuffer(
-              CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-              &p3_gpu_match_region);
-          cl::Buffer p3_match_cpu = S_match_found_buf.createSubBuffer(
-              CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-              &p3_cpu_match_region);
-
-          cl::Event p3_final_events[2];
-          p3_final_events[0] =
-              p3(cl::EnqueueArgs(gpu_queue, cl::NDRange(p3_gpu)), p3_S_keys_gpu,
-                 p3_ids_gpu, bucket_keys_buf, p3_kidx_gpu, p3_match_gpu);
-          p3_final_events[1] =
-              p3(cl::EnqueueArgs(cpu_queue, cl::NDRange(p3_cpu)), p3_S_keys_cpu,
-                 p3_ids_cpu, bucket_keys_buf, p3_kidx_cpu, p3_match_cpu);
-          cpu_queue.flush();
-          gpu_queue.flush();
-          cl_event p3_final_eh[2] = {p3_final_events[0](),
-                                     p3_final_events[1]()};
-          clWaitForEvents(2, p3_final_eh);
-
-          // p4 with best split
-          // Create p4-specific buffers from p3 buffers (p4_gpu may differ from
-          // p3_gpu)
-          cl_buffer_region p4_gpu_keys_region = {0, sizeof(uint32_t) * p4_gpu};
-          cl_buffer_region p4_gpu_rids_region = {0, sizeof(uint32_t) * p4_gpu};
-          cl_buffer_region p4_gpu_kidx_region = {0, sizeof(int) * p4_gpu};
-          cl_buffer_region p4_gpu_match_region = {0, sizeof(uint32_t) * p4_gpu};
-          cl_buffer_region p4_gpu_ids_region = {0, sizeof(uint32_t) * p4_gpu};
-          cl_buffer_region p4_gpu_res_key_region = {
-              0, sizeof(uint32_t) * p4_gpu * MAX_RIDS_PER_KEY};
-          cl_buffer_region p4_gpu_res_rid_region = {
-              0, sizeof(uint32_t) * p4_gpu * MAX_RIDS_PER_KEY};
-          cl_buffer_region p4_gpu_res_sid_region = {
-              0, sizeof(uint32_t) * p4_gpu * MAX_RIDS_PER_KEY};
-          cl_buffer_region p4_gpu_res_cnt_region = {0,
-                                                    sizeof(uint32_t) * p4_gpu};
-          cl_buffer_region p4_cpu_keys_region = {sizeof(uint32_t) * p4_gpu,
-                                                 sizeof(uint32_t) * p4_cpu};
-          cl_buffer_region p4_cpu_rids_region = {sizeof(uint32_t) * p4_gpu,
-                                                 sizeof(uint32_t) * p4_cpu};
-          cl_buffer_region p4_cpu_kidx_region = {
-              sizeof(int) * (ptrdiff_t)p4_gpu, sizeof(int) * p4_cpu};
-          cl_buffer_region p4_cpu_match_region = {sizeof(uint32_t) * p4_gpu,
-                                                  sizeof(uint32_t) * p4_cpu};
-          cl_buffer_region p4_cpu_ids_region = {sizeof(uint32_t) * p4_gpu,
-                                                sizeof(uint32_t) * p4_cpu};
-          cl_buffer_region p4_cpu_res_key_region = {
-              sizeof(uint32_t) * p4_gpu * MAX_RIDS_PER_KEY,
-              sizeof(uint32_t) * p4_cpu * MAX_RIDS_PER_KEY};
-          cl_buffer_region p4_cpu_res_rid_region = {
-              sizeof(uint32_t) * p4_gpu * MAX_RIDS_PER_KEY,
-              sizeof(uint32_t) * p4_cpu * MAX_RIDS_PER_KEY};
-          cl_buffer_region p4_cpu_res_sid_region = {
-              sizeof(uint32_t) * p4_gpu * MAX_RIDS_PER_KEY,
-              sizeof(uint32_t) * p4_cpu * MAX_RIDS_PER_KEY};
-          cl_buffer_region p4_cpu_res_cnt_region = {sizeof(uint32_t) * p4_gpu,
-                                                    sizeof(uint32_t) * p4_cpu};
-
-          // Create p4 sub-buffers from p3 buffers (use first p4_gpu elements)
-          cl::Buffer p4_S_keys_gpu = S_keys_buf.createSubBuffer(
-              CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION,
-              &p4_gpu_keys_region);
-          cl::Buffer p4_S_keys_cpu = S_keys_buf.createSubBuffer(
-              CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION,
-              &p4_cpu_keys_region);
-          cl::Buffer p4_S_rids_gpu = S_rids_buf.createSubBuffer(
-              CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION,
-              &p4_gpu_rids_region);
-          cl::Buffer p4_S_rids_cpu = S_rids_buf.createSubBuffer(
-              CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION,
-              &p4_cpu_rids_region);
-          cl::Buffer p4_kidx_gpu = S_key_indices_buf.createSubBuffer(
-              CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION,
-              &p4_gpu_kidx_region);
-          cl::Buffer p4_kidx_cpu = S_key_indices_buf.createSubBuffer(
-              CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION,
-              &p4_cpu_kidx_region);
-          cl::Buffer p4_match_gpu = S_match_found_buf.createSubBuffer(
-              CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION,
-              &p4_gpu_match_region);
-          cl::Buffer p4_match_cpu = S_match_found_buf.createSubBuffer(
-              CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION,
-              &p4_cpu_match_region);
-          cl::Buffer p4_ids_gpu = S_bucket_ids_buf.createSubBuffer(
-              CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION,
-              &p4_gpu_ids_region);
-          cl::Buffer p4_ids_cpu = S_bucket_ids_buf.createSubBuffer(
-              CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION,
-              &p4_cpu_ids_region);
-          cl::Buffer p4_res_key_gpu = result_key_buf.createSubBuffer(
-              CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-              &p4_gpu_res_key_region);
-          cl::Buffer p4_res_rid_gpu = result_rid_buf.createSubBuffer(
-              CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-              &p4_gpu_res_rid_region);
-          cl::Buffer p4_res_sid_gpu = result_sid_buf.createSubBuffer(
-              CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-              &p4_gpu_res_sid_region);
-          cl::Buffer p4_res_cnt_gpu = result_count_buf.createSubBuffer(
-              CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-              &p4_gpu_res_cnt_region);
-          cl::Buffer p4_res_key_cpu = result_key_buf.createSubBuffer(
-              CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-              &p4_cpu_res_key_region);
-          cl::Buffer p4_res_rid_cpu = result_rid_buf.createSubBuffer(
-              CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-              &p4_cpu_res_rid_region);
-          cl::Buffer p4_res_sid_cpu = result_sid_buf.createSubBuffer(
-              CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-              &p4_cpu_res_sid_region);
-          cl::Buffer p4_res_cnt_cpu = result_count_buf.createSubBuffer(
-              CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION,
-              &p4_cpu_res_cnt_region);
-          cl::Event pe[2];
-          pe[0] = p4(cl::EnqueueArgs(gpu_queue, cl::NDRange(p4_gpu)),
-                     p4_S_keys_gpu, p4_S_rids_gpu, p4_kidx_gpu, p4_match_gpu,
-                     bucket_key_rids_buf, p4_ids_gpu, p4_res_key_gpu,
-                     p4_res_rid_gpu, p4_res_sid_gpu, p4_res_cnt_gpu);
-          pe[1] = p4(cl::EnqueueArgs(cpu_queue, cl::NDRange(p4_cpu)),
-                     p4_S_keys_cpu, p4_S_rids_cpu, p4_kidx_cpu, p4_match_cpu,
-                     bucket_key_rids_buf, p4_ids_cpu, p4_res_key_cpu,
-                     p4_res_rid_cpu, p4_res_sid_cpu, p4_res_cnt_cpu);
-          cpu_queue.flush();
-          gpu_queue.flush();
-          cl_event peh[2] = {pe[0](), pe[1]()};
-          clWaitForEvents(2, peh);
-          double probe_time = probe_timer.getTimeMilliseconds();
+          std::cout << "\nBest GPU ratio: p1 " << best_p1_gpu_ratio << "%, p3 "
+                    << best_p3_gpu_ratio << "%, p4 " << best_p4_gpu_ratio << "%"
+                    << std::endl;
+          p1_ratio = best_p1_gpu_ratio;
+          p3_ratio = best_p3_gpu_ratio;
+          p4_ratio = best_p4_gpu_ratio;
+          tune_cache.store(pl_key, {{"p1_ratio", p1_ratio},
+                                    {"p3_ratio", p3_ratio},
+                                    {"p4_ratio", p4_ratio}});
+          std::cout << "Stored in " << tune_cache.path() << std::endl;
+        }
+        if (!run_bench) {
+          // One chunk of S_LENGTH is the barrier split the tuner measured
+          size_t chunk =
+              pl_pipeline || run_feedback ? dd_chunk_size(dd_chunk) : S_LENGTH;
+          std::cout << "p1/p3/p4 GPU: " << p1_ratio << "/" << p3_ratio << "/"
+                    << p4_ratio << "%, " << chunk << " tuples per chunk"
+                    << std::endl;
+
+          JoinBuffers pl_bufs;
+          pl_bufs.bucket_keys = bucket_keys_buf;
+          pl_bufs.bucket_key_rids = bucket_key_rids_buf;
+          pl_bufs.S = S_buf;
+          pl_bufs.S_bucket_ids = S_bucket_ids_buf;
+          pl_bufs.S_key_indices = S_key_indices_buf;
+          pl_bufs.S_match_found = S_match_found_buf;
+          pl_bufs.result_rid = result_rid_buf;
+          pl_bufs.result_count = result_count_buf;
+          pl_bufs.table = table;
+          PLRatios ratios;
+          ratios.p1 = p1_ratio;
+          ratios.p3 = p3_ratio;
+          ratios.p4 = p4_ratio;
+          std::vector<HashVariant> pl_variants = {cpu_hash, gpu_hash};
+          for (size_t i = 2; i < chosen_device.size(); i++)
+            pl_variants.push_back(default_hash_variant(chosen_device[i]));
+          std::vector<cl::CommandQueue> &pl_queues = jc.queues();
+          // Every step is split, so the intermediates go where most of
+          // their work runs and are not migrated
+          StepShares pl_shares;
+          pl_shares.gpu[JOIN_P1] = p1_ratio;
+          pl_shares.gpu[JOIN_P3] = p3_ratio;
+          pl_shares.gpu[JOIN_P4] = p4_ratio;
+          JoinSteps pl_steps(
+              program, place_buffers(context, pl_queues, pl_bufs, pl_shares));
+          double probe_time = 0;
+          if (run_feedback) {
+            // p1, p3 and p4 each keep their own split
+            std::vector<FeedbackStage> stages = {
+                {"p1", 0, {}}, {"p3", 1, {}}, {"p4", 2, {}}};
+            for (size_t d = 0; d < pl_queues.size(); d++) {
+              stages[0].fns.push_back(pl_steps.p1(pl_variants[d]));
+              stages[1].fns.push_back(pl_steps.p3());
+              stages[2].fns.push_back(pl_steps.p4());
+            }
+            long min_share = feedback_min_share(chunk);
+            std::vector<SplitController> control = {
+                SplitController(p1_ratio, min_share),
+                SplitController(p3_ratio, min_share),
+                SplitController(p4_ratio, min_share)};
+            FeedbackResult fb = run_feedback_probe(pl_queues, stages, control,
+                                                   false, chunk);
+            probe_time = fb.ms;
+            print_feedback(fb, {"p1", "p3", "p4"});
+          } else {
+            StepGraph graph(pl_queues);
+            add_pl_plan(graph, pl_steps, ratios, pl_variants, chunk);
+            probe_time = graph.run();
+          }
           std::cout << "Probe time: " << probe_time << " ms" << std::endl;
           std::cout << "Build + Probe time: " << build_time + probe_time
                     << " ms" << std::endl;
@@ -2079,6 +1920,8 @@ int main(int argc, char *argv[]) {
 
   //===================== OpenCL Join End ==========================
 
+  memtrack::tracker().print(std::cout);
+
   // Verification: Compare CPU join with Standard join
   if (run_cpu_join && run_std_join) {
     std::cout << "\n=== Verification (CPU vs Standard) ===" << std::endl;
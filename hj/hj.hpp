@@ -1,6 +1,8 @@
 #pragma once
 
-#define CL_TARGET_OPENCL_VERSION 120
+// 2.0 for the SVM entry points (svm_join.hpp); cl.hpp is the 1.2 wrapper
+#define CL_TARGET_OPENCL_VERSION 200
+#define CL_USE_DEPRECATED_OPENCL_1_2_APIS
 #define __CL_ENABLE_EXCEPTIONS
 
 #include <CL/cl_platform.h>
@@ -9,20 +11,24 @@
 #include <sys/types.h>
 #include <vector>
 
-struct Tuple {
-  uint32_t key;
-  uint32_t rid;
+// Tuple of K keys and V rids. The kernels read the 32/32 Tuple in place as
+// uint2 (key in .x, rid in .y) and wider ones as a struct with this layout
+// (hj.cl, KEY_BITS/RID_BITS)
+template <typename K, typename V> struct BasicTuple {
+  K key;
+  V rid;
+};
 
-  friend std::ostream &operator<<(std::ostream &out, const Tuple &tuple);
+template <typename K, typename V> struct BasicJoinedTuple {
+  K key;
+  V ridR;
+  V ridS;
 };
 
-struct JoinedTuple {
-  uint32_t key;
-  uint32_t ridR;
-  uint32_t ridS;
+typedef BasicTuple<uint32_t, uint32_t> Tuple;
+typedef BasicJoinedTuple<uint32_t, uint32_t> JoinedTuple;
 
-  friend std::ostream &operator<<(std::ostream &out, const JoinedTuple &tuple);
-};
+static_assert(sizeof(Tuple) == 8, "a 32/32 tuple is a uint2");
 
 struct KeyHeader {
   uint32_t key{0};
@@ -34,12 +40,16 @@ struct BucketHeader {
   std::vector<KeyHeader> keyList;
 };
 
-inline std::ostream &operator<<(std::ostream &out, const Tuple &tuple) {
+template <typename K, typename V>
+inline std::ostream &operator<<(std::ostream &out,
+                                const BasicTuple<K, V> &tuple) {
   out << "Tuple{" << tuple.key << "," << tuple.rid << "}";
   return out;
 }
 
-inline std::ostream &operator<<(std::ostream &out, const JoinedTuple &tuple) {
+template <typename K, typename V>
+inline std::ostream &operator<<(std::ostream &out,
+                                const BasicJoinedTuple<K, V> &tuple) {
   out << "Joined{" << tuple.key << ", R:" << tuple.ridR << ", S:" << tuple.ridS
       << "}";
   return out;
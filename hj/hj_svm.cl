@@ -0,0 +1,61 @@
+#include "param.hpp"
+
+// Chained hash table in shared virtual memory (svm_join.hpp), OpenCL C 2.0.
+// Every R tuple gets one node; a bucket is the head of a singly linked list
+// of them. R, S, the nodes, the heads and the result arrays are SVM
+// allocations, so the pointers stored here are the host's pointers too.
+
+#pragma OPENCL EXTENSION cl_khr_int64_base_atomics : enable
+#pragma OPENCL EXTENSION cl_khr_int64_extended_atomics : enable
+
+// SvmNode in svm_join.hpp
+typedef struct svm_node {
+  uint key;
+  uint rid;
+  __global struct svm_node *next;
+} svm_node;
+
+// Same as hash_key in hj.cl
+uint hash_key(uint key, uint num_buckets) {
+  return mul_hi(key * HASH_SEED, num_buckets);
+}
+
+// Push node gid onto its bucket's list. The lists are only walked by later
+// kernels and the host, so next may be set after the exchange.
+__kernel void svm_build(__global const uint2 *R, uint n,
+                        __global svm_node *nodes,
+                        __global atomic_uintptr_t *heads, uint num_buckets) {
+  uint gid = get_global_id(0);
+  if (gid >= n) {
+    return;
+  }
+  uint2 tuple = R[gid];
+  __global svm_node *node = nodes + gid;
+  node->key = tuple.x;
+  node->rid = tuple.y;
+  uintptr_t next = atomic_exchange_explicit(
+      heads + hash_key(tuple.x, num_buckets), (uintptr_t)node,
+      memory_order_relaxed, memory_scope_device);
+  node->next = (__global svm_node *)next;
+}
+
+// Walk the bucket of S tuple gid and write up to MAX_RIDS_PER_KEY matching R
+// rids, in the p4 result layout (join_result.hpp)
+__kernel void svm_probe(__global const uint2 *S, uint n,
+                        __global svm_node *__global const *heads,
+                        __global uint *result_rid, __global uint *result_count,
+                        uint num_buckets) {
+  uint gid = get_global_id(0);
+  if (gid >= n) {
+    return;
+  }
+  uint key = S[gid].x;
+  uint count = 0;
+  for (__global const svm_node *node = heads[hash_key(key, num_buckets)];
+       node != 0 && count < MAX_RIDS_PER_KEY; node = node->next) {
+    if (node->key == key) {
+      result_rid[gid * MAX_RIDS_PER_KEY + count++] = node->rid;
+    }
+  }
+  result_count[gid] = count;
+}
@@ -0,0 +1,295 @@
+#pragma once
+
+#include "device_picker.hpp"
+#include "hj.hpp"
+#include "hugepage.hpp"
+#include "join_result.hpp"
+#include "morsel.hpp"
+#include "param.hpp"
+#include "table_size.hpp"
+#include "util.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Host-side join engine. The table has the same layout as the OpenCL one
+// (bucket_keys: num_buckets x MAX_KEYS_PER_BUCKET key slots,
+// bucket_key_rids: rids_per_key rid slots per key slot, 0xffffffff = empty),
+// so OpenCL devices can probe it in place via CL_MEM_USE_HOST_PTR.
+
+const uint32_t EMPTY_SLOT = 0xffffffffu;
+
+struct HostHashTable {
+  cl_uint num_buckets, rids_per_key;
+  huge_vector<uint32_t> bucket_keys;
+  huge_vector<uint32_t> bucket_key_rids;
+
+  explicit HostHashTable(const TableSize &size)
+      : num_buckets(size.buckets), rids_per_key(size.rids_per_key),
+        bucket_keys(size.key_slots(), EMPTY_SLOT),
+        bucket_key_rids(size.rid_slots(), EMPTY_SLOT) {}
+
+  uint32_t bucket_of(uint32_t key) const {
+    return ::bucket_of(key, num_buckets);
+  }
+
+  // b1-b4 for one tuple; slots are claimed with CAS so any number of threads
+  // may insert concurrently. Returns false if the rid list was already full.
+  bool insert(uint32_t key, uint32_t rid) {
+    uint32_t bucket_id = bucket_of(key);
+    for (uint32_t probe = 0; probe < num_buckets; probe++) {
+      uint32_t *slots = &bucket_keys[(size_t)bucket_id * MAX_KEYS_PER_BUCKET];
+      for (int i = 0; i < MAX_KEYS_PER_BUCKET; i++) {
+        uint32_t current = __atomic_load_n(&slots[i], __ATOMIC_ACQUIRE);
+        if (current == EMPTY_SLOT) {
+          uint32_t expected = EMPTY_SLOT;
+          current = __atomic_compare_exchange_n(&slots[i], &expected, key,
+                                                false, __ATOMIC_ACQ_REL,
+                                                __ATOMIC_ACQUIRE)
+                        ? key
+                        : expected;
+        }
+        if (current == key) {
+          return insert_rid((size_t)bucket_id * MAX_KEYS_PER_BUCKET + i, rid);
+        }
+      }
+      bucket_id = (bucket_id + 1) % num_buckets;
+    }
+    return false;
+  }
+
+  // p1-p3: key slot index (bucket * MAX_KEYS_PER_BUCKET + i) or -1
+  int64_t find(uint32_t key) const {
+    uint32_t bucket_id = bucket_of(key);
+    for (uint32_t probe = 0; probe < num_buckets; probe++) {
+      const uint32_t *slots =
+          &bucket_keys[(size_t)bucket_id * MAX_KEYS_PER_BUCKET];
+      for (int i = 0; i < MAX_KEYS_PER_BUCKET; i++) {
+        if (slots[i] == key)
+          return (int64_t)bucket_id * MAX_KEYS_PER_BUCKET + i;
+        // Slots fill in order, so an empty slot ends the probe sequence
+        if (slots[i] == EMPTY_SLOT)
+          return -1;
+      }
+      bucket_id = (bucket_id + 1) % num_buckets;
+    }
+    return -1;
+  }
+
+private:
+  bool insert_rid(size_t key_slot, uint32_t rid) {
+    uint32_t *rids = &bucket_key_rids[key_slot * rids_per_key];
+    for (cl_uint i = 0; i < rids_per_key; i++) {
+      uint32_t expected = EMPTY_SLOT;
+      if (__atomic_compare_exchange_n(&rids[i], &expected, rid, false,
+                                      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return true;
+    }
+    return false;
+  }
+};
+
+// Result layout shared with p4 (join_result.hpp): S tuple i owns rid slots
+// [i * MAX_RIDS_PER_KEY, (i + 1) * MAX_RIDS_PER_KEY) and count[i]
+struct SparseResult {
+  huge_vector<uint32_t> rid, count;
+
+  SparseResult()
+      : rid((size_t)S_LENGTH * MAX_RIDS_PER_KEY), count(S_LENGTH, 0) {}
+
+  std::vector<JoinedTuple> compact(const huge_vector<Tuple> &S) const {
+    return materialize_results(&S[0], &rid[0], &count[0], count.size());
+  }
+};
+
+// p4 for one S tuple at position pos
+inline void probe_tuple(const HostHashTable &table, const Tuple &s, size_t pos,
+                        SparseResult &res) {
+  int64_t slot = table.find(s.key);
+  if (slot < 0)
+    return;
+  const uint32_t *rids = &table.bucket_key_rids[slot * table.rids_per_key];
+  size_t base = pos * MAX_RIDS_PER_KEY;
+  uint32_t i;
+  for (i = 0; i < table.rids_per_key; i++) {
+    if (rids[i] == EMPTY_SLOT)
+      break;
+    res.rid[base + i] = rids[i];
+  }
+  res.count[pos] = i;
+}
+
+// Probes morsels of S on one OpenCL device against the host-built table.
+// All large buffers wrap host memory (S is read in place as Tuples), so
+// results land directly in the shared SparseResult and the kernels address it
+// with absolute (offset) global ids. Every worker has its own context; after
+// a morsel only that morsel's result slots are mapped back.
+class DeviceMorselWorker {
+public:
+  DeviceMorselWorker(const cl::Device &device, HostHashTable &table,
+                     const huge_vector<Tuple> &S, SparseResult &res)
+      : device_(device), context_(std::vector<cl::Device>(1, device)),
+        queue_(context_, device),
+        program_(build_join_program(context_, table.rids_per_key)),
+        p1_(program_, "p1"), p3_(program_, "p3"), p4_(program_, "p4"),
+        num_buckets_(table.num_buckets) {
+    cl_mem_flags ro = CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR;
+    cl_mem_flags rw = CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR;
+    size_t max_result_size = (size_t)S_LENGTH * MAX_RIDS_PER_KEY;
+    // READ_ONLY: the kernels never write through the host pointer
+    S_buf_ = cl::Buffer(context_, ro, sizeof(Tuple) * S_LENGTH,
+                        const_cast<Tuple *>(&S[0]));
+    bucket_keys_buf_ =
+        cl::Buffer(context_, ro, sizeof(uint32_t) * table.bucket_keys.size(),
+                   &table.bucket_keys[0]);
+    bucket_key_rids_buf_ = cl::Buffer(
+        context_, ro, sizeof(uint32_t) * table.bucket_key_rids.size(),
+        &table.bucket_key_rids[0]);
+    S_bucket_ids_buf_ =
+        cl::Buffer(context_, CL_MEM_READ_WRITE, sizeof(uint32_t) * S_LENGTH);
+    S_key_indices_buf_ =
+        cl::Buffer(context_, CL_MEM_READ_WRITE, sizeof(int) * S_LENGTH);
+    S_match_found_buf_ =
+        cl::Buffer(context_, CL_MEM_READ_WRITE, sizeof(uint32_t) * S_LENGTH);
+    result_rid_buf_ = cl::Buffer(
+        context_, rw, sizeof(uint32_t) * max_result_size, &res.rid[0]);
+    result_count_buf_ = cl::Buffer(context_, rw, sizeof(uint32_t) * S_LENGTH,
+                                   &res.count[0]);
+  }
+
+  std::string name() const { return device_.getInfo<CL_DEVICE_NAME>(); }
+
+  void probe(const Morsel &m) {
+    cl::NDRange offset(m.begin), global(m.size());
+    p1_(cl::EnqueueArgs(queue_, offset, global, cl::NullRange), S_buf_,
+        S_bucket_ids_buf_, num_buckets_);
+    p3_(cl::EnqueueArgs(queue_, offset, global, cl::NullRange), S_buf_,
+        S_bucket_ids_buf_, bucket_keys_buf_, S_key_indices_buf_,
+        S_match_found_buf_, num_buckets_);
+    p4_(cl::EnqueueArgs(queue_, offset, global, cl::NullRange),
+        S_key_indices_buf_, S_match_found_buf_, bucket_key_rids_buf_,
+        S_bucket_ids_buf_, result_rid_buf_, result_count_buf_);
+    sync_results(m);
+  }
+
+private:
+  // Make the device writes of morsel m visible in the host arrays (no-op
+  // copy on CPU devices, write-back on discrete ones). Only m's slots: the
+  // rest of the device's image is stale, since other workers filled it.
+  void sync_results(const Morsel &m) {
+    size_t word = sizeof(uint32_t);
+    map_range(result_rid_buf_, word * MAX_RIDS_PER_KEY * m.begin,
+              word * MAX_RIDS_PER_KEY * m.size());
+    map_range(result_count_buf_, word * m.begin, word * m.size());
+  }
+
+  void map_range(const cl::Buffer &buf, size_t offset, size_t bytes) {
+    void *p =
+        queue_.enqueueMapBuffer(buf, CL_TRUE, CL_MAP_READ, offset, bytes);
+    queue_.enqueueUnmapMemObject(buf, p);
+    queue_.finish();
+  }
+
+  cl::Device device_;
+  cl::Context context_;
+  cl::CommandQueue queue_;
+  cl::Program program_;
+  cl::make_kernel<cl::Buffer, cl::Buffer, cl_uint> p1_;
+  cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer,
+                  cl_uint>
+      p3_;
+  cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer,
+                  cl::Buffer>
+      p4_;
+  cl_uint num_buckets_;
+  cl::Buffer S_buf_, bucket_keys_buf_, bucket_key_rids_buf_;
+  cl::Buffer S_bucket_ids_buf_, S_key_indices_buf_, S_match_found_buf_;
+  cl::Buffer result_rid_buf_, result_count_buf_;
+};
+
+struct MorselJoinConfig {
+  unsigned threads{1};
+  size_t morsel_size{65536};
+  bool use_devices{false};
+  TableSize table; // sized from R by main
+};
+
+// Insert R into table on cfg.threads host threads; returns dropped rids
+inline size_t build_host_table(const huge_vector<Tuple> &R,
+                               const MorselJoinConfig &cfg,
+                               HostHashTable &table) {
+  MorselScheduler build_sched(cfg.threads);
+  build_sched.reset(R.size(), cfg.morsel_size);
+  std::atomic<size_t> dropped(0);
+  build_sched.run([&](unsigned, const Morsel &m) {
+    size_t local_dropped = 0;
+    for (size_t i = m.begin; i < m.end; i++) {
+      if (!table.insert(R[i].key, R[i].rid))
+        local_dropped++;
+    }
+    if (local_dropped)
+      dropped += local_dropped;
+  });
+  return dropped;
+}
+
+// Build R and probe S with morsel-driven work stealing. Build morsels run on
+// host threads only (devices cannot take part in the CAS-based insert); probe
+// morsels are shared by host threads and, optionally, every OpenCL device.
+inline std::vector<JoinedTuple>
+run_morsel_join(const huge_vector<Tuple> &R, const huge_vector<Tuple> &S,
+                const MorselJoinConfig &cfg) {
+  util::Timer timer;
+  HostHashTable table(cfg.table);
+  SparseResult res;
+
+  timer.reset();
+  size_t dropped = build_host_table(R, cfg, table);
+  double build_time = timer.getTimeMilliseconds();
+  std::cout << "Build: " << build_time << " ms (" << cfg.threads
+            << " threads)" << std::endl;
+  if (dropped > 0)
+    std::cout << "Warning: " << dropped
+              << " rids dropped (rid slots per key exceeded)" << std::endl;
+
+  // Host threads and devices both read the Tuple vector directly
+  std::vector<std::unique_ptr<DeviceMorselWorker>> device_workers;
+  if (cfg.use_devices) {
+    std::vector<cl::Device> devices;
+    getDeviceList(devices);
+    for (auto &d : devices)
+      device_workers.emplace_back(new DeviceMorselWorker(d, table, S, res));
+  }
+
+  timer.reset();
+  unsigned num_workers = cfg.threads + (unsigned)device_workers.size();
+  MorselScheduler probe_sched(num_workers);
+  probe_sched.reset(S.size(), cfg.morsel_size);
+  probe_sched.run([&](unsigned w, const Morsel &m) {
+    if (w >= cfg.threads) {
+      device_workers[w - cfg.threads]->probe(m);
+      return;
+    }
+    for (size_t i = m.begin; i < m.end; i++)
+      probe_tuple(table, S[i], i, res);
+  });
+  double probe_time = timer.getTimeMilliseconds();
+  std::cout << "Probe: " << probe_time << " ms" << std::endl;
+
+  for (unsigned w = 0; w < num_workers; w++) {
+    const WorkerStats &st = probe_sched.stats()[w];
+    std::string who = w < cfg.threads
+                          ? "thread " + std::to_string(w)
+                          : device_workers[w - cfg.threads]->name();
+    std::cout << "  " << who << ": " << st.morsels << " morsels, "
+              << st.tuples << " tuples, " << st.stolen << " stolen"
+              << std::endl;
+  }
+  std::cout << "Morsel Join Total: " << build_time + probe_time << " ms"
+            << std::endl;
+  return res.compact(S);
+}
@@ -0,0 +1,198 @@
+#pragma once
+
+#include "mem_tracker.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <sys/mman.h>
+#include <unordered_map>
+#include <vector>
+
+// Huge-page backed storage for the large host-side arrays (R/S columns and
+// the hash table). Random probes into a 4KB-paged table miss the dTLB on
+// almost every access; 2MB pages cut the number of translations by 512x.
+//
+// Allocation order: explicit hugetlbfs pages (MAP_HUGETLB), then transparent
+// huge pages (madvise(MADV_HUGEPAGE)), then plain pages. Blocks under 2MB
+// are not worth a mapping and come from aligned_alloc. Every block is page
+// aligned so it can be wrapped with CL_MEM_USE_HOST_PTR.
+namespace hugepage {
+
+const size_t HUGE_PAGE_SIZE = 2u << 20;
+const size_t SMALL_PAGE_SIZE = 4096;
+
+// Live bytes of the mapped blocks by the pages they got
+struct Stats {
+  size_t hugetlb_bytes{0};  // MAP_HUGETLB succeeded
+  size_t thp_bytes{0};      // madvise(MADV_HUGEPAGE) on normal mapping
+  size_t regular_bytes{0};  // huge pages disabled or madvise refused
+};
+
+inline bool &enabled() {
+  static bool on = true;
+  return on;
+}
+
+inline size_t round_up(size_t bytes, size_t page = HUGE_PAGE_SIZE) {
+  return (bytes + page - 1) / page * page;
+}
+
+// aligned_alloc length of a block under 2MB: whole 4KB pages, at least one
+inline size_t small_len(size_t bytes) {
+  return round_up(bytes ? bytes : 1, SMALL_PAGE_SIZE);
+}
+
+// The Stats field of every mapped block, so deallocate takes its bytes back
+// from the one allocate added them to
+class Blocks {
+public:
+  void add(void *p, size_t Stats::*field, size_t len) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    fields_[p] = field;
+    stats_.*field += len;
+  }
+
+  void sub(void *p, size_t len) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = fields_.find(p);
+    if (it == fields_.end())
+      return;
+    stats_.*(it->second) -= len;
+    fields_.erase(it);
+  }
+
+  Stats stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+
+private:
+  mutable std::mutex mutex_;
+  std::unordered_map<void *, size_t Stats::*> fields_;
+  Stats stats_;
+};
+
+inline Blocks &blocks() {
+  static Blocks b;
+  return b;
+}
+
+inline Stats stats() { return blocks().stats(); }
+
+inline void *allocate(size_t bytes) {
+  if (bytes < HUGE_PAGE_SIZE) {
+    size_t len = small_len(bytes);
+    void *p = aligned_alloc(SMALL_PAGE_SIZE, len);
+    if (p == nullptr) {
+      throw std::bad_alloc();
+    }
+    memtrack::tracker().add("small host arrays", memtrack::HOST, len);
+    return p;
+  }
+  size_t len = round_up(bytes);
+  memtrack::tracker().add("huge-page arrays", memtrack::HOST, len);
+  void *p = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+  if (enabled()) {
+    p = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+      blocks().add(p, &Stats::hugetlb_bytes, len);
+      return p;
+    }
+  }
+#endif
+
+  p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+           -1, 0);
+  if (p == MAP_FAILED) {
+    memtrack::tracker().sub("huge-page arrays", len);
+    throw std::bad_alloc();
+  }
+#ifdef MADV_HUGEPAGE
+  if (enabled() && madvise(p, len, MADV_HUGEPAGE) == 0) {
+    blocks().add(p, &Stats::thp_bytes, len);
+    return p;
+  }
+#endif
+#ifdef MADV_NOHUGEPAGE
+  // Keep the disabled case a true 4KB baseline even with THP=always
+  if (!enabled()) {
+    madvise(p, len, MADV_NOHUGEPAGE);
+  }
+#endif
+  blocks().add(p, &Stats::regular_bytes, len);
+  return p;
+}
+
+inline void deallocate(void *p, size_t bytes) {
+  if (p == nullptr) {
+    return;
+  }
+  if (bytes < HUGE_PAGE_SIZE) {
+    free(p);
+    memtrack::tracker().sub("small host arrays", small_len(bytes));
+    return;
+  }
+  munmap(p, round_up(bytes));
+  blocks().sub(p, round_up(bytes));
+  memtrack::tracker().sub("huge-page arrays", round_up(bytes));
+}
+
+// AnonHugePages of this process in KB (THP actually granted by the kernel)
+inline size_t anon_huge_kb() {
+  FILE *f = fopen("/proc/self/smaps_rollup", "r");
+  if (f == nullptr) {
+    return 0;
+  }
+  char line[256];
+  size_t kb = 0;
+  while (fgets(line, sizeof(line), f)) {
+    if (strncmp(line, "AnonHugePages:", 14) == 0) {
+      sscanf(line + 14, "%zu", &kb);
+      break;
+    }
+  }
+  fclose(f);
+  return kb;
+}
+
+inline void print_stats(std::ostream &out) {
+  Stats s = stats();
+  out << "Huge pages " << (enabled() ? "enabled" : "disabled")
+      << ": hugetlb " << (s.hugetlb_bytes >> 20) << " MB, THP advised "
+      << (s.thp_bytes >> 20) << " MB, 4KB " << (s.regular_bytes >> 20)
+      << " MB, AnonHugePages " << (anon_huge_kb() >> 10) << " MB"
+      << std::endl;
+}
+
+} // namespace hugepage
+
+template <typename T> struct HugePageAllocator {
+  typedef T value_type;
+
+  HugePageAllocator() = default;
+  template <typename U> HugePageAllocator(const HugePageAllocator<U> &) {}
+
+  T *allocate(size_t n) {
+    return static_cast<T *>(hugepage::allocate(n * sizeof(T)));
+  }
+  void deallocate(T *p, size_t n) { hugepage::deallocate(p, n * sizeof(T)); }
+
+  template <typename U> bool operator==(const HugePageAllocator<U> &) const {
+    return true;
+  }
+  template <typename U> bool operator!=(const HugePageAllocator<U> &) const {
+    return false;
+  }
+};
+
+template <typename T>
+using huge_vector = std::vector<T, HugePageAllocator<T>>;
@@ -0,0 +1,177 @@
+#pragma once
+
+#include "cl.hpp"
+#include "hugepage.hpp"
+#include "mem_tracker.hpp"
+#include "table_size.hpp"
+#include "util.hpp"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Context, queues, program and buffers of one DD/OL/PL run. Buffers are
+// pooled by name: the first call creates one, later calls return the same
+// buffer, so repeated runs (bench loops, the search, calibration) set up
+// nothing. Buffers created with a reset pattern are brought back to it by
+// reset() with enqueueFillBuffer, which replaces the host staging vectors
+// that used to be copied in. Sub-buffer views are cached the same way.
+
+class JoinContext {
+public:
+  // hj.cl is built for the rid slots per key of `table`
+  JoinContext(const std::vector<cl::Device> &devices, const TableSize &table)
+      : context_(devices) {
+    for (const cl::Device &device : devices) {
+      queues_.push_back(
+          cl::CommandQueue(context_, device, CL_QUEUE_PROFILING_ENABLE));
+    }
+    program_ = build_join_program(context_, table.rids_per_key);
+  }
+
+  cl::Context &context() { return context_; }
+  cl::Program &program() { return program_; }
+  // One queue per device, in device order
+  std::vector<cl::CommandQueue> &queues() { return queues_; }
+  cl::CommandQueue &queue(size_t i) { return queues_[i]; }
+
+  // A name asked for again must come with the same flags and size (and
+  // reset pattern); anything else throws rather than hand back a buffer of
+  // another shape.
+  cl::Buffer &buffer(const std::string &name, cl_mem_flags flags,
+                     size_t bytes) {
+    Entry &e = pool_[name];
+    if (e.buf() == NULL)
+      e.buf = create(name, flags, bytes);
+    else
+      check(e, flags, bytes, false, 0);
+    return e.buf;
+  }
+
+  // Pooled buffer that reset() fills with `pattern`
+  cl::Buffer &buffer(const std::string &name, cl_mem_flags flags,
+                     size_t bytes, cl_uint pattern) {
+    Entry &e = pool_[name];
+    if (e.buf() == NULL) {
+      e.buf = create(name, flags, bytes);
+      e.resets = true;
+      e.pattern = pattern;
+    } else {
+      check(e, flags, bytes, true, pattern);
+    }
+    return e.buf;
+  }
+
+  // Pooled hash table array in huge-page backed host memory (USE_HOST_PTR),
+  // owned by the context; reset() fills it with `pattern`
+  cl::Buffer &host_table(const std::string &name, size_t bytes,
+                         cl_uint pattern) {
+    const cl_mem_flags flags = CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR;
+    Entry &e = pool_[name];
+    if (e.buf() == NULL) {
+      e.host.resize(bytes / sizeof(uint32_t));
+      e.buf = cl::Buffer(context_, flags, bytes, &e.host[0]);
+      e.resets = true;
+      e.pattern = pattern;
+    } else {
+      check(e, flags, bytes, true, pattern);
+    }
+    return e.buf;
+  }
+
+  // Pooled buffer `name` with `flags` that stands in for `src`, at its size.
+  // It resets like `src` when that is pooled with a reset pattern, and a new
+  // one starts from that pattern, as `src` is after reset().
+  cl::Buffer &placed(const std::string &name, const cl::Buffer &src,
+                     cl_mem_flags flags) {
+    Entry &e = pool_[name];
+    if (e.buf() == NULL) {
+      size_t bytes = src.getInfo<CL_MEM_SIZE>();
+      e.buf = create(name, flags, bytes);
+      for (const auto &kv : pool_) {
+        if (kv.second.buf() == src() && kv.second.resets) {
+          e.resets = true;
+          e.pattern = kv.second.pattern;
+        }
+      }
+      if (e.resets) {
+        queues_[0].enqueueFillBuffer(e.buf, e.pattern, 0, bytes);
+        queues_[0].finish();
+      }
+    } else {
+      check(e, flags, src.getInfo<CL_MEM_SIZE>(), e.resets, e.pattern);
+    }
+    return e.buf;
+  }
+
+  // Cached sub-buffer [origin, origin + bytes) of the pooled buffer `name`
+  cl::Buffer &view(const std::string &name, size_t origin, size_t bytes,
+                   cl_mem_flags flags = CL_MEM_READ_WRITE) {
+    std::string key =
+        name + "@" + std::to_string(origin) + "+" + std::to_string(bytes);
+    Entry &e = pool_[key];
+    if (e.buf() == NULL) {
+      cl_buffer_region region = {origin, bytes};
+      e.buf = pool_.at(name).buf.createSubBuffer(
+          flags, CL_BUFFER_CREATE_TYPE_REGION, &region);
+    }
+    return e.buf;
+  }
+
+  // Fill every buffer created with a reset pattern, on queue `q`
+  void reset(size_t q = 0) {
+    cl::CommandQueue &queue = queues_[q];
+    for (auto &kv : pool_) {
+      if (kv.second.resets) {
+        queue.enqueueFillBuffer(kv.second.buf, kv.second.pattern, 0,
+                                kv.second.buf.getInfo<CL_MEM_SIZE>());
+      }
+    }
+    queue.finish();
+  }
+
+  // Bytes of all pooled buffers (views excluded)
+  size_t pooled_bytes() const {
+    size_t bytes = 0;
+    for (const auto &kv : pool_) {
+      if (kv.first.find('@') == std::string::npos)
+        bytes += kv.second.buf.getInfo<CL_MEM_SIZE>();
+    }
+    return bytes;
+  }
+
+private:
+  // Runtime-allocated buffers count as OpenCL memory; a USE_HOST_PTR one is
+  // a host array that is already counted
+  cl::Buffer create(const std::string &name, cl_mem_flags flags,
+                    size_t bytes) {
+    if (!(flags & CL_MEM_USE_HOST_PTR))
+      memtrack::tracker().add(name, memtrack::OPENCL, bytes);
+    return cl::Buffer(context_, flags, bytes);
+  }
+
+  struct Entry {
+    cl::Buffer buf;
+    bool resets{false};
+    cl_uint pattern{0};
+    huge_vector<uint32_t> host;
+  };
+
+  // `e` was created with exactly this shape
+  void check(const Entry &e, cl_mem_flags flags, size_t bytes, bool resets,
+             cl_uint pattern) const {
+    if (e.buf.getInfo<CL_MEM_FLAGS>() != flags ||
+        e.buf.getInfo<CL_MEM_SIZE>() != bytes || e.resets != resets ||
+        (resets && e.pattern != pattern)) {
+      throw cl::Error(CL_INVALID_VALUE,
+                      "JoinContext: pooled buffer asked for with another "
+                      "size, flags or reset pattern");
+    }
+  }
+
+  cl::Context context_;
+  std::vector<cl::CommandQueue> queues_;
+  cl::Program program_;
+  std::map<std::string, Entry> pool_;
+};
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "cl.hpp"
+#include "hj.hpp"
+#include "mapped_view.hpp"
+#include "mem_tracker.hpp"
+#include "param.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Late-materialized join result. p4 and probe write only the R rid of every
+// match: S tuple i owns slots [i * MAX_RIDS_PER_KEY, (i + 1) *
+// MAX_RIDS_PER_KEY) of result_rid and result_count[i] of them are used. The
+// S position is the slot index, so the key and S rid are read back from S
+// when a consumer asks for JoinedTuples; the devices write one 4-byte array
+// per match instead of three copies of key, R rid and S rid.
+
+inline size_t count_results(const uint32_t *counts, size_t n) {
+  size_t total = 0;
+  for (size_t i = 0; i < n; i++)
+    total += counts[i];
+  return total;
+}
+
+// JoinedTuples of the matches of S[0, n), in S order
+template <typename K, typename V>
+inline std::vector<BasicJoinedTuple<K, V>>
+materialize_results(const BasicTuple<K, V> *S, const V *rids,
+                    const uint32_t *counts, size_t n) {
+  std::vector<BasicJoinedTuple<K, V>> out;
+  out.reserve(count_results(counts, n));
+  for (size_t i = 0; i < n; i++) {
+    const V *slots = rids + i * MAX_RIDS_PER_KEY;
+    for (uint32_t j = 0; j < counts[i]; j++) {
+      BasicJoinedTuple<K, V> jt;
+      jt.key = S[i].key;
+      jt.ridR = slots[j];
+      jt.ridS = S[i].rid;
+      out.push_back(jt);
+    }
+  }
+  return out;
+}
+
+static_assert(sizeof(JoinedTuple) == 3 * sizeof(uint32_t),
+              "compact_scatter writes three words per JoinedTuple");
+
+class ResultCompactor {
+public:
+  ResultCompactor(const cl::Context &context, const cl::Program &program,
+                  size_t n)
+      : context_(context), count_(program, "compact_count"),
+        scatter_(program, "compact_scatter"),
+        blocks_((n + ROUTE_BLOCK - 1) / ROUTE_BLOCK),
+        counts_(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * blocks_),
+        offsets_(context, CL_MEM_READ_ONLY, sizeof(cl_uint) * blocks_) {}
+
+  // Matches of S[0, n): sums result_count on the device and reads back one
+  // word per block
+  size_t count(cl::CommandQueue &queue, const cl::Buffer &result_count,
+               size_t n) {
+    count_blocks(queue, result_count, n);
+    return scan();
+  }
+
+  // JoinedTuples of the matches of S[0, n) (S as Tuples). The dense output
+  // is allocated in host memory on a device that shares it, so the view
+  // maps it in place; a discrete device's output is copied once.
+  MappedView<JoinedTuple> compact(cl::CommandQueue &queue, const cl::Buffer &S,
+                                  const cl::Buffer &result_rid,
+                                  const cl::Buffer &result_count, size_t n) {
+    count_blocks(queue, result_count, n);
+    size_t total = scan();
+    if (total == 0)
+      return MappedView<JoinedTuple>();
+    queue.enqueueWriteBuffer(offsets_, CL_TRUE, 0, sizeof(cl_uint) * blocks_,
+                             &counts_host_[0]);
+    cl::Device device = queue.getInfo<CL_QUEUE_DEVICE>();
+    cl_mem_flags flags = CL_MEM_WRITE_ONLY;
+    if (shares_host_memory(device))
+      flags |= CL_MEM_ALLOC_HOST_PTR;
+    cl::Buffer dense(context_, flags, sizeof(JoinedTuple) * total);
+    memtrack::tracker().sub("dense results", dense_bytes_);
+    dense_bytes_ = sizeof(JoinedTuple) * total;
+    memtrack::tracker().add("dense results", memtrack::OPENCL, dense_bytes_);
+    scatter_(args(queue), S, result_rid, result_count, (cl_uint)n, offsets_,
+             dense);
+    return MappedView<JoinedTuple>(queue, dense, total);
+  }
+
+private:
+  cl::EnqueueArgs args(cl::CommandQueue &queue) {
+    cl::Device device = queue.getInfo<CL_QUEUE_DEVICE>();
+    size_t group = std::min<size_t>(
+        256, device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>());
+    return cl::EnqueueArgs(queue, cl::NDRange(blocks_ * group),
+                           cl::NDRange(group));
+  }
+
+  void count_blocks(cl::CommandQueue &queue, const cl::Buffer &result_count,
+                    size_t n) {
+    count_(args(queue), result_count, (cl_uint)n, counts_);
+    counts_host_.resize(blocks_);
+    queue.enqueueReadBuffer(counts_, CL_TRUE, 0, sizeof(cl_uint) * blocks_,
+                            &counts_host_[0]);
+  }
+
+  // Block sums -> exclusive offsets; returns the total
+  size_t scan() {
+    size_t total = 0;
+    for (cl_uint &c : counts_host_) {
+      cl_uint block = c;
+      c = (cl_uint)total;
+      total += block;
+    }
+    return total;
+  }
+
+  cl::Context context_;
+  cl::make_kernel<cl::Buffer, cl_uint, cl::Buffer> count_;
+  cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl_uint, cl::Buffer,
+                  cl::Buffer>
+      scatter_;
+  size_t blocks_;
+  cl::Buffer counts_, offsets_;
+  std::vector<cl_uint> counts_host_;
+  size_t dense_bytes_{0}; // latest output, as counted by memtrack
+};
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "cl.hpp"
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Read access to device output without a copy where the memory is the
+// host's. A buffer on a device that shares memory with the host (a CPU, an
+// integrated GPU) is mapped (enqueueMapBuffer) and unmapped when the view
+// goes away; on a discrete device the contents are read into a vector the
+// view owns. Either way the consumer iterates a plain T array.
+
+// A CPU or a GPU with host-unified memory
+inline bool shares_host_memory(const cl::Device &device) {
+  return (device.getInfo<CL_DEVICE_TYPE>() & CL_DEVICE_TYPE_CPU) ||
+         device.getInfo<CL_DEVICE_HOST_UNIFIED_MEMORY>();
+}
+
+template <typename T> class MappedView {
+public:
+  MappedView() {}
+
+  // The first `count` Ts of `buf`, once the commands before it on `queue`
+  // are done
+  MappedView(cl::CommandQueue &queue, const cl::Buffer &buf, size_t count)
+      : queue_(queue), buf_(buf), size_(count) {
+    if (count == 0)
+      return;
+    size_t bytes = sizeof(T) * count;
+    if (shares_host_memory(queue.getInfo<CL_QUEUE_DEVICE>())) {
+      data_ = (T *)queue.enqueueMapBuffer(buf, CL_TRUE, CL_MAP_READ, 0, bytes);
+      mapped_ = true;
+    } else {
+      copy_.resize(count);
+      queue.enqueueReadBuffer(buf, CL_TRUE, 0, bytes, &copy_[0]);
+      data_ = &copy_[0];
+    }
+  }
+
+  MappedView(const MappedView &) = delete;
+  MappedView &operator=(const MappedView &) = delete;
+
+  MappedView(MappedView &&other) { swap(other); }
+  MappedView &operator=(MappedView &&other) {
+    MappedView(std::move(other)).swap(*this);
+    return *this;
+  }
+
+  ~MappedView() {
+    if (mapped_)
+      queue_.enqueueUnmapMemObject(buf_, data_);
+  }
+
+  const T *data() const { return data_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  // True if the view is the buffer itself rather than a copy
+  bool mapped() const { return mapped_; }
+
+  const T *begin() const { return data_; }
+  const T *end() const { return data_ + size_; }
+  const T &operator[](size_t i) const { return data_[i]; }
+
+private:
+  void swap(MappedView &other) {
+    std::swap(queue_, other.queue_);
+    std::swap(buf_, other.buf_);
+    std::swap(data_, other.data_);
+    std::swap(size_, other.size_);
+    std::swap(mapped_, other.mapped_);
+    copy_.swap(other.copy_); // keeps a copy's data_ valid
+  }
+
+  cl::CommandQueue queue_;
+  cl::Buffer buf_;
+  T *data_{nullptr};
+  size_t size_{0};
+  bool mapped_{false};
+  std::vector<T> copy_;
+};
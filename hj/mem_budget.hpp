@@ -0,0 +1,170 @@
+#pragma once
+
+#include "buffer_tracking.hpp"
+#include "cl.hpp"
+#include "hj.hpp"
+#include "hugepage.hpp"
+#include "join_result.hpp"
+#include "mem_tracker.hpp"
+#include "param.hpp"
+#include "table_size.hpp"
+#include "util.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// --mem-budget: the single-device join with the most memory that fits.
+//   staged   b1..p4 with every intermediate and the full sparse result
+//   fused    build/probe kernels only: no bucket ids, key indices or match
+//            flags
+//   chunked  fused, with S probed and compacted one chunk at a time, so the
+//            sparse result is chunk-sized
+// The budget covers the working set: R and S, the table, the intermediates
+// and the sparse result. The dense output belongs to the caller and is not
+// counted. When even the smallest chunk does not fit (R, S and the table
+// alone are over), the join runs chunked anyway and says so; there is no
+// partitioned or spilling plan.
+
+const size_t MIN_PLAN_CHUNK = 65536;
+
+enum JoinPlanKind { PLAN_STAGED, PLAN_FUSED, PLAN_CHUNKED };
+
+struct JoinPlan {
+  JoinPlanKind kind{PLAN_STAGED};
+  size_t chunk{S_LENGTH}; // S tuples per probe
+  size_t bytes{0};
+  bool fits{true};
+};
+
+// Sparse result for `n` S tuples: MAX_RIDS_PER_KEY rids and a count each
+inline size_t sparse_result_bytes(size_t n) {
+  return sizeof(uint32_t) * n * (MAX_RIDS_PER_KEY + 1);
+}
+
+inline size_t plan_bytes(JoinPlanKind kind, const TableSize &t,
+                         size_t chunk) {
+  size_t bytes = sizeof(Tuple) * ((size_t)R_LENGTH + S_LENGTH) + t.bytes();
+  if (kind == PLAN_STAGED) {
+    // bucket ids and key indices of R; bucket ids, key indices, flags of S
+    return bytes + sizeof(uint32_t) * (2 * (size_t)R_LENGTH + 3 * S_LENGTH) +
+           sparse_result_bytes(S_LENGTH);
+  }
+  // no bucket_total without b2/p2
+  return bytes - sizeof(uint32_t) * t.buckets + sparse_result_bytes(chunk);
+}
+
+inline JoinPlan choose_plan(size_t budget, const TableSize &t) {
+  JoinPlan plan;
+  for (JoinPlanKind kind : {PLAN_STAGED, PLAN_FUSED}) {
+    plan.kind = kind;
+    plan.bytes = plan_bytes(kind, t, S_LENGTH);
+    if (plan.bytes <= budget)
+      return plan;
+  }
+  // Largest power-of-two chunk that fits
+  plan.kind = PLAN_CHUNKED;
+  plan.chunk = S_LENGTH;
+  while (plan.chunk > MIN_PLAN_CHUNK &&
+         plan_bytes(PLAN_CHUNKED, t, plan.chunk) > budget)
+    plan.chunk /= 2;
+  plan.bytes = plan_bytes(PLAN_CHUNKED, t, plan.chunk);
+  plan.fits = plan.bytes <= budget;
+  return plan;
+}
+
+inline std::string to_string(const JoinPlan &plan) {
+  switch (plan.kind) {
+  case PLAN_FUSED:
+    return "fused";
+  case PLAN_CHUNKED:
+    return "chunked (" + std::to_string(plan.chunk) + " S tuples)";
+  default:
+    return "staged";
+  }
+}
+
+inline void print_plan(const JoinPlan &plan, size_t budget) {
+  std::cout << "Memory budget " << (budget >> 20) << " MB: " << to_string(plan)
+            << " plan, " << (plan.bytes >> 20) << " MB working set"
+            << std::endl;
+  if (!plan.fits)
+    std::cout << "Warning: no plan fits the budget; running the smallest"
+              << std::endl;
+}
+
+// Fused or chunked plan on one device: fused build, then S in plan.chunk
+// pieces, each probed into a chunk-sized sparse result and compacted.
+// Chunks are S sub-buffers, so the kernels see positions from 0.
+inline std::vector<JoinedTuple>
+run_planned_join(const cl::Context &context, cl::CommandQueue &queue,
+                 const cl::Program &program, huge_vector<Tuple> &R,
+                 huge_vector<Tuple> &S, const TableSize &table,
+                 const JoinPlan &plan) {
+  cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl_uint> build(
+      program, "build");
+  cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer,
+                  cl_uint>
+      probe(program, "probe");
+  size_t chunk = std::min<size_t>(plan.chunk, S.size());
+
+  cl::Buffer R_buf(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
+                   sizeof(Tuple) * R.size(), &R[0]);
+  cl::Buffer S_buf(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
+                   sizeof(Tuple) * S.size(), &S[0]);
+  huge_vector<uint32_t> bucket_keys(table.key_slots(), 0xffffffffu);
+  huge_vector<uint32_t> bucket_key_rids(table.rid_slots(), 0xffffffffu);
+  cl::Buffer bucket_keys_buf(context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR,
+                             sizeof(uint32_t) * table.key_slots(),
+                             &bucket_keys[0]);
+  cl::Buffer bucket_key_rids_buf(
+      context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR,
+      sizeof(uint32_t) * table.rid_slots(), &bucket_key_rids[0]);
+  cl::Buffer result_rid_buf(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                            sizeof(uint32_t) * chunk * MAX_RIDS_PER_KEY);
+  cl::Buffer result_count_buf(context,
+                              CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                              sizeof(uint32_t) * chunk);
+  track_buffer("result_rid", result_rid_buf);
+  track_buffer("result_count", result_count_buf);
+  ResultCompactor compactor(context, program, chunk);
+
+  util::Timer timer;
+  memtrack::tracker().phase("build");
+  timer.reset();
+  build(cl::EnqueueArgs(queue, cl::NDRange(R.size())), R_buf,
+        bucket_keys_buf, bucket_key_rids_buf, table.buckets);
+  queue.finish();
+  double build_time = timer.getTimeMilliseconds();
+
+  memtrack::tracker().phase("probe");
+  std::vector<JoinedTuple> out;
+  size_t chunks = 0;
+  timer.reset();
+  for (size_t begin = 0; begin < S.size(); begin += chunk, chunks++) {
+    size_t n = std::min(chunk, S.size() - begin);
+    cl_buffer_region region = {sizeof(Tuple) * begin, sizeof(Tuple) * n};
+    cl::Buffer S_chunk = S_buf.createSubBuffer(
+        CL_MEM_READ_ONLY, CL_BUFFER_CREATE_TYPE_REGION, &region);
+    probe(cl::EnqueueArgs(queue, cl::NDRange(n)), S_chunk, bucket_keys_buf,
+          bucket_key_rids_buf, result_rid_buf, result_count_buf,
+          table.buckets);
+    MappedView<JoinedTuple> dense =
+        compactor.compact(queue, S_chunk, result_rid_buf, result_count_buf,
+                          n);
+    out.insert(out.end(), dense.begin(), dense.end());
+  }
+  double probe_time = timer.getTimeMilliseconds();
+  memtrack::tracker().add("joined tuples", memtrack::HOST,
+                          sizeof(JoinedTuple) * out.capacity());
+
+  std::cout << "Build: " << build_time << " ms\nProbe: " << probe_time
+            << " ms (" << chunks << " chunks, compaction included)"
+            << std::endl;
+  std::cout << "\nOpenCL Join Total: " << build_time + probe_time << " ms"
+            << std::endl;
+  return out;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Memory accounting for one run. Allocations are recorded by name as host
+// memory (every huge_vector block) or OpenCL memory (buffers the runtime
+// allocates, SVM arrays; USE_HOST_PTR buffers are their host array and are
+// not counted twice; track_buffer in buffer_tracking.hpp). The tracker keeps the live and peak bytes of each
+// name, of each kind and of each phase, where a phase runs from its phase()
+// call to the next.
+namespace memtrack {
+
+enum Kind { HOST, OPENCL };
+
+class Tracker {
+public:
+  void phase(const std::string &name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    phases_.push_back(std::make_pair(name, live()));
+  }
+
+  void add(const std::string &name, Kind kind, size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Entry &e = buffers_[name];
+    e.kind = kind;
+    e.bytes += bytes;
+    e.peak = std::max(e.peak, e.bytes);
+    live_[kind] += bytes;
+    peak_[kind] = std::max(peak_[kind], live_[kind]);
+    peak_total_ = std::max(peak_total_, live());
+    if (!phases_.empty())
+      phases_.back().second = std::max(phases_.back().second, live());
+  }
+
+  void sub(const std::string &name, size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Entry &e = buffers_[name];
+    bytes = std::min(bytes, e.bytes);
+    e.bytes -= bytes;
+    live_[e.kind] -= bytes;
+  }
+
+  size_t peak() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return peak_total_;
+  }
+
+  // Peak of the run, of every phase and of every name of 1 MB or more
+  void print(std::ostream &out) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    out << "Memory peak: " << (peak_total_ >> 20) << " MB (host "
+        << (peak_[HOST] >> 20) << " MB, OpenCL " << (peak_[OPENCL] >> 20)
+        << " MB)" << std::endl;
+    for (const auto &p : phases_)
+      out << "  phase " << p.first << ": " << (p.second >> 20) << " MB"
+          << std::endl;
+    std::vector<std::pair<size_t, std::string>> by_peak;
+    for (const auto &kv : buffers_) {
+      if (kv.second.peak >= (1 << 20))
+        by_peak.push_back(std::make_pair(kv.second.peak, kv.first));
+    }
+    std::sort(by_peak.rbegin(), by_peak.rend());
+    for (const auto &b : by_peak) {
+      out << "  " << b.second << ": " << (b.first >> 20) << " MB ("
+          << (buffers_.at(b.second).kind == HOST ? "host" : "OpenCL") << ")"
+          << std::endl;
+    }
+  }
+
+private:
+  struct Entry {
+    Kind kind{HOST};
+    size_t bytes{0}, peak{0};
+  };
+
+  size_t live() const { return live_[HOST] + live_[OPENCL]; }
+
+  mutable std::mutex mutex_;
+  std::map<std::string, Entry> buffers_;
+  std::vector<std::pair<std::string, size_t>> phases_; // name, peak
+  size_t live_[2] = {}, peak_[2] = {}, peak_total_{0};
+};
+
+inline Tracker &tracker() {
+  static Tracker t;
+  return t;
+}
+
+} // namespace memtrack
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Morsel-driven scheduling: the input is cut into small ranges (morsels) that
+// workers pull from per-worker deques. A worker that runs dry steals from the
+// back of another worker's deque, so a worker stuck on hot keys (long rid
+// lists) does not hold up the rest. A worker is anything that can process a
+// range: a host thread, or a host thread driving an OpenCL queue.
+
+struct Morsel {
+  size_t begin;
+  size_t end;
+
+  size_t size() const { return end - begin; }
+};
+
+struct WorkerStats {
+  size_t morsels{0};
+  size_t tuples{0};
+  size_t stolen{0};
+};
+
+class MorselScheduler {
+public:
+  explicit MorselScheduler(unsigned num_workers)
+      : queues_(std::max(1u, num_workers)), stats_(queues_.size()) {}
+
+  unsigned num_workers() const { return (unsigned)queues_.size(); }
+  const std::vector<WorkerStats> &stats() const { return stats_; }
+
+  // Cut [0, total) into morsels and hand each worker a contiguous block of
+  // them, so that without stealing every worker scans sequential memory.
+  void reset(size_t total, size_t morsel_size) {
+    morsel_size = std::max<size_t>(1, morsel_size);
+    size_t num_morsels = (total + morsel_size - 1) / morsel_size;
+    size_t per_worker = (num_morsels + queues_.size() - 1) / queues_.size();
+    for (size_t w = 0; w < queues_.size(); w++) {
+      std::lock_guard<std::mutex> lock(queues_[w].mutex);
+      queues_[w].morsels.clear();
+      for (size_t m = w * per_worker;
+           m < std::min(num_morsels, (w + 1) * per_worker); m++) {
+        size_t begin = m * morsel_size;
+        queues_[w].morsels.push_back(
+            Morsel{begin, std::min(total, begin + morsel_size)});
+      }
+    }
+    for (auto &s : stats_)
+      s = WorkerStats();
+  }
+
+  // Own deque front first, then steal from the back of the others
+  bool next(unsigned worker, Morsel &m) {
+    if (pop_front(worker, m)) {
+      stats_[worker].morsels++;
+      stats_[worker].tuples += m.size();
+      return true;
+    }
+    for (unsigned i = 1; i < queues_.size(); i++) {
+      unsigned victim = (worker + i) % queues_.size();
+      if (pop_back(victim, m)) {
+        stats_[worker].morsels++;
+        stats_[worker].tuples += m.size();
+        stats_[worker].stolen++;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Run one thread per worker until every morsel has been processed.
+  // fn(worker, morsel) decides what a worker is, e.g. the last few worker
+  // ids can enqueue the morsel on an OpenCL device instead of running it on
+  // the host.
+  void run(const std::function<void(unsigned, const Morsel &)> &fn) {
+    std::vector<std::thread> threads;
+    threads.reserve(queues_.size());
+    for (unsigned w = 0; w < queues_.size(); w++) {
+      threads.emplace_back([this, w, &fn]() {
+        Morsel m;
+        while (next(w, m)) {
+          fn(w, m);
+        }
+      });
+    }
+    for (auto &t : threads)
+      t.join();
+  }
+
+private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Morsel> morsels;
+  };
+
+  bool pop_front(unsigned w, Morsel &m) {
+    std::lock_guard<std::mutex> lock(queues_[w].mutex);
+    if (queues_[w].morsels.empty())
+      return false;
+    m = queues_[w].morsels.front();
+    queues_[w].morsels.pop_front();
+    return true;
+  }
+
+  bool pop_back(unsigned w, Morsel &m) {
+    std::lock_guard<std::mutex> lock(queues_[w].mutex);
+    if (queues_[w].morsels.empty())
+      return false;
+    m = queues_[w].morsels.back();
+    queues_[w].morsels.pop_back();
+    return true;
+  }
+
+  std::vector<Queue> queues_;
+  std::vector<WorkerStats> stats_;
+};
+
+// Shared cursor over [0, total): every caller takes the next `chunk` tuples.
+// No per-worker blocks and no stealing, so a fast worker (e.g. a GPU queue)
+// simply comes back more often. Used by DD mode's dynamic probe.
+class ChunkCursor {
+public:
+  ChunkCursor(size_t total, size_t chunk)
+      : total_(total), chunk_(std::max<size_t>(1, chunk)) {}
+
+  bool next(Morsel &m) {
+    size_t begin = next_.fetch_add(chunk_, std::memory_order_relaxed);
+    if (begin >= total_)
+      return false;
+    m = Morsel{begin, std::min(total_, begin + chunk_)};
+    return true;
+  }
+
+private:
+  size_t total_;
+  size_t chunk_;
+  std::atomic<size_t> next_{0};
+};
@@ -2,9 +2,15 @@
 
 #define R_LENGTH 16777216
 #define S_LENGTH 16777216
-#define BUCKET_HEADER_NUMBER R_LENGTH
 #define MAX_KEYS_PER_BUCKET 2
 #define MAX_RIDS_PER_KEY 2
 #define HASH_SEED 2654435769U
 
 #define WORK_RATIO_GPU 2
+
+// Used key slots / key slots the hash table is sized for (--load-factor);
+// 0.5 gives the old bucket count, one bucket per R tuple, for unique keys
+#define DEFAULT_LOAD_FACTOR 0.75
+
+// Tuples per work-group in the DD shard routing kernels
+#define ROUTE_BLOCK 4096
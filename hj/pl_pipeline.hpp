@@ -0,0 +1,67 @@
+#pragma once
+
+#include "dd_dynamic.hpp"
+#include "hash_kernels.hpp"
+#include "param.hpp"
+#include "step_graph.hpp"
+
+#include <algorithm>
+#include <vector>
+
+// PL probe as a chunked software pipeline instead of one global barrier per
+// step. S is cut into chunks and every step of a chunk is split between the
+// devices by that step's PL ratio. A chunk's p3 depends on its own p1 on both
+// queues, and its p4 on both p3 parts, so nothing waits on whole steps.
+// Nodes are added in wavefronts (p4 of chunk i, p3 of chunk i+1, p1 of chunk
+// i+2) so each in-order queue runs a later stage while the other device
+// finishes an earlier one. One chunk of S_LENGTH is the barrier version.
+// Every part runs on sub-buffers of its own range (JoinSteps), so the CPU and
+// GPU parts of a step, and the overlapping stages of neighbouring chunks,
+// never write one memory object at the same time. Parts of different steps
+// of a chunk can overlap; the dependencies above order them.
+
+struct PLRatios {
+  long p1{4}, p3{4}, p4{2}; // GPU share (%) of every chunk, per step
+};
+
+// hash[q] is the p1 variant for queue q. Returns the number of chunks.
+inline size_t add_pl_plan(StepGraph &graph, JoinSteps &steps,
+                          const PLRatios &ratios,
+                          const std::vector<HashVariant> &hash,
+                          size_t chunk_size) {
+  const size_t chunk = dd_chunk_size(chunk_size);
+  const size_t num_chunks = (S_LENGTH + chunk - 1) / chunk;
+  const size_t n = graph.num_queues();
+  auto split = [&](size_t c, long ratio) {
+    Morsel range = {c * chunk, std::min<size_t>((c + 1) * chunk, S_LENGTH)};
+    return split_range(range, ratio, n);
+  };
+
+  std::vector<std::vector<int>> p1_done(num_chunks), p3_done(num_chunks);
+  for (size_t wave = 0; wave < num_chunks + 2; wave++) {
+    // Every stage adds the accelerators' parts before the CPU's
+    if (wave >= 2 && wave - 2 < num_chunks) {
+      size_t c = wave - 2;
+      std::vector<Morsel> parts = split(c, ratios.p4);
+      for (size_t q = 1; q <= n; q++)
+        graph.add("p4", q % n, parts[q % n], steps.p4(), p3_done[c]);
+    }
+    if (wave >= 1 && wave - 1 < num_chunks) {
+      size_t c = wave - 1;
+      std::vector<Morsel> parts = split(c, ratios.p3);
+      for (size_t q = 1; q <= n; q++) {
+        p3_done[c].push_back(graph.add("p3", q % n, parts[q % n], steps.p3(),
+                                       p1_done[c]));
+      }
+    }
+    if (wave < num_chunks) {
+      size_t c = wave;
+      std::vector<Morsel> parts = split(c, ratios.p1);
+      for (size_t q = 1; q <= n; q++) {
+        p1_done[c].push_back(graph.add("p1", q % n, parts[q % n],
+                                       steps.p1(hash[q % n])));
+      }
+    }
+  }
+  return num_chunks;
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include "buffer_placement.hpp"
+#include "param.hpp"
+#include "step_graph.hpp"
+#include "tune_cache.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+// Search over the GPU share of all eight steps at once (StepShares) instead
+// of the 2^4 OL placements or the independent PL ratios. The space is too big
+// to run exhaustively, so this is greedy coordinate descent: one step at a
+// time over a grid of shares, keeping any improvement, until a full pass
+// gains nothing. Shares interact, which is why whole passes repeat. A config
+// whose first run is already `cutoff` times slower than the best is dropped
+// after that run. Every evaluated config also gets its GPU-resident bytes,
+// and the time/memory Pareto front is reported.
+
+inline std::string to_string(const StepShares &shares) {
+  std::string s;
+  for (int i = 0; i < NUM_JOIN_STEPS; i++) {
+    s += (i ? " " : "") + std::string(join_step_name(i)) + ":" +
+         std::to_string(shares.gpu[i]);
+  }
+  return s;
+}
+
+// Tune cache fields: gpu_b1 .. gpu_p4
+inline void store_shares(const StepShares &shares, TuneValues &values) {
+  for (int i = 0; i < NUM_JOIN_STEPS; i++)
+    values[std::string("gpu_") + join_step_name(i)] = shares.gpu[i];
+}
+
+// `shares` is set only when every field is present and valid: a share in
+// [0, 100], and 0 or 100 for the steps that cannot be split. Otherwise it
+// is left as it was (shares_from_placement in OL).
+inline bool load_shares(const TuneValues &values, StepShares &shares) {
+  StepShares loaded;
+  for (int i = 0; i < NUM_JOIN_STEPS; i++) {
+    long v = tune_value(values, std::string("gpu_") + join_step_name(i), -1);
+    if (v < 0 || v > 100)
+      return false;
+    if (!step_splittable(i) && v != 0 && v != 100)
+      return false;
+    loaded.gpu[i] = v;
+  }
+  shares = loaded;
+  return true;
+}
+
+// Bytes the GPU parts of `shares` touch. Per-tuple arrays count the largest
+// GPU share of any step using them; the table arrays count whole.
+inline size_t gpu_bytes(const StepShares &shares, const TableSize &table) {
+  double total = 0;
+  for (const JoinBufferUse &a : join_buffer_uses(table)) {
+    long share = 0;
+    for (int s : a.steps)
+      share = std::max(share, shares.gpu[s]);
+    if (a.whole)
+      total += share > 0 ? a.bytes : 0;
+    else
+      total += a.bytes * share / 100;
+  }
+  return (size_t)total;
+}
+
+struct SearchPoint {
+  StepShares shares;
+  double ms{0};
+  size_t gpu_bytes{0};
+  bool pruned{false};
+};
+
+class PlacementSearch {
+public:
+  // One timed run of the whole join with the given shares (ms)
+  typedef std::function<double(const StepShares &)> RunFn;
+
+  PlacementSearch(RunFn run, const TableSize &table, int repeats = 3,
+                  double cutoff = 1.5)
+      : run_(run), table_(table), repeats_(repeats), cutoff_(cutoff) {}
+
+  StepShares search(const StepShares &start, int max_passes = 4) {
+    const long grid[] = {0, 5, 10, 25, 50, 75, 90, 100};
+    StepShares best = start;
+    double best_ms = evaluate(best, -1);
+    for (int pass = 0; pass < max_passes; pass++) {
+      bool improved = false;
+      for (int step = 0; step < NUM_JOIN_STEPS; step++) {
+        for (long share : grid) {
+          if (!step_splittable(step) && share != 0 && share != 100)
+            continue;
+          StepShares cand = best;
+          cand.gpu[step] = share;
+          double ms = evaluate(cand, best_ms);
+          if (ms < best_ms) {
+            best_ms = ms;
+            best = cand;
+            improved = true;
+          }
+        }
+      }
+      std::cout << "  pass " << pass + 1 << ": best " << best_ms << " ms ["
+                << to_string(best) << "], " << points_.size()
+                << " configs run" << std::endl;
+      if (!improved)
+        break;
+    }
+    return best;
+  }
+
+  // Configs no other config beats on both time and GPU bytes, fastest first
+  std::vector<SearchPoint> pareto_front() const {
+    std::vector<SearchPoint> sorted;
+    for (const auto &kv : points_) {
+      if (!kv.second.pruned)
+        sorted.push_back(kv.second);
+    }
+    std::sort(sorted.begin(), sorted.end(),
+              [](const SearchPoint &a, const SearchPoint &b) {
+                return a.ms < b.ms ||
+                       (a.ms == b.ms && a.gpu_bytes < b.gpu_bytes);
+              });
+    std::vector<SearchPoint> front;
+    for (const SearchPoint &p : sorted) {
+      if (front.empty() || p.gpu_bytes < front.back().gpu_bytes)
+        front.push_back(p);
+    }
+    return front;
+  }
+
+private:
+  // Best of `repeats_` runs; stops after the first if it is already worse
+  // than cutoff_ * best_ms. Each config runs only once per search.
+  double evaluate(const StepShares &shares, double best_ms) {
+    std::string key = to_string(shares);
+    auto it = points_.find(key);
+    if (it != points_.end())
+      return it->second.ms;
+    SearchPoint p;
+    p.shares = shares;
+    p.gpu_bytes = gpu_bytes(shares, table_);
+    p.ms = run_(shares);
+    if (best_ms >= 0 && p.ms > cutoff_ * best_ms) {
+      p.pruned = true;
+    } else {
+      for (int r = 1; r < repeats_; r++)
+        p.ms = std::min(p.ms, run_(shares));
+    }
+    points_[key] = p;
+    return p.ms;
+  }
+
+  RunFn run_;
+  TableSize table_;
+  int repeats_;
+  double cutoff_;
+  std::map<std::string, SearchPoint> points_;
+};
+
+inline void print_pareto_front(const std::vector<SearchPoint> &front) {
+  for (const SearchPoint &p : front) {
+    std::cout << "  " << p.ms << " ms, " << p.gpu_bytes / (1 << 20)
+              << " MB on GPU: [" << to_string(p.shares) << "]" << std::endl;
+  }
+}
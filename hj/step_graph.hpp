@@ -0,0 +1,348 @@
+#pragma once
+
+#include "cl.hpp"
+#include "hash_kernels.hpp"
+#include "hj.hpp"
+#include "morsel.hpp"
+#include "param.hpp"
+#include "table_size.hpp"
+#include "util.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+// Join steps as a DAG. Every node names the queue it runs on and the R or S
+// range it covers, and lists the nodes whose output it reads. run() enqueues
+// the nodes in insertion order with the done events of their dependencies as
+// wait list, so a step placed on another queue than its producer waits for
+// it instead of racing it. Nodes without a path between them overlap.
+// DD, OL and PL are plans built on top (add_*_plan below).
+
+// Queue slots the plans use
+enum StepDevice { STEP_CPU = 0, STEP_GPU = 1 };
+
+// Full-length buffers the step kernels run on. R and S hold Tuples.
+struct JoinBuffers {
+  cl::Buffer R, R_bucket_ids, key_indices;
+  cl::Buffer bucket_total, bucket_keys, bucket_key_rids;
+  cl::Buffer S, S_bucket_ids, S_key_indices, S_match_found;
+  cl::Buffer result_rid, result_count; // join_result.hpp
+  TableSize table; // size of bucket_total, bucket_keys, bucket_key_rids
+};
+
+// Enqueue one step over `range` on `queue` after `wait`
+typedef std::function<cl::Event(cl::CommandQueue &, const Morsel &,
+                                const std::vector<cl::Event> &)>
+    StepFn;
+
+class StepGraph {
+public:
+  explicit StepGraph(const std::vector<cl::CommandQueue> &queues)
+      : queues_(queues) {}
+
+  // Add a node and return its id. Dependencies must be earlier nodes, which
+  // makes insertion order a topological order. An empty range adds nothing
+  // and returns -1; -1 is also accepted (and skipped) as a dependency.
+  int add(const std::string &name, int queue, const Morsel &range, StepFn fn,
+          const std::vector<int> &deps = {}) {
+    if (range.size() == 0)
+      return -1;
+    Node node;
+    node.name = name;
+    node.queue = queue;
+    node.range = range;
+    node.fn = fn;
+    for (int d : deps) {
+      if (d >= 0)
+        node.deps.push_back(d);
+    }
+    nodes_.push_back(node);
+    return (int)nodes_.size() - 1;
+  }
+
+  size_t size() const { return nodes_.size(); }
+  size_t num_queues() const { return queues_.size(); }
+
+  // Enqueue every node, wait for all queues and return the wall time (ms)
+  double run() {
+    util::Timer timer;
+    timer.reset();
+    for (Node &node : nodes_) {
+      std::vector<cl::Event> wait;
+      for (int d : node.deps)
+        wait.push_back(nodes_[d].done);
+      cl::CommandQueue &queue = queues_[node.queue];
+      node.done = node.fn(queue, node.range, wait);
+      // Submit now so waits on other queues can resolve
+      queue.flush();
+    }
+    for (cl::CommandQueue &queue : queues_)
+      queue.finish();
+    return timer.getTimeMilliseconds();
+  }
+
+private:
+  struct Node {
+    std::string name;
+    int queue{0};
+    Morsel range{0, 0};
+    StepFn fn;
+    std::vector<int> deps;
+    cl::Event done;
+  };
+
+  std::vector<cl::CommandQueue> queues_;
+  std::vector<Node> nodes_;
+};
+
+// Sub-buffer of elements [r.begin, r.end) of `buf`, `elem` bytes each, with
+// the access flags of `buf`. A kernel enqueued on it keeps it alive until it
+// has run.
+inline cl::Buffer range_buffer(cl::Buffer buf, const Morsel &r, size_t elem) {
+  cl_buffer_region region = {elem * r.begin, elem * r.size()};
+  return buf.createSubBuffer(0, CL_BUFFER_CREATE_TYPE_REGION, &region);
+}
+
+// StepFn factories for b1..b4 and p1..p4 on one JoinBuffers. A step runs on
+// sub-buffers of its range of every per-tuple buffer, so the parts of a split
+// step on different queues write disjoint memory objects (OpenCL leaves
+// concurrent writes to one buffer from several devices undefined). Ranges
+// start at multiples of 4096 tuples, which keeps the sub-buffers aligned.
+// The table arrays are shared whole. Must outlive the graphs that use its
+// steps.
+class JoinSteps {
+public:
+  JoinSteps(const cl::Program &program, const JoinBuffers &bufs)
+      : bufs_(bufs), hash_keys_(program), b2_(program, "b2"),
+        b3_(program, "b3"), b4_(program, "b4"), p2_(program, "p2"),
+        p3_(program, "p3"), p4_(program, "p4") {}
+
+  StepFn b1(const HashVariant &v) {
+    return [this, v](cl::CommandQueue &q, const Morsel &r,
+                     const std::vector<cl::Event> &wait) {
+      return hash_keys_(q, v, tuples(bufs_.R, r), ids(bufs_.R_bucket_ids, r),
+                        bufs_.table.buckets, (cl_uint)r.size(), 0, wait);
+    };
+  }
+  StepFn b2() {
+    return [this](cl::CommandQueue &q, const Morsel &r,
+                  const std::vector<cl::Event> &wait) {
+      return b2_(args(q, r, wait), ids(bufs_.R_bucket_ids, r),
+                 bufs_.bucket_total);
+    };
+  }
+  StepFn b3() {
+    return [this](cl::CommandQueue &q, const Morsel &r,
+                  const std::vector<cl::Event> &wait) {
+      return b3_(args(q, r, wait), tuples(bufs_.R, r),
+                 ids(bufs_.R_bucket_ids, r), bufs_.bucket_keys,
+                 ids(bufs_.key_indices, r), bufs_.table.buckets);
+    };
+  }
+  StepFn b4() {
+    return [this](cl::CommandQueue &q, const Morsel &r,
+                  const std::vector<cl::Event> &wait) {
+      return b4_(args(q, r, wait), tuples(bufs_.R, r),
+                 ids(bufs_.R_bucket_ids, r), ids(bufs_.key_indices, r),
+                 bufs_.bucket_key_rids);
+    };
+  }
+  StepFn p1(const HashVariant &v) {
+    return [this, v](cl::CommandQueue &q, const Morsel &r,
+                     const std::vector<cl::Event> &wait) {
+      return hash_keys_(q, v, tuples(bufs_.S, r), ids(bufs_.S_bucket_ids, r),
+                        bufs_.table.buckets, (cl_uint)r.size(), 0, wait);
+    };
+  }
+  StepFn p2() {
+    return [this](cl::CommandQueue &q, const Morsel &r,
+                  const std::vector<cl::Event> &wait) {
+      return p2_(args(q, r, wait), ids(bufs_.S_bucket_ids, r),
+                 bufs_.bucket_total);
+    };
+  }
+  StepFn p3() {
+    return [this](cl::CommandQueue &q, const Morsel &r,
+                  const std::vector<cl::Event> &wait) {
+      return p3_(args(q, r, wait), tuples(bufs_.S, r),
+                 ids(bufs_.S_bucket_ids, r), bufs_.bucket_keys,
+                 ids(bufs_.S_key_indices, r), ids(bufs_.S_match_found, r),
+                 bufs_.table.buckets);
+    };
+  }
+  StepFn p4() {
+    return [this](cl::CommandQueue &q, const Morsel &r,
+                  const std::vector<cl::Event> &wait) {
+      return p4_(args(q, r, wait), ids(bufs_.S_key_indices, r),
+                 ids(bufs_.S_match_found, r), bufs_.bucket_key_rids,
+                 ids(bufs_.S_bucket_ids, r),
+                 range_buffer(bufs_.result_rid, r,
+                              sizeof(uint32_t) * MAX_RIDS_PER_KEY),
+                 ids(bufs_.result_count, r));
+    };
+  }
+
+private:
+  static cl::EnqueueArgs args(cl::CommandQueue &q, const Morsel &r,
+                              const std::vector<cl::Event> &wait) {
+    return cl::EnqueueArgs(q, wait, cl::NDRange(r.size()), cl::NullRange);
+  }
+
+  static cl::Buffer tuples(const cl::Buffer &buf, const Morsel &r) {
+    return range_buffer(buf, r, sizeof(Tuple));
+  }
+  static cl::Buffer ids(const cl::Buffer &buf, const Morsel &r) {
+    return range_buffer(buf, r, sizeof(uint32_t));
+  }
+
+  JoinBuffers bufs_;
+  HashKernels hash_keys_;
+  cl::make_kernel<cl::Buffer, cl::Buffer> b2_;
+  cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer, cl_uint> b3_;
+  cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer> b4_;
+  cl::make_kernel<cl::Buffer, cl::Buffer> p2_;
+  cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer,
+                  cl_uint>
+      p3_;
+  cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer,
+                  cl::Buffer>
+      p4_;
+};
+
+enum JoinStep {
+  JOIN_B1,
+  JOIN_B2,
+  JOIN_B3,
+  JOIN_B4,
+  JOIN_P1,
+  JOIN_P2,
+  JOIN_P3,
+  JOIN_P4,
+  NUM_JOIN_STEPS
+};
+
+inline const char *join_step_name(int step) {
+  static const char *names[NUM_JOIN_STEPS] = {"b1", "b2", "b3", "b4",
+                                              "p1", "p2", "p3", "p4"};
+  return names[step];
+}
+
+// b3/b4 insert into one table with plain stores and a retry loop, not
+// atomics (claim_key, insert_rid), so two devices writing it at once would
+// race; they run whole on one device
+inline bool step_splittable(int step) {
+  return step != JOIN_B3 && step != JOIN_B4;
+}
+
+// GPU share (%) of every step: 0 = all CPU, 100 = all GPU
+struct StepShares {
+  long gpu[NUM_JOIN_STEPS] = {};
+};
+
+// OL placement bits [b3][b4][p3][p4] (1 = GPU), the rest on the CPU
+inline StepShares shares_from_placement(long placement) {
+  StepShares shares;
+  shares.gpu[JOIN_B3] = (placement & 1) ? 100 : 0;
+  shares.gpu[JOIN_B4] = (placement & 2) ? 100 : 0;
+  shares.gpu[JOIN_P3] = (placement & 4) ? 100 : 0;
+  shares.gpu[JOIN_P4] = (placement & 8) ? 100 : 0;
+  return shares;
+}
+
+// One part of `range` per queue: queues 1..n-1 take the first `share`
+// percent in equal 4096-aligned pieces, queue 0 (the CPU) the rest. With
+// two queues that is [CPU part, GPU part], the GPU part first in `range`.
+inline std::vector<Morsel> split_range(const Morsel &range, long share,
+                                       size_t n) {
+  std::vector<Morsel> parts(n, Morsel{range.end, range.end});
+  const size_t accel = n - 1, total = range.size() * share / 100;
+  size_t b = range.begin;
+  for (size_t q = 1; q < n; q++) {
+    size_t e = range.begin + total * q / accel / 4096 * 4096;
+    parts[q] = {b, e};
+    b = e;
+  }
+  parts[0] = {b, range.end};
+  return parts;
+}
+
+// Optional hook over every node a plan adds: the StepFn of `step` on
+// `queue`, `whole` if no other queue runs a part of it. Called in plan order.
+typedef std::function<StepFn(int step, size_t queue, bool whole, StepFn fn)>
+    StepWrap;
+
+// The whole join with every step split by `shares` over all queues of the
+// graph; hash[q] is the b1/p1 variant for queue q. A step depends on all
+// parts of the steps it reads from; p1/p2 depend on nothing from the build
+// and overlap with it. b3/b4 go whole to queue 0 or 1.
+inline void add_shares_plan(StepGraph &graph, JoinSteps &steps,
+                            const StepShares &shares,
+                            const std::vector<HashVariant> &hash,
+                            const StepWrap &wrap = nullptr) {
+  const size_t n = graph.num_queues();
+  std::vector<int> done[NUM_JOIN_STEPS];
+  auto add = [&](int step, const Morsel &range,
+                 std::function<StepFn(size_t)> fn,
+                 std::initializer_list<int> inputs) {
+    std::vector<int> deps;
+    for (int in : inputs)
+      deps.insert(deps.end(), done[in].begin(), done[in].end());
+    // A step that cannot be split goes whole to the side with the larger
+    // share
+    long share = shares.gpu[step];
+    if (!step_splittable(step))
+      share = share >= 50 ? 100 : 0;
+    std::vector<Morsel> parts =
+        split_range(range, share, step_splittable(step) ? n : 2);
+    const char *name = join_step_name(step);
+    bool whole = std::count_if(parts.begin(), parts.end(), [](const Morsel &m) {
+                   return m.size() > 0;
+                 }) == 1;
+    // Accelerators first, as in the two-device plans
+    for (size_t q = 1; q <= parts.size(); q++) {
+      size_t d = q % parts.size();
+      if (parts[d].size() == 0)
+        continue;
+      StepFn step_fn = wrap ? wrap(step, d, whole, fn(d)) : fn(d);
+      done[step].push_back(graph.add(name, d, parts[d], step_fn, deps));
+    }
+  };
+  auto same = [](StepFn fn) { return [fn](size_t) { return fn; }; };
+  Morsel R = {0, R_LENGTH}, S = {0, S_LENGTH};
+  add(JOIN_B1, R, [&](size_t q) { return steps.b1(hash[q]); }, {});
+  add(JOIN_B2, R, same(steps.b2()), {JOIN_B1});
+  // b3 rewrites the bucket ids b2 reads
+  add(JOIN_B3, R, same(steps.b3()), {JOIN_B1, JOIN_B2});
+  add(JOIN_B4, R, same(steps.b4()), {JOIN_B3});
+  add(JOIN_P1, S, [&](size_t q) { return steps.p1(hash[q]); }, {});
+  add(JOIN_P2, S, same(steps.p2()), {JOIN_P1, JOIN_B2});
+  // p3 rewrites the bucket ids p2 reads
+  add(JOIN_P3, S, same(steps.p3()), {JOIN_P1, JOIN_P2, JOIN_B3});
+  add(JOIN_P4, S, same(steps.p4()), {JOIN_P3, JOIN_B4});
+}
+
+// OL: b1/b2/p1/p2 on the CPU, b3, b4, p3, p4 placed by `placement`
+inline void add_ol_plan(StepGraph &graph, JoinSteps &steps, long placement,
+                        const HashVariant &cpu_hash) {
+  add_shares_plan(graph, steps, shares_from_placement(placement),
+                  std::vector<HashVariant>(graph.num_queues(), cpu_hash));
+}
+
+// DD probe: S split by `parts` (one per queue, see split_range), an
+// independent chain per queue with nothing shared but the built table.
+// Queue 0 runs on cpu_steps, the others on gpu_steps.
+inline void add_dd_probe_plan(StepGraph &graph, JoinSteps &cpu_steps,
+                              JoinSteps &gpu_steps,
+                              const std::vector<Morsel> &parts,
+                              const std::vector<HashVariant> &hash) {
+  for (size_t d = 0; d < parts.size(); d++) {
+    JoinSteps &steps = d == STEP_CPU ? cpu_steps : gpu_steps;
+    int p1 = graph.add("p1", d, parts[d], steps.p1(hash[d]));
+    int p2 = graph.add("p2", d, parts[d], steps.p2(), {p1});
+    int p3 = graph.add("p3", d, parts[d], steps.p3(), {p1, p2});
+    graph.add("p4", d, parts[d], steps.p4(), {p3});
+  }
+}
@@ -0,0 +1,231 @@
+#pragma once
+
+#include "cl.hpp"
+#include "hj.hpp"
+#include "host_join.hpp"
+#include "hugepage.hpp"
+#include "join_result.hpp"
+#include "mem_tracker.hpp"
+#include "morsel.hpp"
+#include "param.hpp"
+#include "table_size.hpp"
+#include "util.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Pointer-based join in shared virtual memory (OpenCL 2.0). R, S, a chained
+// hash table and the p4-layout result are clSVMAlloc allocations that the
+// host and the kernels in hj_svm.cl address by the same pointers: no
+// cl::Buffer, no sub-buffers, no copies between the two. A bucket is the
+// head of a linked list of SvmNodes, one per R tuple, so a key has no
+// MAX_KEYS_PER_BUCKET limit and a bucket never overflows into the next. The
+// device builds the table; the device and the host threads then both probe
+// it. Fine-grained buffers are used as they are, coarse-grained ones are
+// mapped around every host access. Devices without SVM (all OpenCL 1.x
+// devices) are reported by svm_supported and keep the buffer path.
+
+// svm_node in hj_svm.cl
+struct SvmNode {
+  uint32_t key;
+  uint32_t rid;
+  SvmNode *next;
+};
+
+static_assert(sizeof(SvmNode) == 16, "svm_node is 16 bytes on the device");
+
+// Buffer SVM capabilities of `device`; 0 for a device without SVM
+inline cl_device_svm_capabilities svm_capabilities(const cl::Device &device) {
+  cl_device_svm_capabilities caps = 0;
+  if (clGetDeviceInfo(device(), CL_DEVICE_SVM_CAPABILITIES, sizeof(caps),
+                      &caps, NULL) != CL_SUCCESS)
+    return 0;
+  return caps & (CL_DEVICE_SVM_COARSE_GRAIN_BUFFER |
+                 CL_DEVICE_SVM_FINE_GRAIN_BUFFER);
+}
+
+// Buffer SVM, host-sized pointers (nodes hold them) and 64-bit atomics for
+// the pointer exchange in svm_build
+inline bool svm_supported(const cl::Device &device) {
+  std::string ext = device.getInfo<CL_DEVICE_EXTENSIONS>();
+  return svm_capabilities(device) != 0 &&
+         device.getInfo<CL_DEVICE_ADDRESS_BITS>() == 8 * sizeof(void *) &&
+         ext.find("cl_khr_int64_base_atomics") != std::string::npos;
+}
+
+// `count` Ts of SVM, recorded in memtrack as "SVM arrays". map/unmap
+// bracket host access to a coarse-grained allocation and do nothing for a
+// fine-grained one.
+template <typename T> class SvmArray {
+public:
+  SvmArray(const cl::Context &context, size_t count, bool fine)
+      : context_(context), size_(count), fine_(fine) {
+    cl_svm_mem_flags flags =
+        CL_MEM_READ_WRITE | (fine ? CL_MEM_SVM_FINE_GRAIN_BUFFER : 0);
+    data_ = (T *)clSVMAlloc(context_(), flags, sizeof(T) * count, 0);
+    if (data_ == NULL)
+      throw cl::Error(CL_MEM_OBJECT_ALLOCATION_FAILURE, "clSVMAlloc");
+    memtrack::tracker().add("SVM arrays", memtrack::OPENCL,
+                            sizeof(T) * count);
+  }
+  ~SvmArray() {
+    clSVMFree(context_(), data_);
+    memtrack::tracker().sub("SVM arrays", sizeof(T) * size_);
+  }
+
+  SvmArray(const SvmArray &) = delete;
+  SvmArray &operator=(const SvmArray &) = delete;
+
+  T *data() { return data_; }
+  const T *data() const { return data_; }
+  size_t size() const { return size_; }
+  T &operator[](size_t i) { return data_[i]; }
+  const T &operator[](size_t i) const { return data_[i]; }
+
+  void map(cl::CommandQueue &queue, cl_map_flags flags) {
+    if (fine_)
+      return;
+    cl_int err = clEnqueueSVMMap(queue(), CL_TRUE, flags, data_,
+                                 sizeof(T) * size_, 0, NULL, NULL);
+    if (err != CL_SUCCESS)
+      throw cl::Error(err, "clEnqueueSVMMap");
+  }
+
+  void unmap(cl::CommandQueue &queue) {
+    if (fine_)
+      return;
+    cl_int err = clEnqueueSVMUnmap(queue(), data_, 0, NULL, NULL);
+    if (err != CL_SUCCESS)
+      throw cl::Error(err, "clEnqueueSVMUnmap");
+  }
+
+private:
+  cl::Context context_;
+  T *data_;
+  size_t size_;
+  bool fine_;
+};
+
+inline void set_svm_arg(cl::Kernel &kernel, cl_uint index, const void *ptr) {
+  cl_int err = clSetKernelArgSVMPointer(kernel(), index, ptr);
+  if (err != CL_SUCCESS)
+    throw cl::Error(err, "clSetKernelArgSVMPointer");
+}
+
+// Host probe of one S tuple: the same walk as svm_probe
+inline void probe_chain(const SvmNode *const *heads, cl_uint num_buckets,
+                        const Tuple &s, size_t pos, SparseResult &res) {
+  uint32_t count = 0;
+  size_t base = pos * MAX_RIDS_PER_KEY;
+  for (const SvmNode *node = heads[bucket_of(s.key, num_buckets)];
+       node != NULL && count < MAX_RIDS_PER_KEY; node = node->next) {
+    if (node->key == s.key)
+      res.rid[base + count++] = node->rid;
+  }
+  res.count[pos] = count;
+}
+
+// Build R into a chained SVM table on `queue`'s device, probe S with it on
+// the device and on `threads` host threads. One list head per key slot of
+// `table`, so the average list is as long as the load factor. Returns the
+// device's result count; the host's is printed next to it.
+inline size_t run_svm_join(const cl::Context &context, cl::CommandQueue &queue,
+                           const huge_vector<Tuple> &R,
+                           const huge_vector<Tuple> &S, const TableSize &table,
+                           unsigned threads) {
+  cl::Device device = queue.getInfo<CL_QUEUE_DEVICE>();
+  bool fine =
+      (svm_capabilities(device) & CL_DEVICE_SVM_FINE_GRAIN_BUFFER) != 0;
+  std::cout << "SVM: " << (fine ? "fine" : "coarse") << "-grained buffers"
+            << std::endl;
+
+  cl::Program program(context, util::loadProgram("hj_svm.cl"));
+  std::vector<cl::Device> build_devices(1, device);
+  program.build(build_devices, "-cl-std=CL2.0");
+  cl::Kernel build(program, "svm_build");
+  cl::Kernel probe(program, "svm_probe");
+
+  cl_uint num_heads = (cl_uint)table.key_slots();
+  SvmArray<Tuple> R_svm(context, R.size(), fine);
+  SvmArray<Tuple> S_svm(context, S.size(), fine);
+  SvmArray<SvmNode> nodes(context, R.size(), fine);
+  SvmArray<SvmNode *> heads(context, num_heads, fine);
+  SvmArray<uint32_t> result_rid(context, S.size() * MAX_RIDS_PER_KEY, fine);
+  SvmArray<uint32_t> result_count(context, S.size(), fine);
+
+  // The inputs are the generated vectors; load them into SVM once
+  R_svm.map(queue, CL_MAP_WRITE);
+  S_svm.map(queue, CL_MAP_WRITE);
+  heads.map(queue, CL_MAP_WRITE);
+  memcpy(R_svm.data(), &R[0], sizeof(Tuple) * R.size());
+  memcpy(S_svm.data(), &S[0], sizeof(Tuple) * S.size());
+  memset(heads.data(), 0, sizeof(SvmNode *) * num_heads);
+  R_svm.unmap(queue);
+  S_svm.unmap(queue);
+  heads.unmap(queue);
+
+  util::Timer timer;
+  timer.reset();
+  set_svm_arg(build, 0, R_svm.data());
+  build.setArg(1, (cl_uint)R.size());
+  set_svm_arg(build, 2, nodes.data());
+  set_svm_arg(build, 3, heads.data());
+  build.setArg(4, num_heads);
+  queue.enqueueNDRangeKernel(build, cl::NullRange, cl::NDRange(R.size()),
+                             cl::NullRange);
+  queue.finish();
+  double build_time = timer.getTimeMilliseconds();
+
+  // svm_probe reaches the nodes only through the heads
+  void *indirect[] = {nodes.data()};
+  cl_int err = clSetKernelExecInfo(probe(), CL_KERNEL_EXEC_INFO_SVM_PTRS,
+                                   sizeof(indirect), indirect);
+  if (err != CL_SUCCESS)
+    throw cl::Error(err, "clSetKernelExecInfo");
+
+  timer.reset();
+  set_svm_arg(probe, 0, S_svm.data());
+  probe.setArg(1, (cl_uint)S.size());
+  set_svm_arg(probe, 2, heads.data());
+  set_svm_arg(probe, 3, result_rid.data());
+  set_svm_arg(probe, 4, result_count.data());
+  probe.setArg(5, num_heads);
+  queue.enqueueNDRangeKernel(probe, cl::NullRange, cl::NDRange(S.size()),
+                             cl::NullRange);
+  queue.finish();
+  double probe_time = timer.getTimeMilliseconds();
+
+  result_count.map(queue, CL_MAP_READ);
+  size_t device_results = count_results(result_count.data(), S.size());
+  result_count.unmap(queue);
+
+  // The host follows the pointers the device wrote
+  S_svm.map(queue, CL_MAP_READ);
+  nodes.map(queue, CL_MAP_READ);
+  heads.map(queue, CL_MAP_READ);
+  SparseResult host_res;
+  MorselScheduler sched(threads);
+  sched.reset(S.size(), 65536);
+  timer.reset();
+  sched.run([&](unsigned, const Morsel &m) {
+    for (size_t i = m.begin; i < m.end; i++)
+      probe_chain(heads.data(), num_heads, S_svm[i], i, host_res);
+  });
+  double host_probe_time = timer.getTimeMilliseconds();
+  S_svm.unmap(queue);
+  nodes.unmap(queue);
+  heads.unmap(queue);
+  queue.finish();
+  size_t host_results = count_results(&host_res.count[0], S.size());
+
+  std::cout << "SVM build: " << build_time << " ms\nSVM probe: " << probe_time
+            << " ms (device), " << host_probe_time << " ms (" << threads
+            << " host threads)" << std::endl;
+  std::cout << "SVM produced " << device_results << " joined tuples"
+            << (host_results == device_results ? "" : " (HOST MISMATCH)")
+            << std::endl;
+  return device_results;
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "cl.hpp"
+#include "hj.hpp"
+#include "hugepage.hpp"
+#include "param.hpp"
+#include "util.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Hash table size, chosen at runtime. The bucket count is sized for the
+// distinct R keys at a target load factor (used key slots / key slots) and
+// passed to the kernels. MAX_KEYS_PER_BUCKET stays compile-time. Distinct
+// keys come from a sample of R: the sample's distinct fraction scaled to
+// |R|, which errs towards a larger table. The rid slots per key slot are a
+// build option of hj.cl: MAX_RIDS_PER_KEY (the p4 result stride), or one
+// when an exact pass over R proves every key unique. A sample cannot prove
+// that, and insert_rid drops a rid that finds no slot without a trace.
+
+struct TableSize {
+  cl_uint buckets{R_LENGTH};
+  cl_uint rids_per_key{MAX_RIDS_PER_KEY};
+
+  size_t key_slots() const { return (size_t)buckets * MAX_KEYS_PER_BUCKET; }
+  size_t rid_slots() const { return key_slots() * rids_per_key; }
+  // bucket_total + bucket_keys + bucket_key_rids
+  size_t bytes() const {
+    return sizeof(uint32_t) * (buckets + key_slots() + rid_slots());
+  }
+};
+
+// hash_key in hj.cl: multiplicative hash, then multiply-shift onto
+// [0, buckets), which needs no division for a bucket count that is not a
+// compile-time constant
+inline uint32_t bucket_of(uint32_t key, cl_uint buckets) {
+  return (uint32_t)(((uint64_t)(uint32_t)(key * HASH_SEED) * buckets) >> 32);
+}
+
+// 64-bit keys are folded to 32 bits first
+inline uint32_t bucket_of(uint64_t key, cl_uint buckets) {
+  return bucket_of((uint32_t)key ^ (uint32_t)(key >> 32), buckets);
+}
+
+struct KeySample {
+  size_t sampled{0}, distinct{0};
+  uint32_t max_repeats{0}; // most copies of one key in the sample
+  bool unique{false};       // no key of R repeats (exact, not sampled)
+};
+
+// True if no two tuples of R share a key: a sorted copy of the keys
+inline bool keys_unique(const huge_vector<Tuple> &R) {
+  huge_vector<uint32_t> keys(R.size());
+  for (size_t i = 0; i < R.size(); i++)
+    keys[i] = R[i].key;
+  std::sort(keys.begin(), keys.end());
+  return std::adjacent_find(keys.begin(), keys.end()) == keys.end();
+}
+
+// Every (|R| / count)-th key of R. A sample without repeats is checked
+// against all of R.
+inline KeySample sample_keys(const huge_vector<Tuple> &R,
+                             size_t count = 1 << 20) {
+  KeySample s;
+  size_t stride = std::max<size_t>(1, R.size() / count);
+  std::unordered_map<uint32_t, uint32_t> seen;
+  seen.reserve(std::min(count, R.size()));
+  for (size_t i = 0; i < R.size(); i += stride) {
+    s.max_repeats = std::max(s.max_repeats, ++seen[R[i].key]);
+    s.sampled++;
+  }
+  s.distinct = seen.size();
+  s.unique = s.max_repeats <= 1 && keys_unique(R);
+  return s;
+}
+
+inline double estimated_distinct(const KeySample &s, size_t n) {
+  return s.sampled > 0 ? (double)n * s.distinct / s.sampled : (double)n;
+}
+
+// Buckets for `n` R tuples at `load_factor`; one rid slot per key only for
+// keys proven unique
+inline TableSize size_table(const KeySample &s, size_t n, double load_factor) {
+  double buckets =
+      std::ceil(estimated_distinct(s, n) / (load_factor * MAX_KEYS_PER_BUCKET));
+  TableSize t;
+  t.buckets = (cl_uint)std::max(1.0, buckets);
+  t.rids_per_key = s.unique ? 1 : MAX_RIDS_PER_KEY;
+  return t;
+}
+
+// hj.cl options for a table of `rids_per_key` rid slots per key slot
+inline std::string table_build_options(cl_uint rids_per_key) {
+  return "-DTABLE_RIDS_PER_KEY=" + std::to_string(rids_per_key);
+}
+
+// hj.cl built for every device of `context` and a table of `rids_per_key`
+inline cl::Program build_join_program(const cl::Context &context,
+                                      cl_uint rids_per_key) {
+  cl::Program program(context, util::loadProgram("hj.cl"));
+  program.build(table_build_options(rids_per_key).c_str());
+  return program;
+}
+
+inline void print_table_size(const TableSize &t, const KeySample &s,
+                             size_t n, double load_factor) {
+  std::cout << "Hash table: " << t.buckets << " buckets ("
+            << t.bytes() / (1 << 20) << " MB) for ~"
+            << (size_t)estimated_distinct(s, n) << " distinct keys at load "
+            << "factor " << load_factor << ", " << t.rids_per_key
+            << " rid slots per key" << std::endl;
+  if (s.max_repeats > MAX_RIDS_PER_KEY) {
+    std::cout << "Warning: a sampled key has " << s.max_repeats
+              << " R tuples; only " << MAX_RIDS_PER_KEY << " are kept"
+              << std::endl;
+  }
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "cl.hpp"
+#include "param.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Persistent winners of the DD/OL/PL tuners. One line per configuration:
+//
+//   <key>\t<name>=<value> <name>=<value> ...
+//
+// The key names the mode, every device with its driver version, the input
+// sizes and the table size, so a tuned config is only reused on the same
+// hardware, data size and load factor.
+// Normal runs load their config from here and only tune on a miss.
+
+typedef std::map<std::string, long> TuneValues;
+
+class TuneCache {
+public:
+  explicit TuneCache(const std::string &path) : path_(path) { load(); }
+
+  const std::string &path() const { return path_; }
+
+  static std::string make_key(const std::string &mode,
+                              const std::vector<cl::Device> &devices,
+                              cl_uint buckets) {
+    std::string key = mode;
+    for (const cl::Device &d : devices) {
+      key += "|" + d.getInfo<CL_DEVICE_NAME>() + "@" +
+             d.getInfo<CL_DRIVER_VERSION>();
+    }
+    key += "|R=" + std::to_string(R_LENGTH) + "|S=" + std::to_string(S_LENGTH);
+    key += "|buckets=" + std::to_string(buckets);
+    for (char &c : key) {
+      if (c == '\t' || c == '\n' || c == '\r' || c == '\0')
+        c = ' ';
+    }
+    return key;
+  }
+
+  bool lookup(const std::string &key, TuneValues &values) const {
+    auto it = entries_.find(key);
+    if (it == entries_.end())
+      return false;
+    values.clear();
+    std::istringstream in(it->second);
+    std::string field;
+    while (in >> field) {
+      size_t eq = field.find('=');
+      if (eq == std::string::npos)
+        continue;
+      values[field.substr(0, eq)] = strtol(field.c_str() + eq + 1, NULL, 10);
+    }
+    return true;
+  }
+
+  // Replace the entry for `key` and rewrite the file
+  void store(const std::string &key, const TuneValues &values) {
+    std::string line;
+    for (const auto &kv : values) {
+      if (!line.empty())
+        line += " ";
+      line += kv.first + "=" + std::to_string(kv.second);
+    }
+    entries_[key] = line;
+    save();
+  }
+
+private:
+  void load() {
+    std::ifstream in(path_.c_str());
+    std::string line;
+    while (std::getline(in, line)) {
+      size_t tab = line.find('\t');
+      if (tab == std::string::npos)
+        continue;
+      entries_[line.substr(0, tab)] = line.substr(tab + 1);
+    }
+  }
+
+  void save() const {
+    std::ofstream out(path_.c_str(), std::ios::trunc);
+    if (!out) {
+      std::cout << "Cannot write tune cache: " << path_ << std::endl;
+      return;
+    }
+    for (const auto &kv : entries_)
+      out << kv.first << "\t" << kv.second << "\n";
+  }
+
+  std::string path_;
+  std::map<std::string, std::string> entries_;
+};
+
+inline long tune_value(const TuneValues &values, const std::string &name,
+                       long fallback) {
+  auto it = values.find(name);
+  return it == values.end() ? fallback : it->second;
+}
+
+inline void print_tune_values(const TuneValues &values) {
+  for (const auto &kv : values)
+    std::cout << " " << kv.first << "=" << kv.second;
+  std::cout << std::endl;
+}
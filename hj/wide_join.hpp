@@ -0,0 +1,131 @@
+#pragma once
+
+#include "cl.hpp"
+#include "hj.hpp"
+#include "hugepage.hpp"
+#include "join_result.hpp"
+#include "mapped_view.hpp"
+#include "param.hpp"
+#include "table_size.hpp"
+#include "util.hpp"
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Fused join over BasicTuple<K, V> with hj.cl built for those widths
+// (-DKEY_BITS, -DRID_BITS). The table holds K keys and V rids, so 32/32 is
+// the single-device fused join with its 8-byte tuples and 4-byte slots, and
+// 64-bit keys only widen the key slots and the tuple loads: the kernels
+// compare one ulong per slot, with no per-width branches or byte loops.
+// Results are the p4 layout with V rids, materialized on the host.
+
+template <typename K, typename V> std::string width_build_options() {
+  return "-DKEY_BITS=" + std::to_string(8 * sizeof(K)) +
+         " -DRID_BITS=" + std::to_string(8 * sizeof(V));
+}
+
+struct WidthJoinStats {
+  double build_ms{0}, probe_ms{0};
+  size_t results{0};
+  size_t table_bytes{0};
+};
+
+template <typename K, typename V>
+inline WidthJoinStats run_width_join(const cl::Context &context,
+                                     cl::CommandQueue &queue,
+                                     huge_vector<BasicTuple<K, V>> &R,
+                                     huge_vector<BasicTuple<K, V>> &S,
+                                     const TableSize &table) {
+  cl::Program program(context, util::loadProgram("hj.cl"));
+  std::vector<cl::Device> build_devices(1, queue.getInfo<CL_QUEUE_DEVICE>());
+  std::string options = width_build_options<K, V>() + " " +
+                        table_build_options(table.rids_per_key);
+  program.build(build_devices, options.c_str());
+  cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl_uint> build(
+      program, "build");
+  cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer,
+                  cl_uint>
+      probe(program, "probe");
+
+  cl::Buffer R_buf(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
+                   sizeof(BasicTuple<K, V>) * R.size(), &R[0]);
+  cl::Buffer S_buf(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
+                   sizeof(BasicTuple<K, V>) * S.size(), &S[0]);
+  huge_vector<K> bucket_keys(table.key_slots(), (K)-1);
+  huge_vector<V> bucket_key_rids(table.rid_slots(), (V)-1);
+  cl::Buffer bucket_keys_buf(context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR,
+                             sizeof(K) * table.key_slots(), &bucket_keys[0]);
+  cl::Buffer bucket_key_rids_buf(
+      context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR,
+      sizeof(V) * table.rid_slots(), &bucket_key_rids[0]);
+  cl::Buffer result_rid_buf(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                            sizeof(V) * S.size() * MAX_RIDS_PER_KEY);
+  cl::Buffer result_count_buf(context,
+                              CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                              sizeof(uint32_t) * S.size());
+
+  WidthJoinStats st;
+  st.table_bytes =
+      sizeof(K) * table.key_slots() + sizeof(V) * table.rid_slots();
+  util::Timer timer;
+  timer.reset();
+  build(cl::EnqueueArgs(queue, cl::NDRange(R.size())), R_buf,
+        bucket_keys_buf, bucket_key_rids_buf, table.buckets);
+  queue.finish();
+  st.build_ms = timer.getTimeMilliseconds();
+
+  timer.reset();
+  probe(cl::EnqueueArgs(queue, cl::NDRange(S.size())), S_buf,
+        bucket_keys_buf, bucket_key_rids_buf, result_rid_buf,
+        result_count_buf, table.buckets);
+  queue.finish();
+  st.probe_ms = timer.getTimeMilliseconds();
+
+  MappedView<V> rids(queue, result_rid_buf, S.size() * MAX_RIDS_PER_KEY);
+  MappedView<uint32_t> counts(queue, result_count_buf, S.size());
+  st.results =
+      materialize_results(&S[0], rids.data(), counts.data(), S.size()).size();
+  return st;
+}
+
+// R and S with every key k replaced by k * an odd 64-bit constant: a
+// bijection, so the join has the same matches, with keys that use all 64
+// bits
+inline huge_vector<BasicTuple<uint64_t, uint32_t>>
+widen_keys(const huge_vector<Tuple> &in) {
+  huge_vector<BasicTuple<uint64_t, uint32_t>> out(in.size());
+  for (size_t i = 0; i < in.size(); i++) {
+    out[i].key = in[i].key * 0x9E3779B97F4A7C15ull;
+    out[i].rid = in[i].rid;
+  }
+  return out;
+}
+
+inline void print_width_stats(const char *label, size_t tuple_bytes,
+                              const WidthJoinStats &st, size_t n) {
+  std::cout << label << ": " << tuple_bytes << "-byte tuples, table "
+            << (st.table_bytes >> 20) << " MB, build " << st.build_ms
+            << " ms, probe " << st.probe_ms << " ms ("
+            << (st.probe_ms > 0 ? n / st.probe_ms / 1000.0 : 0)
+            << " M tuples/s), " << st.results << " results" << std::endl;
+}
+
+// The fused join with 32-bit and with 64-bit keys on the same data
+inline void run_width_benchmark(const cl::Context &context,
+                                cl::CommandQueue &queue,
+                                huge_vector<Tuple> &R, huge_vector<Tuple> &S,
+                                const TableSize &table) {
+  WidthJoinStats narrow =
+      run_width_join<uint32_t, uint32_t>(context, queue, R, S, table);
+  print_width_stats("32-bit keys", sizeof(Tuple), narrow, S.size());
+
+  huge_vector<BasicTuple<uint64_t, uint32_t>> R64 = widen_keys(R);
+  huge_vector<BasicTuple<uint64_t, uint32_t>> S64 = widen_keys(S);
+  WidthJoinStats wide =
+      run_width_join<uint64_t, uint32_t>(context, queue, R64, S64, table);
+  print_width_stats("64-bit keys", sizeof(R64[0]), wide, S.size());
+  if (wide.results != narrow.results)
+    std::cout << "Width result count MISMATCH" << std::endl;
+}